@@ -49,24 +49,67 @@
 #define __FLEX_LEXER_H
 
 #include <iostream>
+#ifdef YY_LARGE_INPUT
+#include <cstddef>
+#include <climits>
+#endif
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 
 extern "C++" {
 
 struct yy_buffer_state;
 typedef int yy_state_type;
 
+// The type of buffer sizes, offsets into buffers, and yyleng.  A scanner
+// generated with %option large-input defines YY_LARGE_INPUT before
+// including this file, and so must every other source that includes it
+// for that scanner.
+#ifdef YY_LARGE_INPUT
+typedef std::ptrdiff_t yy_len_t;
+#else
+typedef int yy_len_t;
+#endif
+
+// The layout and virtual functions of the classes below depend on
+// yy_len_t.  A source that disagrees with the scanner about
+// YY_LARGE_INPUT would quietly break the one-definition rule, so
+// YY_LARGE_INPUT puts the classes in an inline namespace, and such a
+// program fails to link instead.
+#ifdef YY_LARGE_INPUT
+#define YY_FLEXLEXER_NAMESPACE_BEGIN inline namespace yy_large_input {
+#define YY_FLEXLEXER_NAMESPACE_END }
+#else
+#define YY_FLEXLEXER_NAMESPACE_BEGIN
+#define YY_FLEXLEXER_NAMESPACE_END
+#endif
+
+YY_FLEXLEXER_NAMESPACE_BEGIN
+
 class FlexLexer
 {
 public:
   virtual ~FlexLexer()        { }
 
   const char* YYText() const  { return yytext; }
+#ifdef YY_LARGE_INPUT
+  int YYLeng()        const
+    { return yyleng > INT_MAX ? INT_MAX : (int) yyleng; }
+#else
   int YYLeng()        const   { return yyleng; }
+#endif
+#if __cplusplus >= 201703L
+  // The matched text, which needs no NUL terminator: with
+  // %option token-view, YYText() is not NUL-terminated.
+  std::string_view YYView() const
+    { return std::string_view( yytext, (size_t) yyleng ); }
+#endif
 
   virtual void
   yy_switch_to_buffer( yy_buffer_state* new_buffer ) = 0;
-  virtual yy_buffer_state* yy_create_buffer( std::istream* s, int size ) = 0;
-  virtual yy_buffer_state* yy_create_buffer( std::istream& s, int size ) = 0;
+  virtual yy_buffer_state* yy_create_buffer( std::istream* s, yy_len_t size ) = 0;
+  virtual yy_buffer_state* yy_create_buffer( std::istream& s, yy_len_t size ) = 0;
   virtual void yy_delete_buffer( yy_buffer_state* b ) = 0;
   virtual void yyrestart( std::istream* s ) = 0;
   virtual void yyrestart( std::istream& s ) = 0;
@@ -100,11 +143,13 @@ public:
 
 protected:
   char* yytext;
-  int yyleng;
+  yy_len_t yyleng;
   int yylineno;       // only maintained if you use %option yylineno
   int yyflexdebug;    // only has effect with -d or "%option debug"
 };
 
+YY_FLEXLEXER_NAMESPACE_END
+
 }
 #endif // FLEXLEXER_H
 
@@ -116,6 +161,8 @@ protected:
 
 extern "C++" {
 
+YY_FLEXLEXER_NAMESPACE_BEGIN
+
 class yyFlexLexer : public FlexLexer {
 public:
   // arg_yyin and arg_yyout default to the cin and cout, but we
@@ -130,8 +177,8 @@ public:
   virtual ~yyFlexLexer();
 
   void yy_switch_to_buffer( yy_buffer_state* new_buffer );
-  yy_buffer_state* yy_create_buffer( std::istream* s, int size );
-  yy_buffer_state* yy_create_buffer( std::istream& s, int size );
+  yy_buffer_state* yy_create_buffer( std::istream* s, yy_len_t size );
+  yy_buffer_state* yy_create_buffer( std::istream& s, yy_len_t size );
   void yy_delete_buffer( yy_buffer_state* b );
   void yyrestart( std::istream* s );
   void yyrestart( std::istream& s );
@@ -176,7 +223,7 @@ protected:
   char yy_hold_char;
 
   // Number of characters read into yy_ch_buf.
-  int yy_n_chars;
+  yy_len_t yy_n_chars;
 
   // Points to current character in buffer.
   char* yy_c_buf_p;
@@ -200,6 +247,19 @@ protected:
   yy_state_type yy_last_accepting_state;
   char* yy_last_accepting_cpos;
 
+  // Where yy_get_previous_state() left off in the current token.
+  yy_len_t yy_resume_len;
+  yy_state_type yy_resume_state;
+  yy_len_t yy_resume_accepting;
+  yy_state_type yy_resume_accepting_state;
+
+  // NUL-terminated copy of the current token, made on demand under
+  // %option token-view when an action uses yytext.
+  char* yy_token_text();
+  char* yy_token_buf;
+  yy_len_t yy_token_buf_size;
+  int yy_token_valid;
+
   yy_state_type* yy_state_buf;
   yy_state_type* yy_state_ptr;
   size_t yy_state_buf_max;
@@ -212,11 +272,13 @@ protected:
   int yy_looking_for_trail_begin;
 
   int yy_more_flag;
-  int yy_more_len;
-  int yy_more_offset;
-  int yy_prev_more_offset;
+  yy_len_t yy_more_len;
+  yy_len_t yy_more_offset;
+  yy_len_t yy_prev_more_offset;
 };
 
+YY_FLEXLEXER_NAMESPACE_END
+
 }
 
 #endif // yyFlexLexer || ! yyFlexLexerOnce
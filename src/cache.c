@@ -0,0 +1,545 @@
+/* cache - reuse the DFA and tables of an earlier run on the same rules */
+
+/*  This file is part of flex. */
+
+/*  Redistribution and use in source and binary forms, with or without */
+/*  modification, are permitted provided that the following conditions */
+/*  are met: */
+
+/*  1. Redistributions of source code must retain the above copyright */
+/*     notice, this list of conditions and the following disclaimer. */
+/*  2. Redistributions in binary form must reproduce the above copyright */
+/*     notice, this list of conditions and the following disclaimer in the */
+/*     documentation and/or other materials provided with the distribution. */
+
+/*  Neither the name of the University nor the names of its contributors */
+/*  may be used to endorse or promote products derived from this software */
+/*  without specific prior written permission. */
+
+/*  THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR */
+/*  IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED */
+/*  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR */
+/*  PURPOSE. */
+
+#include "flexdef.h"
+#include "tables.h"
+#include "version.h"
+#include <sys/stat.h>
+#include <errno.h>
+
+/* With --cache-dir, the output of ntod() and of make_tables() is kept in
+ * a file named for a hash of everything they read: the NFA built from
+ * the patterns, the start conditions, the character and equivalence
+ * classes, the rule types and the options and back end that shape the
+ * tables.  None of that changes when only actions or user code do, so
+ * the next run on the same rules copies the saved output instead of
+ * building the DFA and compressing the tables again.  The action text,
+ * rule line numbers and everything else are still written fresh.
+ *
+ * A part is recorded by pointing the out() family and table_bodies at
+ * temporary files, and is then written to the real output the same way
+ * whether it was just recorded or read from the cache.  Besides the two
+ * parts, an entry keeps what main() reads between them: rule_useful[],
+ * jambase, jamstate, tblend, whether there is a NUL transition table,
+ * and the rules ntod() warned about.
+ *
+ * The key is stored in the entry and compared in full, so a hash
+ * collision costs only a miss.  Runs that also write reports from the
+ * DFA (-b, -v, -T, --tune-tables) or the tables (--tables-file) are not
+ * cached.
+ */
+
+struct cache_buf {
+	char   *str;
+	size_t  len, max;
+};
+
+/* One recorded part of the output. */
+struct cache_part {
+	struct cache_buf text;	/* what went to stdout, markers included */
+	struct cache_buf bodies;	/* the table bodies the markers refer to */
+};
+
+static const char cache_magic[] = "flex cache 1\n";
+
+static bool cache_active;	/* this run uses the cache */
+static bool cache_hit;		/* ... and the entry was there */
+static char *cache_path;	/* the entry's file */
+static struct cache_buf cache_key;
+static struct cache_buf cache_warnings;	/* rule numbers and messages */
+static struct cache_part cache_parts[CACHE_PARTS];
+static int cache_state[4];	/* nultrans != NULL, jambase, jamstate, tblend */
+
+/* The files a part is being recorded to, and the table_bodies they
+ * stand in for.
+ */
+static FILE *record_text, *record_bodies, *saved_bodies;
+
+
+/* buf_add - append n bytes to a buffer */
+
+static void buf_add (struct cache_buf *buf, const void *p, size_t n)
+{
+	if (buf->len + n + 1 > buf->max) {
+		buf->max = MAX (2 * buf->max, buf->len + n + 1);
+		buf->str = realloc (buf->str, buf->max);
+		if (buf->str == NULL)
+			flexfatal (_("memory allocation failed in buf_add()"));
+	}
+	memcpy (buf->str + buf->len, p, n);
+	buf->len += n;
+	buf->str[buf->len] = '\0';
+}
+
+static void key_ints (const int *a, int n)
+{
+	if (n > 0)
+		buf_add (&cache_key, a, (size_t) n * sizeof (int));
+}
+
+static void key_int (int n)
+{
+	key_ints (&n, 1);
+}
+
+static void key_str (const char *str)
+{
+	size_t  len = str != NULL ? strlen (str) : 0;
+
+	key_int (str != NULL ? (int) len : -1);
+	buf_add (&cache_key, str != NULL ? str : "", len);
+}
+
+
+/* make_key - gather everything ntod() and make_tables() read */
+
+static void make_key (void)
+{
+	int     i, tblsize = 0;
+
+	key_str ("flex " FLEX_VERSION);
+
+	/* Options and back-end properties. */
+	key_int (ctrl.csize);
+	key_int (ctrl.fullspd);
+	key_int (ctrl.fulltbl);
+	key_int (ctrl.useecs);
+	key_int (ctrl.usemecs);
+	key_int (ctrl.long_align);
+	key_int (ctrl.do_yylineno);
+	key_str (ctrl.backend_name);
+	key_int (ctrl.have_state_entry_format);
+	key_int (env.minimize);
+	key_int (env.pack);
+	key_int (env.proto_index);
+
+	/* The rules. */
+	key_int (num_rules);
+	key_int (default_rule);
+	key_int (reject);
+	key_int (variable_trailing_context_rules);
+	key_ints (rule_type, num_rules + 1);
+	for (i = 0; i <= num_rules; ++i)
+		key_int (rule_has_nl[i]);
+
+	/* The bounds of the loops left by --counted-repeats, which the
+	 * tables carry but the NFA does not.
+	 */
+	key_int (env.counted_repeats);
+	key_int (num_counted_repeats);
+	for (i = 1; i <= num_rules; ++i)
+		key_int (counted_repeat_limit (i));
+
+	/* The NFA. */
+	key_int (lastnfa);
+	key_ints (firstst, lastnfa + 1);
+	key_ints (lastst, lastnfa + 1);
+	key_ints (finalst, lastnfa + 1);
+	key_ints (transchar, lastnfa + 1);
+	key_ints (trans1, lastnfa + 1);
+	key_ints (trans2, lastnfa + 1);
+	key_ints (accptnum, lastnfa + 1);
+	key_ints (assoc_rule, lastnfa + 1);
+	key_ints (state_type, lastnfa + 1);
+
+	/* Start conditions. */
+	key_int (lastsc);
+	key_ints (scset, lastsc + 1);
+	key_ints (scbol, lastsc + 1);
+
+	/* Character and equivalence classes. */
+	key_int (numecs);
+	key_int (NUL_ec);
+	key_ints (ecgroup, CSIZE + 1);
+	key_int (lastccl);
+	key_ints (cclmap, lastccl + 1);
+	key_ints (ccllen, lastccl + 1);
+	key_ints (cclng, lastccl + 1);
+	for (i = 1; i <= lastccl; ++i)
+		tblsize = MAX (tblsize, cclmap[i] + ccllen[i]);
+	key_int (tblsize);
+	buf_add (&cache_key, ccltbl, (size_t) tblsize);
+}
+
+
+/* cache_warn - report a problem with the cache itself
+ *
+ * The cache only saves time, so nothing that goes wrong with it stops
+ * flex.
+ */
+
+static void cache_warn (const char *msg, const char *arg)
+{
+	if (!env.nowarn) {
+		fprintf (flex_run->err, "%s: warning, ", program_name);
+		fprintf (flex_run->err, msg, arg);
+		putc ('\n', flex_run->err);
+	}
+}
+
+
+static bool get (FILE *fp, void *p, size_t n)
+{
+	return fread (p, 1, n, fp) == n;
+}
+
+static bool get_buf (FILE *fp, struct cache_buf *buf)
+{
+	size_t  len;
+	char   *str;
+
+	buf->len = 0;
+	if (!get (fp, &len, sizeof len))
+		return false;
+
+	/* A damaged entry can claim any length. */
+	if ((str = realloc (buf->str, len + 1)) == NULL)
+		return false;
+	buf->str = str;
+	buf->max = len + 1;
+	buf->str[len] = '\0';
+	buf->len = len;
+
+	return get (fp, buf->str, len);
+}
+
+static void put_buf (FILE *fp, const struct cache_buf *buf)
+{
+	fwrite (&buf->len, sizeof buf->len, 1, fp);
+	fwrite (buf->str != NULL ? buf->str : "", 1, buf->len, fp);
+}
+
+
+/* read_entry - read the entry at cache_path if it has cache_key */
+
+static bool read_entry (void)
+{
+	struct cache_buf key = { NULL, 0, 0 };
+	char    magic[sizeof cache_magic];
+	size_t  usefulsz = (size_t) (num_rules + 1) * sizeof (int);
+	int    *useful;
+	bool    ok;
+	int     i;
+	FILE   *fp;
+
+	if ((fp = fopen (cache_path, "rb")) == NULL)
+		return false;
+
+	useful = allocate_integer_array (num_rules + 1);
+
+	ok = get (fp, magic, sizeof magic) &&
+		memcmp (magic, cache_magic, sizeof magic) == 0 &&
+		get_buf (fp, &key) && key.len == cache_key.len &&
+		memcmp (key.str, cache_key.str, key.len) == 0 &&
+		get (fp, cache_state, sizeof cache_state) &&
+		get (fp, useful, usefulsz) &&
+		get_buf (fp, &cache_warnings);
+
+	for (i = 0; ok && i < CACHE_PARTS; ++i)
+		ok = get_buf (fp, &cache_parts[i].text) &&
+			get_buf (fp, &cache_parts[i].bodies);
+
+	/* A short entry is as good as none. */
+	if (ok)
+		memcpy (rule_useful, useful, usefulsz);
+	else
+		cache_warnings.len = 0;
+
+	fclose (fp);
+	free (useful);
+	free (key.str);
+	return ok;
+}
+
+
+/* cache_lookup - look for the output of ntod() and make_tables()
+ *
+ * Returns true if the cache has it, in which case the state ntod() leaves
+ * for main() is restored and ntod()'s warnings repeated, and neither
+ * function need be called; cache_replay() writes their output.
+ */
+
+bool cache_lookup (void)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t  i;
+	char   *p;
+
+	if (env.cache_dir == NULL || table_bodies == NULL || tablesext ||
+	    env.backing_up_report || env.printstats || env.trace ||
+	    env.tune_tables)
+		return false;
+
+	cache_active = true;
+	make_key ();
+
+	/* 64-bit FNV-1a names the entry. */
+	for (i = 0; i < cache_key.len; ++i) {
+		hash ^= (unsigned char) cache_key.str[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	cache_path = malloc (strlen (env.cache_dir) + 32);
+	if (cache_path == NULL)
+		flexfatal (_("memory allocation failed in cache_lookup()"));
+	sprintf (cache_path, "%s/%016llx.flexcache", env.cache_dir,
+		 (unsigned long long) hash);
+
+	if (!read_entry ()) {
+		stats_cache (false);
+		return false;
+	}
+
+	cache_hit = true;
+	stats_cache (true);
+
+	if (cache_state[0])
+		/* Only its presence matters; the table is in the output. */
+		nultrans = allocate_integer_array (1);
+	jambase = cache_state[1];
+	jamstate = cache_state[2];
+	tblend = cache_state[3];
+
+	for (p = cache_warnings.str; p < cache_warnings.str + cache_warnings.len;
+	     p += strlen (p) + 1) {
+		int     rule;
+
+		memcpy (&rule, p, sizeof rule);
+		p += sizeof rule;
+		line_warning (p, rule_linenum[rule]);
+	}
+
+	return true;
+}
+
+
+/* cache_rule_warning - warn about a rule while building the DFA
+ *
+ * The warning is kept with the entry, to be given again with the rule's
+ * line number at that time.
+ */
+
+void cache_rule_warning (const char *msg, int rule)
+{
+	line_warning (msg, rule_linenum[rule]);
+
+	if (cache_active && !cache_hit) {
+		buf_add (&cache_warnings, &rule, sizeof rule);
+		buf_add (&cache_warnings, msg, strlen (msg) + 1);
+	}
+}
+
+
+/* cache_record - start recording a part of the output */
+
+void cache_record (int part)
+{
+	(void) part;
+
+	if (!cache_active || cache_hit)
+		return;
+
+	if ((record_text = tmpfile ()) == NULL ||
+	    (record_bodies = tmpfile ()) == NULL)
+		flexerror (_("could not create temporary file"));
+
+	saved_bodies = table_bodies;
+	table_bodies = record_bodies;
+	out_redirect (record_text);
+}
+
+
+/* slurp - read a recorded file back into a buffer, and close it */
+
+static void slurp (FILE *fp, struct cache_buf *buf)
+{
+	char    block[65536];
+	size_t  n;
+
+	if (fflush (fp) != 0 || fseeko (fp, 0, SEEK_SET) != 0)
+		flexerror (_("error rereading temporary file"));
+
+	buf->len = 0;
+	while ((n = fread (block, 1, sizeof block, fp)) > 0)
+		buf_add (buf, block, n);
+
+	if (ferror (fp))
+		flexerror (_("error rereading temporary file"));
+	fclose (fp);
+}
+
+
+/* cache_replay - write a part of the output that was just recorded or
+ * that came from the cache
+ */
+
+void cache_replay (int part)
+{
+	struct cache_part *cp = &cache_parts[part];
+	off_t   base;
+	char   *p, *marker;
+
+	if (!cache_active)
+		return;
+
+	if (!cache_hit) {
+		out_redirect (NULL);
+		table_bodies = saved_bodies;
+		slurp (record_text, &cp->text);
+		slurp (record_bodies, &cp->bodies);
+		record_text = record_bodies = NULL;
+
+		if (part == CACHE_DFA) {
+			cache_state[0] = nultrans != NULL;
+			cache_state[1] = jambase;
+			cache_state[2] = jamstate;
+			cache_state[3] = tblend;
+		}
+	}
+
+	/* The bodies go after whatever table_bodies already holds, so the
+	 * offsets in the markers move up by that much.
+	 */
+	base = ftello (table_bodies);
+	if (cp->bodies.len > 0 &&
+	    fwrite (cp->bodies.str, 1, cp->bodies.len, table_bodies) !=
+	    cp->bodies.len)
+		flexerror (_("error writing table bodies"));
+	if (fflush (table_bodies) != 0)
+		flexerror (_("error writing table bodies"));
+
+	if (cp->text.str == NULL)
+		return;
+
+	for (p = cp->text.str; (marker = strstr (p, TABLE_BODY_MARKER)) != NULL;) {
+		long long off, len;
+
+		fwrite (p, 1, (size_t) (marker - p), flex_run->out);
+		p = marker + strlen (TABLE_BODY_MARKER);
+		off = strtoll (p, &p, 10);
+		len = strtoll (p, &p, 10);
+		fprintf (flex_run->out, TABLE_BODY_MARKER "%lld %lld",
+			 off + (long long) base, len);
+	}
+	fputs (p, flex_run->out);
+}
+
+
+/* cache_store - save the recorded parts, if they were recorded */
+
+void cache_store (void)
+{
+	char   *tmpname;
+	bool    bad;
+	FILE   *fp;
+	int     fd, i;
+
+	if (!cache_active || cache_hit)
+		return;
+
+	if (mkdir (env.cache_dir, 0777) != 0 && errno != EEXIST) {
+		cache_warn (_("could not create cache directory %s"),
+			    env.cache_dir);
+		return;
+	}
+
+	tmpname = malloc (strlen (cache_path) + 8);
+	if (tmpname == NULL)
+		flexfatal (_("memory allocation failed in cache_store()"));
+	sprintf (tmpname, "%s.XXXXXX", cache_path);
+
+	if ((fd = mkstemp (tmpname)) == -1 ||
+	    (fp = fdopen (fd, "wb")) == NULL) {
+		cache_warn (_("could not write cache file %s"), cache_path);
+		if (fd != -1) {
+			close (fd);
+			unlink (tmpname);
+		}
+		free (tmpname);
+		return;
+	}
+
+	fwrite (cache_magic, 1, sizeof cache_magic, fp);
+	put_buf (fp, &cache_key);
+	fwrite (cache_state, sizeof cache_state, 1, fp);
+	fwrite (rule_useful, sizeof (int), (size_t) num_rules + 1, fp);
+	put_buf (fp, &cache_warnings);
+	for (i = 0; i < CACHE_PARTS; ++i) {
+		put_buf (fp, &cache_parts[i].text);
+		put_buf (fp, &cache_parts[i].bodies);
+	}
+
+	/* Renaming the finished file into place keeps a concurrent run
+	 * from reading half an entry.
+	 */
+	bad = ferror (fp) != 0;
+	if (fclose (fp) != 0 || bad || rename (tmpname, cache_path) != 0) {
+		cache_warn (_("could not write cache file %s"), cache_path);
+		unlink (tmpname);
+	}
+
+	free (tmpname);
+}
+
+
+/* buf_free - empty a buffer and give back its memory */
+
+static void buf_free (struct cache_buf *buf)
+{
+	free (buf->str);
+	buf->str = NULL;
+	buf->len = buf->max = 0;
+}
+
+
+/* cache_cleanup - forget this run's entry, once the run is over
+ *
+ * A run that ended in an error may still be recording a part; its files
+ * are dropped and table_bodies is given back.
+ */
+
+void cache_cleanup (void)
+{
+	int     i;
+
+	if (record_text != NULL) {
+		out_redirect (NULL);
+		fclose (record_text);
+		record_text = NULL;
+	}
+	if (record_bodies != NULL) {
+		table_bodies = saved_bodies;
+		fclose (record_bodies);
+		record_bodies = saved_bodies = NULL;
+	}
+
+	cache_active = cache_hit = false;
+	free (cache_path);
+	cache_path = NULL;
+	buf_free (&cache_key);
+	buf_free (&cache_warnings);
+	for (i = 0; i < CACHE_PARTS; ++i) {
+		buf_free (&cache_parts[i].text);
+		buf_free (&cache_parts[i].bodies);
+	}
+}
@@ -33,20 +33,98 @@
 
 #include "flexdef.h"
 
+/* Membership bitsets of the ccls, CCL_WORDS words to a ccl: bit ch of
+ * ccl i is set if ch has been added to ccl i.  Negation is not folded in;
+ * cclng[] still says whether the ccl is negated.  ccltbl[] keeps listing
+ * the members for ecs.c and dfa.c, but is never searched here, so tests
+ * and set operations cost a few word operations rather than a scan of
+ * the class.
+ *
+ * ccltbl_used is the number of characters of ccltbl[] in use.  It is not
+ * always cclmap[lastccl] + ccllen[lastccl], since a ccl that grows after
+ * a later one was made is moved to the end of the table.
+ */
+#define CCL_WORDS (CSIZE / 64)
+#define CCL_BITS(cclp) (cclbits + (size_t) (cclp) * CCL_WORDS)
+
+static uint64_t *cclbits;
+static int cclbits_size, ccltbl_used;
+
+/* ccl_room - make room for n more characters at the end of ccltbl */
+
+static void ccl_room (int n)
+{
+	if (ccltbl_used + n <= current_max_ccl_tbl_size)
+		return;
+
+	while (ccltbl_used + n > current_max_ccl_tbl_size)
+		current_max_ccl_tbl_size += MAX_CCL_TBL_SIZE_INCREMENT;
+
+	++num_reallocs;
+
+	ccltbl = reallocate_Character_array (ccltbl,
+					     current_max_ccl_tbl_size);
+}
+
+/* ccl_members - the characters a ccl matches, negation included */
+
+static void ccl_members (int cclp, uint64_t set[])
+{
+	uint64_t *bits = CCL_BITS (cclp);
+	int     i;
+
+	for (i = 0; i < CCL_WORDS; ++i)
+		set[i] = cclng[cclp] ? ~bits[i] : bits[i];
+
+	/* Clear what lies beyond the character set. */
+	for (i = 0; i < CCL_WORDS; ++i)
+		if (ctrl.csize <= i * 64)
+			set[i] = 0;
+		else if (ctrl.csize < (i + 1) * 64)
+			set[i] &= ((uint64_t) 1 << (ctrl.csize - i * 64)) - 1;
+}
+
+/* ccl_from_set - return a new ccl holding the characters of a bitset */
+
+static int ccl_from_set (uint64_t set[])
+{
+	int     cclp, i, n, ch;
+	uint64_t word;
+
+	cclp = cclinit ();
+
+	for (n = i = 0; i < CCL_WORDS; ++i)
+		for (word = set[i]; word; word &= word - 1)
+			++n;
+
+	ccl_room (n);
+
+	/* List the members in increasing order. */
+	for (i = 0; i < CCL_WORDS; ++i)
+		for (ch = i * 64, word = set[i]; word; ++ch, word >>= 1)
+			if (word & 1)
+				ccltbl[ccltbl_used++] = (unsigned char) ch;
+
+	memcpy (CCL_BITS (cclp), set, CCL_WORDS * sizeof (uint64_t));
+	ccllen[cclp] = n;
+
+	if (nlch >= 0 && nlch < CSIZE &&
+	    (set[nlch / 64] >> (nlch % 64)) & 1)
+		ccl_has_nl[cclp] = true;
+
+	return cclp;
+}
+
 /* return true if the chr is in the ccl. Takes negation into account. */
-static bool
+bool
 ccl_contains (const int cclp, const int ch)
 {
-	int     ind, len, i;
-
-	len = ccllen[cclp];
-	ind = cclmap[cclp];
+	bool    in;
 
-	for (i = 0; i < len; ++i)
-		if (ccltbl[ind + i] == ch)
-			return !cclng[cclp];
+	in = ch >= 0 && ch < CSIZE &&
+		((CCL_BITS (cclp)[ch / 64] >> (ch % 64)) & 1);
 
-    return cclng[cclp];
+	return cclng[cclp] ? !in : in;
 }
 
 
@@ -54,43 +132,45 @@ ccl_contains (const int cclp, const int ch)
 
 void ccladd (int cclp, int ch)
 {
-	int     ind, len, newpos, i;
+	uint64_t *bits;
+	int     len;
 
 	check_char (ch);
 
-	len = ccllen[cclp];
-	ind = cclmap[cclp];
+	if (ch < 0 || ch >= CSIZE)
+		/* check_char() has complained; there is no bit for it */
+		return;
 
 	/* check to see if the character is already in the ccl */
+	bits = CCL_BITS (cclp);
+
+	if ((bits[ch / 64] >> (ch % 64)) & 1)
+		return;
 
-	for (i = 0; i < len; ++i)
-		if (ccltbl[ind + i] == ch)
-			return;
+	bits[ch / 64] |= (uint64_t) 1 << (ch % 64);
 
 	/* mark newlines */
 	if (ch == nlch)
 		ccl_has_nl[cclp] = true;
 
-	newpos = ind + len;
-
-	/* For a non-last cclp, expanding the set will overflow and overwrite a
-	 * char in the next cclp.
-	 * FIXME: Need another allocation scheme for ccl's. */
-	if (cclp != lastccl) {
-		flexfatal(_("internal error: trying to add a char to a non-last ccl.\n"));
-	}
-
-	if (newpos >= current_max_ccl_tbl_size) {
-		current_max_ccl_tbl_size += MAX_CCL_TBL_SIZE_INCREMENT;
-
-		++num_reallocs;
+	len = ccllen[cclp];
 
-		ccltbl = reallocate_Character_array (ccltbl,
-						     current_max_ccl_tbl_size);
+	if (cclmap[cclp] + len != ccltbl_used) {
+		/* Some other ccl follows this one in ccltbl.  Move this one to
+		 * the end of the table, where it has room to grow; its old
+		 * place is left unused.
+		 */
+		ccl_room (len + 1);
+		memmove (ccltbl + ccltbl_used, ccltbl + cclmap[cclp],
+			 (size_t) len);
+		cclmap[cclp] = ccltbl_used;
+		ccltbl_used += len;
 	}
+	else
+		ccl_room (1);
 
+	ccltbl[ccltbl_used++] = (unsigned char) ch;
 	ccllen[cclp] = len + 1;
-	ccltbl[newpos] = (unsigned char) ch;
 }
 
 /* dump_cclp - same thing as list_character_set, but for cclps.  */
@@ -129,29 +209,30 @@ static void    dump_cclp (FILE* file, int cclp)
 int
 ccl_set_diff (int a, int b)
 {
-    int  d, ch;
-
-    /* create new class  */
-    d = cclinit();
+    uint64_t  seta[CCL_WORDS], setb[CCL_WORDS];
+    int  d, i;
 
-    /* In order to handle negation, we spin through all possible chars,
-     * addding each char in a that is not in b.
-     * (This could be O(n^2), but n is small and bounded.)
+    /* Negation is folded into both sets, so the difference is just
+     * "in a and not in b", a word at a time.
      */
-	for ( ch = 0; ch < ctrl.csize; ++ch )
-        if (ccl_contains (a, ch) && !ccl_contains(b, ch))
-            ccladd (d, ch);
+    ccl_members (a, seta);
+    ccl_members (b, setb);
+
+    for (i = 0; i < CCL_WORDS; ++i)
+        seta[i] &= ~setb[i];
+
+    d = ccl_from_set (seta);
 
     /* debug */
     if (0){
-        fprintf(stderr, "ccl_set_diff (");
-            fprintf(stderr, "\n    ");
-            dump_cclp (stderr, a);
-            fprintf(stderr, "\n    ");
-            dump_cclp (stderr, b);
-            fprintf(stderr, "\n    ");
-            dump_cclp (stderr, d);
-        fprintf(stderr, "\n)\n");
+        fprintf(flex_run->err, "ccl_set_diff (");
+            fprintf(flex_run->err, "\n    ");
+            dump_cclp (flex_run->err, a);
+            fprintf(flex_run->err, "\n    ");
+            dump_cclp (flex_run->err, b);
+            fprintf(flex_run->err, "\n    ");
+            dump_cclp (flex_run->err, d);
+        fprintf(flex_run->err, "\n)\n");
     }
     return d;
 }
@@ -160,29 +241,27 @@ ccl_set_diff (int a, int b)
 int
 ccl_set_union (int a, int b)
 {
+    uint64_t  set[CCL_WORDS];
     int  d, i;
 
-    /* create new class  */
-    d = cclinit();
-
-    /* Add all of a */
-    for (i = 0; i < ccllen[a]; ++i)
-		ccladd (d, ccltbl[cclmap[a] + i]);
+    /* The union is of the characters listed in a and b, as it always
+     * has been; negation is not taken into account.
+     */
+    for (i = 0; i < CCL_WORDS; ++i)
+        set[i] = CCL_BITS (a)[i] | CCL_BITS (b)[i];
 
-    /* Add all of b */
-    for (i = 0; i < ccllen[b]; ++i)
-		ccladd (d, ccltbl[cclmap[b] + i]);
+    d = ccl_from_set (set);
 
     /* debug */
     if (0){
-        fprintf(stderr, "ccl_set_union (%d + %d = %d", a, b, d);
-            fprintf(stderr, "\n    ");
-            dump_cclp (stderr, a);
-            fprintf(stderr, "\n    ");
-            dump_cclp (stderr, b);
-            fprintf(stderr, "\n    ");
-            dump_cclp (stderr, d);
-        fprintf(stderr, "\n)\n");
+        fprintf(flex_run->err, "ccl_set_union (%d + %d = %d", a, b, d);
+            fprintf(flex_run->err, "\n    ");
+            dump_cclp (flex_run->err, a);
+            fprintf(flex_run->err, "\n    ");
+            dump_cclp (flex_run->err, b);
+            fprintf(flex_run->err, "\n    ");
+            dump_cclp (flex_run->err, d);
+        fprintf(flex_run->err, "\n)\n");
     }
     return d;
 }
@@ -207,19 +286,19 @@ int     cclinit (void)
 					       current_maxccls);
 	}
 
+	if (cclbits_size < current_maxccls) {
+		cclbits_size = current_maxccls;
+		cclbits = reallocate_array (cclbits, cclbits_size,
+					    CCL_WORDS * sizeof (uint64_t));
+	}
+
 	if (lastccl == 1)
 		/* we're making the first ccl */
-		cclmap[lastccl] = 0;
-
-	else
-		/* The new pointer is just past the end of the last ccl.
-		 * Since the cclmap points to the \first/ character of a
-		 * ccl, adding the length of the ccl to the cclmap pointer
-		 * will produce a cursor to the first free space.
-		 */
-		cclmap[lastccl] =
-			cclmap[lastccl - 1] + ccllen[lastccl - 1];
+		ccltbl_used = 0;
 
+	/* The new ccl starts at the first free space in ccltbl. */
+	cclmap[lastccl] = ccltbl_used;
+	memset (CCL_BITS (lastccl), 0, CCL_WORDS * sizeof (uint64_t));
 	ccllen[lastccl] = 0;
 	cclng[lastccl] = 0;	/* ccl's start out life un-negated */
 	ccl_has_nl[lastccl] = false;
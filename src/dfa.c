@@ -32,12 +32,42 @@
 #include "flexdef.h"
 #include "tables.h"
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 /* declare functions that have forward references */
 
 void	dump_associated_rules(FILE *, int);
 void	dump_transitions(FILE *, int[]);
-void	sympartition(int[], int, int[], int[]);
-int	symfollowset(int[], int, int, int[]);
+void	emit_dfa_state(int, int[], int, int, int, int);
+void	minimize_dfa(int);
+int	sympartition(int[], int, int[], int[]);
+
+
+/* Words in a mask over the equivalence classes 0 .. CSIZE. */
+#define ECMASK_WORDS ((CSIZE + 64) / 64)
+
+/* ecmasks holds, for each ccl and then for each character, the mask of
+ * the equivalence classes it matches.  ECMASK(ns) is the one for the
+ * transition out of nfa state ns, which must not be an epsilon.
+ */
+static uint64_t *ecmasks;
+
+#define ECMASK(ns) \
+	(ecmasks + ECMASK_WORDS * (size_t) \
+	 (transchar[ns] < 0 ? -transchar[ns] : lastccl + 1 + transchar[ns]))
+
+/* The targets of a dfa's out-transitions, bucketed by symbol; see
+ * symfollowset().
+ */
+struct sym_follow {
+	int     start[CSIZE + 2];	/* bucket of sym is from start[sym] */
+	int    *targets, max;
+};
+
+static bool symfollowset(int[], int, int[], int[], struct sym_follow *);
+static int follow_targets(struct sym_follow *, int, int[]);
 
 
 /* check_for_backing_up - check a DFA state for backing up
@@ -115,9 +145,9 @@ void check_trailing_context (int *nfa_states, int num_states, int *accset, int n
 			 */
 			for (j = 1; j <= nacc; ++j)
 				if (accset[j] & YY_TRAILING_HEAD_MASK) {
-					line_warning (_
-						      ("dangerous trailing context"),
-						      rule_linenum[ar]);
+					cache_rule_warning (_
+							    ("dangerous trailing context"),
+							    ar);
 					return;
 				}
 		}
@@ -206,129 +236,213 @@ void dump_transitions (FILE *file, int state[])
 }
 
 
-/* epsclosure - construct the epsilon closure of a set of ndfa states
+/* nfa_state_key - pseudo-random 64-bit key for an NFA state
  *
- * synopsis
- *    int *epsclosure( int t[num_states], int *numstates_addr,
- *			int accset[num_rules+1], int *nacc_addr,
- *			int *hashval_addr );
+ * The keys are summed to give the hash value of a set of NFA states.
+ * This is the "splitmix64" mixing function, so the keys of neighbouring
+ * states have no bits in common to speak of.
+ */
+
+static uint64_t nfa_state_key (int state)
+{
+	uint64_t z = (uint64_t) state * UINT64_C (0x9e3779b97f4a7c15);
+
+	z = (z ^ (z >> 30)) * UINT64_C (0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27)) * UINT64_C (0x94d049bb133111eb);
+
+	return z ^ (z >> 31);
+}
+
+
+/* Sets of NFA states, kept as "sparse sets": ns is a member if
+ * sparse[ns] < size and dense[sparse[ns]] == ns.  This makes clearing a
+ * set a constant-time operation, and dense[0 .. size-1] lists the members
+ * in the order in which they were added.
+ */
+
+struct nfa_set {
+	int    *dense, *sparse;
+	int     size, max;
+};
+
+/* The set being built by epsclosure(), and the one nfa_closure() uses to
+ * walk the epsilon transitions.  The -j worker threads each have their
+ * own set to build closures in.
+ */
+static struct nfa_set closure_set, closure_walk;
+
+/* closure_cache[ns] is the list of states that the epsilon closure of ns
+ * contributes, i.e., the states reachable from ns (including ns itself)
+ * by epsilon transitions which have either an accepting number or a
+ * non-epsilon out-transition.  Element 0 holds the length of the list.
+ * It's filled in the first time the closure of ns is needed, except
+ * with -j, where it's filled in for every state before the worker threads
+ * start, and only read from then on.
  *
- * NOTES
- *  The epsilon closure is the set of all states reachable by an arbitrary
- *  number of epsilon transitions, which themselves do not have epsilon
- *  transitions going out, unioned with the set of states which have non-null
- *  accepting numbers.  t is an array of size numstates of nfa state numbers.
- *  Upon return, t holds the epsilon closure and *numstates_addr is updated.
- *  accset holds a list of the accepting numbers, and the size of accset is
- *  given by *nacc_addr.  t may be subjected to reallocation if it is not
- *  large enough to hold the epsilon closure.
+ * The lists may take up at most MAX_CLOSURE_CACHE_WORDS in all.  Once
+ * they do, a closure that isn't cached is built in closure_scratch each
+ * time it's needed.
+ */
+static int **closure_cache, closure_cache_size;
+static int *closure_scratch, closure_scratch_max;
+
+
+/* nfa_set_add - add a state to a set of NFA states
  *
- *  hashval is the hash value for the dfa corresponding to the state set.
+ * Returns true if the state was not already in the set.
  */
 
-int    *epsclosure (int *t, int *ns_addr, int accset[], int *nacc_addr, int *hv_addr)
+static int nfa_set_add (struct nfa_set *set, int ns)
 {
-	int     stkpos, ns, tsp;
-	int     numstates = *ns_addr, nacc, hashval, transsym, nfaccnum;
-	int     stkend, nstate;
-	static int did_stk_init = false, *stk;
-
-#define MARK_STATE(state) \
-do{ trans1[state] = trans1[state] - MARKER_DIFFERENCE;} while(0)
-
-#define IS_MARKED(state) (trans1[state] < 0)
-
-#define UNMARK_STATE(state) \
-do{ trans1[state] = trans1[state] + MARKER_DIFFERENCE;} while(0)
-
-#define CHECK_ACCEPT(state) \
-do{ \
-nfaccnum = accptnum[state]; \
-if ( nfaccnum != NIL ) \
-accset[++nacc] = nfaccnum; \
-}while(0)
-
-#define DO_REALLOCATION() \
-do { \
-current_max_dfa_size += MAX_DFA_SIZE_INCREMENT; \
-++num_reallocs; \
-t = reallocate_integer_array( t, current_max_dfa_size ); \
-stk = reallocate_integer_array( stk, current_max_dfa_size ); \
-}while(0) \
-
-#define PUT_ON_STACK(state) \
-do { \
-if ( ++stkend >= current_max_dfa_size ) \
-DO_REALLOCATION(); \
-stk[stkend] = state; \
-MARK_STATE(state); \
-}while(0)
-
-#define ADD_STATE(state) \
-do { \
-if ( ++numstates >= current_max_dfa_size ) \
-DO_REALLOCATION(); \
-t[numstates] = state; \
-hashval += state; \
-}while(0)
-
-#define STACK_STATE(state) \
-do { \
-PUT_ON_STACK(state); \
-CHECK_ACCEPT(state); \
-if ( nfaccnum != NIL || transchar[state] != SYM_EPSILON ) \
-ADD_STATE(state); \
-}while(0)
-
-
-	if (!did_stk_init) {
-		stk = allocate_integer_array (current_max_dfa_size);
-		did_stk_init = true;
+	int     i;
+
+	if (ns >= set->max) {
+		i = set->max;
+		set->max = current_mns > ns ? current_mns : ns + 1;
+		set->dense = reallocate_integer_array (set->dense, set->max);
+		set->sparse = reallocate_integer_array (set->sparse, set->max);
+
+		for (; i < set->max; ++i)
+			set->sparse[i] = 0;
 	}
 
-	nacc = stkend = hashval = 0;
+	else if (set->sparse[ns] < set->size &&
+		 set->dense[set->sparse[ns]] == ns)
+		return false;
 
-	for (nstate = 1; nstate <= numstates; ++nstate) {
-		ns = t[nstate];
+	set->sparse[ns] = set->size;
+	set->dense[set->size++] = ns;
 
-		/* The state could be marked if we've already pushed it onto
-		 * the stack.
-		 */
-		if (!IS_MARKED (ns)) {
-			PUT_ON_STACK (ns);
-			CHECK_ACCEPT (ns);
-			hashval += ns;
-		}
+	return true;
+}
+
+
+/* nfa_closure - return the cached epsilon closure list of an NFA state
+ *
+ * If the cache is full, the list is good until the next call.
+ */
+
+static int *nfa_closure (int ns)
+{
+	int     pos, state, num, *list;
+
+	if (ns >= closure_cache_size) {
+		pos = closure_cache_size;
+		closure_cache_size = current_mns > ns ? current_mns : ns + 1;
+		closure_cache = reallocate_int_ptr_array (closure_cache,
+							  closure_cache_size);
+
+		for (; pos < closure_cache_size; ++pos)
+			closure_cache[pos] = NULL;
 	}
 
-	for (stkpos = 1; stkpos <= stkend; ++stkpos) {
-		ns = stk[stkpos];
-		transsym = transchar[ns];
+	if (closure_cache[ns])
+		return closure_cache[ns];
 
-		if (transsym == SYM_EPSILON) {
-			tsp = trans1[ns] + MARKER_DIFFERENCE;
+	/* Walk the epsilon transitions breadth-first, using the set's
+	 * list of members as the queue.
+	 */
+	closure_walk.size = 0;
+	nfa_set_add (&closure_walk, ns);
+	num = 0;
 
-			if (tsp != NO_TRANSITION) {
-				if (!IS_MARKED (tsp))
-					STACK_STATE (tsp);
+	for (pos = 0; pos < closure_walk.size; ++pos) {
+		state = closure_walk.dense[pos];
 
-				tsp = trans2[ns];
+		if (transchar[state] == SYM_EPSILON) {
+			if (trans1[state] != NO_TRANSITION) {
+				nfa_set_add (&closure_walk, trans1[state]);
 
-				if (tsp != NO_TRANSITION
-				    && !IS_MARKED (tsp))
-					STACK_STATE (tsp);
+				if (trans2[state] != NO_TRANSITION)
+					nfa_set_add (&closure_walk,
+						     trans2[state]);
 			}
+
+			if (accptnum[state] == NIL)
+				continue;
 		}
+
+		++num;
 	}
 
-	/* Clear out "visit" markers. */
+	if (closure_cache_words + num + 1 <= MAX_CLOSURE_CACHE_WORDS) {
+		list = closure_cache[ns] = allocate_integer_array (num + 1);
+		++num_cached_closures;
+		closure_cache_words += num + 1;
+	}
 
-	for (stkpos = 1; stkpos <= stkend; ++stkpos) {
-		if (IS_MARKED (stk[stkpos]))
-			UNMARK_STATE (stk[stkpos]);
-		else
-			flexfatal (_
-				   ("consistency check failed in epsclosure()"));
+	else {
+		if (num + 1 > closure_scratch_max) {
+			closure_scratch_max = num + 1;
+			closure_scratch = reallocate_integer_array (closure_scratch,
+								    closure_scratch_max);
+		}
+
+		list = closure_scratch;
+		++num_uncached_closures;
+	}
+
+	list[0] = 0;
+
+	for (pos = 0; pos < closure_walk.size; ++pos) {
+		state = closure_walk.dense[pos];
+
+		if (transchar[state] != SYM_EPSILON ||
+		    accptnum[state] != NIL)
+			list[++list[0]] = state;
+	}
+
+	return list;
+}
+
+
+/* closure_union - epsilon closure of a set of NFA states, built in set
+ *
+ * This is epsclosure() for a given set to build in, and with *max_addr
+ * the size of t, which is grown as needed.
+ */
+
+static int *closure_union (struct nfa_set *set, int *t, int *ns_addr, int *max_addr, int accset[], int *nacc_addr, uint64_t *hv_addr)
+{
+	int     numstates = *ns_addr, nacc, ns, nstate, i, *list;
+	uint64_t hashval;
+
+	set->size = 0;
+	nacc = 0;
+	hashval = 0;
+
+	/* The states we start with are all part of the closure. */
+	for (nstate = 1; nstate <= numstates; ++nstate) {
+		ns = t[nstate];
+
+		if (nfa_set_add (set, ns)) {
+			if (accptnum[ns] != NIL)
+				accset[++nacc] = accptnum[ns];
+
+			hashval += nfa_state_key (ns);
+		}
+	}
+
+	for (nstate = 1; nstate <= *ns_addr; ++nstate) {
+		list = nfa_closure (t[nstate]);
+
+		for (i = 1; i <= list[0]; ++i) {
+			ns = list[i];
+
+			if (!nfa_set_add (set, ns))
+				continue;
+
+			if (accptnum[ns] != NIL)
+				accset[++nacc] = accptnum[ns];
+
+			if (++numstates >= *max_addr) {
+				*max_addr += MAX_DFA_SIZE_INCREMENT;
+				t = reallocate_integer_array (t, *max_addr);
+			}
+
+			t[numstates] = ns;
+			hashval += nfa_state_key (ns);
+		}
 	}
 
 	*ns_addr = numstates;
@@ -339,6 +453,45 @@ ADD_STATE(state); \
 }
 
 
+/* epsclosure - construct the epsilon closure of a set of ndfa states
+ *
+ * synopsis
+ *    int *epsclosure( int t[num_states], int *numstates_addr,
+ *			int accset[num_rules+1], int *nacc_addr,
+ *			uint64_t *hashval_addr );
+ *
+ * NOTES
+ *  The epsilon closure is the set of all states reachable by an arbitrary
+ *  number of epsilon transitions, which themselves do not have epsilon
+ *  transitions going out, unioned with the set of states which have non-null
+ *  accepting numbers.  t is an array of size numstates of nfa state numbers.
+ *  Upon return, t holds the epsilon closure and *numstates_addr is updated.
+ *  accset holds a list of the accepting numbers, and the size of accset is
+ *  given by *nacc_addr.  t may be subjected to reallocation if it is not
+ *  large enough to hold the epsilon closure.
+ *
+ *  The closure is the union of the cached closures of the states in t;
+ *  see nfa_closure().
+ *
+ *  hashval is the hash value for the dfa corresponding to the state set.
+ *  It is the sum of the nfa_state_key()s of the states, so it doesn't
+ *  depend on the order in which they are found.
+ */
+
+int    *epsclosure (int *t, int *ns_addr, int accset[], int *nacc_addr, uint64_t *hv_addr)
+{
+	int     old_max = current_max_dfa_size;
+
+	t = closure_union (&closure_set, t, ns_addr, &current_max_dfa_size,
+			   accset, nacc_addr, hv_addr);
+
+	num_reallocs += (current_max_dfa_size - old_max) /
+		MAX_DFA_SIZE_INCREMENT;
+
+	return t;
+}
+
+
 /* increase_max_dfas - increase the maximum number of DFAs */
 
 void increase_max_dfas (void)
@@ -351,7 +504,7 @@ void increase_max_dfas (void)
 	def = reallocate_integer_array (def, current_max_dfas);
 	dfasiz = reallocate_integer_array (dfasiz, current_max_dfas);
 	accsiz = reallocate_integer_array (accsiz, current_max_dfas);
-	dhash = reallocate_integer_array (dhash, current_max_dfas);
+	dhash = reallocate_hash_array (dhash, current_max_dfas);
 	dss = reallocate_int_ptr_array (dss, current_max_dfas);
 	dfaacc = reallocate_dfaacc_union (dfaacc, current_max_dfas);
 
@@ -359,6 +512,688 @@ void increase_max_dfas (void)
 		nultrans =
 			reallocate_integer_array (nultrans,
 						  current_max_dfas);
+
+	if (dfatrans)
+		dfatrans =
+			reallocate_int_ptr_array (dfatrans,
+						  current_max_dfas);
+}
+
+
+/* Open-addressing hash table of the dfas created so far, indexed by
+ * their dhash[] values.  Empty slots hold 0.
+ */
+
+static int *dfa_hash_tbl, dfa_hash_size;
+
+
+/* State of the -f yy_nxt[][] table while ntod() is generating it. */
+
+static struct yytbl_data *yynxt_tbl;
+static flex_int32_t *yynxt_data, yynxt_curr;
+static int num_full_table_rows;
+
+
+/* emit_dfa_state - add a DFA state to the scanner tables
+ *
+ * synopsis
+ *    void emit_dfa_state( int ds, int state[numecs+1], int totaltrans,
+ *			   int comstate, int comfreq, int backs_up );
+ *
+ * state[] holds the out-transitions of ds, indexed by equivalence class.
+ * comstate is the most common destination state and comfreq the number
+ * of transitions to it.  If backs_up is true, ds can be entered in the
+ * middle of a token and so is checked for backing up.
+ */
+
+void emit_dfa_state (int ds, int state[], int totaltrans, int comstate, int comfreq, int backs_up)
+{
+	int i;
+
+	if (backs_up)
+		check_for_backing_up (ds, state);
+
+	if (nultrans) {
+		nultrans[ds] = state[NUL_ec];
+		state[NUL_ec] = 0;	/* remove transition */
+	}
+
+	if (ctrl.fulltbl) {
+
+		/* Each time we hit here, it's another td_hilen, so we realloc. */
+		yynxt_tbl->td_hilen++;
+		yynxt_tbl->td_data = yynxt_data =
+			realloc (yynxt_data,
+					     yynxt_tbl->td_hilen *
+					     yynxt_tbl->td_lolen *
+					     sizeof (flex_int32_t));
+		if (gentables)
+			outn ("M4_HOOK_TABLE_OPENER");
+
+		/* Supply array's 0-element. */
+		if (ds == end_of_buffer_state) {
+			mk2data (-end_of_buffer_state);
+			yynxt_data[yynxt_curr++] =
+				-end_of_buffer_state;
+		}
+		else {
+			mk2data (end_of_buffer_state);
+			yynxt_data[yynxt_curr++] =
+				end_of_buffer_state;
+		}
+
+		for (i = 1; i < num_full_table_rows; ++i) {
+			/* Jams are marked by negative of state
+			 * number.
+			 */
+			mk2data (state[i] ? state[i] : -ds);
+			yynxt_data[yynxt_curr++] =
+				state[i] ? state[i] : -ds;
+		}
+
+		dataflush ();
+		if (gentables)
+			outn ("M4_HOOK_TABLE_CONTINUE");
+	}
+
+	else if (ctrl.fullspd)
+		place_state (state, ds, totaltrans);
+
+	else if (ds == end_of_buffer_state)
+		/* Special case this state to make sure it does what
+		 * it's supposed to, i.e., jam on end-of-buffer.
+		 */
+		stack1 (ds, 0, 0, JAMSTATE);
+
+	else			/* normal, compressed state */
+		bldtbl (state, ds, totaltrans, comstate, comfreq);
+}
+
+
+/* min_hash - hash a DFA state's signature for min_partition() */
+
+static unsigned int min_hash (int ds, int block[])
+{
+	unsigned int h;
+	int i;
+
+	if (!block) {
+		if (ds == end_of_buffer_state)
+			return 0;
+
+		if (!reject)
+			return (unsigned int) dfaacc[ds].dfaacc_state;
+
+		h = (unsigned int) accsiz[ds];
+		for (i = 1; i <= accsiz[ds]; ++i)
+			h = h * 31 + (unsigned int) dfaacc[ds].dfaacc_set[i];
+
+		return h;
+	}
+
+	h = (unsigned int) block[ds];
+	for (i = 1; i <= numecs; ++i)
+		h = h * 31 + (unsigned int) block[dfatrans[ds][i]];
+
+	return h;
+}
+
+/* min_equal - true if two DFA states have the same signature */
+
+static int min_equal (int ds1, int ds2, int block[])
+{
+	int i;
+
+	if (!block) {
+		if (ds1 == end_of_buffer_state || ds2 == end_of_buffer_state)
+			return ds1 == ds2;
+
+		if (!reject)
+			return dfaacc[ds1].dfaacc_state ==
+				dfaacc[ds2].dfaacc_state;
+
+		if (accsiz[ds1] != accsiz[ds2])
+			return false;
+
+		for (i = 1; i <= accsiz[ds1]; ++i)
+			if (dfaacc[ds1].dfaacc_set[i] !=
+			    dfaacc[ds2].dfaacc_set[i])
+				return false;
+
+		return true;
+	}
+
+	if (block[ds1] != block[ds2])
+		return false;
+
+	for (i = 1; i <= numecs; ++i)
+		if (block[dfatrans[ds1][i]] != block[dfatrans[ds2][i]])
+			return false;
+
+	return true;
+}
+
+/* min_partition - split the states into blocks of equal signature
+ *
+ * With a null block[] the signature is what a state accepts; otherwise it
+ * is the state's own block and those of its transitions.  The new block
+ * numbers are stored in newblock[], numbered in order of first appearance,
+ * and the number of blocks is returned.
+ */
+
+static int min_partition (int block[], int newblock[], int hashtbl[], int hashsize)
+{
+	int ds, slot, nblocks = 0;
+
+	for (slot = 0; slot < hashsize; ++slot)
+		hashtbl[slot] = 0;
+
+	for (ds = 1; ds <= lastdfa; ++ds) {
+		slot = (int) (min_hash (ds, block) &
+			      (unsigned int) (hashsize - 1));
+
+		while (hashtbl[slot] && !min_equal (hashtbl[slot], ds, block))
+			slot = (slot + 1) & (hashsize - 1);
+
+		if (hashtbl[slot])
+			newblock[ds] = newblock[hashtbl[slot]];
+
+		else {
+			hashtbl[slot] = ds;
+			newblock[ds] = ++nblocks;
+		}
+	}
+
+	return nblocks;
+}
+
+/* minimize_dfa - merge equivalent DFA states
+ *
+ * synopsis
+ *    void minimize_dfa( int num_start_states );
+ *
+ * The states are first partitioned by what they accept, the end-of-buffer
+ * state getting a block of its own, and the partition is then refined by
+ * the blocks each state's transitions lead to until it stops changing
+ * (Moore's algorithm).  States 1 .. num_start_states are entered directly
+ * by the generated scanner and so keep their numbers; every other block
+ * becomes a single state, numbered after them in order of its lowest
+ * member.  dfatrans[], the per-state arrays and lastdfa are updated to
+ * the new numbering.
+ */
+
+void minimize_dfa (int num_start_states)
+{
+	int    *block, *newblock, *hashtbl, *newnum, *tmp;
+	int     hashsize, nblocks, oldblocks, ds, newds, i;
+
+	num_premin_dfas = lastdfa;
+
+	for (hashsize = 2; hashsize < 2 * lastdfa; hashsize *= 2) ;
+
+	block = allocate_integer_array (lastdfa + 1);
+	newblock = allocate_integer_array (lastdfa + 1);
+	newnum = allocate_integer_array (lastdfa + 1);
+	hashtbl = allocate_integer_array (hashsize);
+
+	/* Block 0 is the "no transition" target. */
+	block[0] = newblock[0] = newnum[0] = 0;
+
+	nblocks = min_partition (NULL, block, hashtbl, hashsize);
+
+	do {
+		oldblocks = nblocks;
+		nblocks = min_partition (block, newblock, hashtbl, hashsize);
+
+		tmp = block;
+		block = newblock;
+		newblock = tmp;
+	}
+	while (nblocks != oldblocks);
+
+	/* Number the new states, reusing newblock[] to map each block to
+	 * the state representing it.
+	 */
+	for (i = 1; i <= nblocks; ++i)
+		newblock[i] = 0;
+
+	newds = num_start_states;
+
+	for (ds = 1; ds <= lastdfa; ++ds) {
+		if (ds <= num_start_states) {
+			newnum[ds] = ds;
+
+			if (!newblock[block[ds]])
+				newblock[block[ds]] = ds;
+		}
+
+		else {
+			if (!newblock[block[ds]])
+				newblock[block[ds]] = ++newds;
+
+			newnum[ds] = newblock[block[ds]];
+		}
+	}
+
+	/* Move each surviving state down to its new number.  A state
+	 * survives if it is a start state or the lowest member of a block
+	 * without one; since new numbers never exceed old ones, the slot
+	 * being moved into has always been dealt with already.
+	 */
+	newds = num_start_states;
+
+	for (ds = 1; ds <= lastdfa; ++ds) {
+		if (ds > num_start_states && newnum[ds] <= newds) {
+			free (dfatrans[ds]);
+			free (dss[ds]);
+
+			if (reject)
+				free (dfaacc[ds].dfaacc_set);
+
+			if (env.trace)
+				fprintf (flex_run->err,
+					 _("state # %d merged into # %d\n"),
+					 ds, newnum[ds]);
+			continue;
+		}
+
+		if (ds > num_start_states)
+			newds = newnum[ds];
+
+		for (i = 1; i <= numecs; ++i)
+			dfatrans[ds][i] = newnum[dfatrans[ds][i]];
+
+		if (newnum[ds] != ds) {
+			dfatrans[newnum[ds]] = dfatrans[ds];
+			dss[newnum[ds]] = dss[ds];
+			dfasiz[newnum[ds]] = dfasiz[ds];
+			dhash[newnum[ds]] = dhash[ds];
+			dfaacc[newnum[ds]] = dfaacc[ds];
+			accsiz[newnum[ds]] = accsiz[ds];
+		}
+	}
+
+	lastdfa = newds;
+
+	free (block);
+	free (newblock);
+	free (newnum);
+	free (hashtbl);
+}
+
+
+#ifdef HAVE_PTHREAD_H
+
+/* With -j, ntod() has worker threads expand the dfas on its todo queue,
+ * a batch at a time.  For each dfa, a worker does the sympartition(),
+ * symfollowset() and epsilon closure work and saves the results; ntod()
+ * then goes through the batch in order, interning the new state sets with
+ * snstods() just as it does when working serially.  So the dfa numbering,
+ * and with it the tables, don't depend on the number of threads.
+ *
+ * The workers are started once, by start_subset_workers(), and wait on
+ * subset_go between batches.  Each batch bumps subset_generation; the
+ * last worker done with it signals subset_done.
+ */
+
+/* Number of dfas per worker thread in a batch. */
+#define SUBSET_JOBS_PER_WORKER 64
+
+struct subset_worker;
+
+/* What stopped a worker from expanding a dfa.  A worker can't leave by
+ * flexfatal(), whose longjmp() belongs to the thread running flex, so it
+ * notes the failure in the job, and ntod() reports it when it gets there.
+ */
+enum subset_failure { SUBSET_OK, SUBSET_BAD_TRANSITION, SUBSET_NO_MEMORY };
+
+/* The expansion of one dfa of the batch.  The closure for sym is stored
+ * in its worker's arena at closure[sym]: the number of states and the
+ * number of accepting numbers, followed by the states and the accepting
+ * numbers.
+ */
+struct subset_job {
+	int     symlist[CSIZE + 1], duplist[CSIZE + 1];
+	int     closure[CSIZE + 1];
+	uint64_t hashval[CSIZE + 1];
+	struct subset_worker *worker;
+	enum subset_failure failure;
+};
+
+struct subset_worker {
+	pthread_t thread;
+	bool    started;
+	int     first;		/* its first job; it does every num_subset_workers'th */
+	struct nfa_set set;
+	struct sym_follow follow;
+	int    *nset, nset_max, *accset;
+	int    *arena, arena_len, arena_max;
+};
+
+static struct subset_job *subset_jobs;
+static struct subset_worker *subset_workers;
+static int num_subset_workers, subset_batch_first, subset_batch_size;
+
+static pthread_mutex_t subset_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t subset_go = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t subset_done = PTHREAD_COND_INITIALIZER;
+static int subset_generation, subset_pending;
+static bool subset_quit;
+
+
+/* expand_subset - do the closure work for dfa ds on behalf of ntod()
+ *
+ * Nothing here may call flexfatal(): the worker's sets are big enough
+ * for any closure from the start, and what does grow is grown with
+ * try_reallocate_array().
+ */
+
+static void expand_subset (struct subset_worker *w, struct subset_job *job, int ds)
+{
+	int    *dset = dss[ds], dsize = dfasiz[ds];
+	int     sym, numstates, nacc, *rec;
+
+	job->worker = w;
+	job->failure = SUBSET_OK;
+
+	for (sym = 0; sym <= numecs; ++sym)
+		job->symlist[sym] = false;
+
+	if (!sympartition (dset, dsize, job->symlist, job->duplist)) {
+		job->failure = SUBSET_BAD_TRANSITION;
+		return;
+	}
+	if (!symfollowset (dset, dsize, job->symlist, job->duplist,
+			   &w->follow)) {
+		job->failure = SUBSET_NO_MEMORY;
+		return;
+	}
+
+	for (sym = 1; sym <= numecs; ++sym) {
+		if (!job->symlist[sym] || job->duplist[sym] != NIL)
+			continue;
+
+		numstates = follow_targets (&w->follow, sym, w->nset);
+		w->nset = closure_union (&w->set, w->nset, &numstates,
+					 &w->nset_max, w->accset, &nacc,
+					 &job->hashval[sym]);
+
+		if (w->arena_len + numstates + nacc + 2 > w->arena_max) {
+			int     max = 2 * w->arena_max + numstates + nacc + 2;
+			int    *arena = try_reallocate_integer_array (w->arena,
+								      max);
+
+			if (!arena) {
+				job->failure = SUBSET_NO_MEMORY;
+				return;
+			}
+			w->arena = arena;
+			w->arena_max = max;
+		}
+
+		job->closure[sym] = w->arena_len;
+		rec = w->arena + w->arena_len;
+		rec[0] = numstates;
+		rec[1] = nacc;
+		memcpy (rec + 2, w->nset + 1, (size_t) numstates * sizeof (int));
+		memcpy (rec + 2 + numstates, w->accset + 1,
+			(size_t) nacc * sizeof (int));
+		w->arena_len += numstates + nacc + 2;
+	}
+}
+
+
+/* expand_subset_share - expand a worker's share of the batch */
+
+static void expand_subset_share (struct subset_worker *w)
+{
+	int     j;
+
+	w->arena_len = 0;
+
+	for (j = w->first; j < subset_batch_size; j += num_subset_workers)
+		expand_subset (w, &subset_jobs[j], subset_batch_first + j);
+}
+
+
+/* subset_worker_main - expand a share of each batch until told to quit */
+
+static void *subset_worker_main (void *arg)
+{
+	struct subset_worker *w = arg;
+	int     generation = 0;
+
+	pthread_mutex_lock (&subset_lock);
+
+	for (;;) {
+		while (generation == subset_generation && !subset_quit)
+			pthread_cond_wait (&subset_go, &subset_lock);
+
+		if (subset_quit)
+			break;
+
+		generation = subset_generation;
+		pthread_mutex_unlock (&subset_lock);
+
+		expand_subset_share (w);
+
+		pthread_mutex_lock (&subset_lock);
+		if (--subset_pending == 0)
+			pthread_cond_signal (&subset_done);
+	}
+
+	pthread_mutex_unlock (&subset_lock);
+
+	return NULL;
+}
+
+
+/* fill_closure_cache - cache the closure of every state symfollowset()
+ *			  can return
+ *
+ * The workers only ever read the cache.  Returns false if it can't hold
+ * all those closures, and the todo queue has to be expanded serially.
+ */
+
+static bool fill_closure_cache (void)
+{
+	int     ns, uncached = num_uncached_closures;
+
+	for (ns = 1; ns <= lastnfa; ++ns)
+		if (transchar[ns] != SYM_EPSILON &&
+		    trans1[ns] != NO_TRANSITION)
+			nfa_closure (trans1[ns]);
+
+	return num_uncached_closures == uncached;
+}
+
+
+/* start_subset_workers - set up for expanding the todo queue in parallel */
+
+static void start_subset_workers (int nthreads)
+{
+	int     ns, i;
+	struct subset_worker *w;
+
+	num_subset_workers = nthreads;
+	subset_workers = calloc ((size_t) nthreads, sizeof (struct subset_worker));
+	subset_jobs = calloc ((size_t) (nthreads * SUBSET_JOBS_PER_WORKER),
+			      sizeof (struct subset_job));
+
+	if (!subset_workers || !subset_jobs)
+		flexfatal (_("memory allocation failed in start_subset_workers()"));
+
+	/* A closure has at most lastnfa states, so neither nset nor the
+	 * set it's built in ever has to grow in a worker.
+	 */
+	for (i = 0; i < nthreads; ++i) {
+		w = &subset_workers[i];
+		w->first = i;
+		w->nset_max = MAX (current_max_dfa_size, lastnfa + 2);
+		w->nset = allocate_integer_array (w->nset_max);
+		w->accset = allocate_integer_array ((num_rules + 1) * 2);
+		w->set.max = current_mns > lastnfa ? current_mns : lastnfa + 1;
+		w->set.dense = allocate_integer_array (w->set.max);
+		w->set.sparse = allocate_integer_array (w->set.max);
+		for (ns = 0; ns < w->set.max; ++ns)
+			w->set.sparse[ns] = 0;
+	}
+
+	subset_batch_first = subset_batch_size = 0;
+	subset_generation = subset_pending = 0;
+	subset_quit = false;
+
+	/* The calling thread does the first share itself.  If a thread
+	 * can't be created, its share is done there too.
+	 */
+	for (i = 1; i < nthreads; ++i) {
+		w = &subset_workers[i];
+		w->started = pthread_create (&w->thread, NULL,
+					     subset_worker_main, w) == 0;
+	}
+}
+
+
+/* expand_subset_batch - expand dfas first .. last, or as many as fit */
+
+static void expand_subset_batch (int first, int last)
+{
+	int     i;
+	struct subset_worker *w;
+
+	pthread_mutex_lock (&subset_lock);
+
+	subset_batch_first = first;
+	subset_batch_size = MIN (last - first + 1,
+				 num_subset_workers * SUBSET_JOBS_PER_WORKER);
+
+	subset_pending = 0;
+	for (i = 1; i < num_subset_workers; ++i)
+		if (subset_workers[i].started)
+			++subset_pending;
+
+	++subset_generation;
+	pthread_cond_broadcast (&subset_go);
+	pthread_mutex_unlock (&subset_lock);
+
+	expand_subset_share (&subset_workers[0]);
+
+	for (i = 1; i < num_subset_workers; ++i) {
+		w = &subset_workers[i];
+
+		if (!w->started)
+			expand_subset_share (w);
+	}
+
+	pthread_mutex_lock (&subset_lock);
+	while (subset_pending > 0)
+		pthread_cond_wait (&subset_done, &subset_lock);
+	pthread_mutex_unlock (&subset_lock);
+}
+
+
+/* subset_closure - fetch a closure expanded by a worker
+ *
+ * The closure for sym of the job's dfa is copied to nset and accset,
+ * which is grown the way epsclosure() would have grown it.
+ */
+
+static int *subset_closure (struct subset_job *job, int sym, int *nset, int *ns_addr, int accset[], int *nacc_addr, uint64_t *hv_addr)
+{
+	int    *rec = job->worker->arena + job->closure[sym];
+	int     numstates = rec[0], nacc = rec[1];
+
+	if (numstates >= current_max_dfa_size) {
+		do {
+			current_max_dfa_size += MAX_DFA_SIZE_INCREMENT;
+			++num_reallocs;
+		} while (numstates >= current_max_dfa_size);
+
+		nset = reallocate_integer_array (nset, current_max_dfa_size);
+	}
+
+	memcpy (nset + 1, rec + 2, (size_t) numstates * sizeof (int));
+	memcpy (accset + 1, rec + 2 + numstates, (size_t) nacc * sizeof (int));
+
+	*ns_addr = numstates;
+	*nacc_addr = nacc;
+	*hv_addr = job->hashval[sym];
+
+	return nset;
+}
+
+
+/* finish_subset_workers - stop the worker threads and free what they used */
+
+static void finish_subset_workers (void)
+{
+	int     i;
+	struct subset_worker *w;
+
+	pthread_mutex_lock (&subset_lock);
+	subset_quit = true;
+	pthread_cond_broadcast (&subset_go);
+	pthread_mutex_unlock (&subset_lock);
+
+	for (i = 1; i < num_subset_workers; ++i)
+		if (subset_workers[i].started)
+			pthread_join (subset_workers[i].thread, NULL);
+
+	for (i = 0; i < num_subset_workers; ++i) {
+		w = &subset_workers[i];
+		free (w->set.dense);
+		free (w->set.sparse);
+		free (w->follow.targets);
+		free (w->nset);
+		free (w->accset);
+		free (w->arena);
+	}
+
+	free (subset_workers);
+	free (subset_jobs);
+	subset_workers = NULL;
+	subset_jobs = NULL;
+	num_subset_workers = 0;
+}
+
+#endif /* HAVE_PTHREAD_H */
+
+
+/* mkecmasks - work out the equivalence classes of each transition label */
+
+static void mkecmasks (void)
+{
+	int     i, k, ch, cclp;
+	uint64_t *m;
+
+	ecmasks = allocate_array (lastccl + 1 + ctrl.csize,
+				  ECMASK_WORDS * sizeof (uint64_t));
+	memset (ecmasks, 0, (size_t) (lastccl + 1 + ctrl.csize) *
+		ECMASK_WORDS * sizeof (uint64_t));
+
+	for (i = 1; i <= lastccl; ++i) {
+		m = ecmasks + (size_t) i * ECMASK_WORDS;
+		cclp = cclmap[i];
+
+		for (k = 0; k < ccllen[i]; ++k) {
+			ch = ccltbl[cclp + k];
+
+			if (ch == 0)
+				ch = NUL_ec;
+
+			m[ch / 64] |= (uint64_t) 1 << (ch % 64);
+		}
+
+		if (cclng[i])
+			for (ch = 1; ch <= numecs; ++ch)
+				m[ch / 64] ^= (uint64_t) 1 << (ch % 64);
+	}
+
+	for (ch = 0; ch < ctrl.csize; ++ch) {
+		k = ABS (ecgroup[ch]);
+		m = ecmasks + (size_t) (lastccl + 1 + ch) * ECMASK_WORDS;
+		m[k / 64] |= (uint64_t) 1 << (k % 64);
+	}
 }
 
 
@@ -373,17 +1208,23 @@ void increase_max_dfas (void)
 
 size_t ntod (void)
 {
-	int    *accset, ds, nacc, newds;
-	int     sym, hashval, numstates, dsize;
-	int     num_full_table_rows=0;	/* used only for -f */
-	int    *nset, *dset;
+	int    *accset, ds, nacc, newds, is_new;
+	int     sym, numstates, dsize;
+	uint64_t hashval;
+	int    *nset, *dset, *entered;
 	int     targptr, totaltrans, i, comstate, comfreq, targ;
 	int     symlist[CSIZE + 1];
 	int     num_start_states;
 	int     todo_head, todo_next;
+	struct sym_follow follow;
+#ifdef HAVE_PTHREAD_H
+	struct subset_job *job = NULL;
+#endif
 
-	struct yytbl_data *yynxt_tbl = 0;
-	flex_int32_t *yynxt_data = 0, yynxt_curr = 0;
+	yynxt_tbl = 0;
+	yynxt_data = 0;
+	yynxt_curr = 0;
+	num_full_table_rows = 0;	/* used only for -f */
 
 	/* Note that the following are indexed by *equivalence classes*
 	 * and not by characters.  Since equivalence classes are indexed
@@ -419,11 +1260,15 @@ size_t ntod (void)
 
 	if (env.trace) {
 		dumpnfa (scset[1]);
-		fputs (_("\n\nDFA Dump:\n\n"), stderr);
+		fputs (_("\n\nDFA Dump:\n\n"), flex_run->err);
 	}
 
 	inittbl ();
 
+	mkecmasks ();
+	follow.targets = NULL;
+	follow.max = 0;
+
 	/* Check to see whether we should build a separate table for
 	 * transitions on NUL characters.  We don't do this for full-speed
 	 * (-F) scanners, since for them we don't have a simple state
@@ -462,6 +1307,12 @@ size_t ntod (void)
 	if (ctrl.fulltbl && ecgroup[0] == numecs && is_power_of_2(numecs))
 		nultrans = allocate_integer_array (current_max_dfas);
 
+	/* When minimizing, the tables can't be built until every state
+	 * exists, so hold on to the transitions until then.
+	 */
+	if (env.minimize)
+		dfatrans = allocate_int_ptr_array (current_max_dfas);
+
 	if (ctrl.fullspd) {
 		for (i = 0; i <= numecs; ++i)
 			state[i] = 0;
@@ -501,11 +1352,8 @@ size_t ntod (void)
 			   sizeof (flex_int32_t));
 		yynxt_curr = 0;
 
-		struct packtype_t *ptype = optimize_pack(0);
-		/* Note: Used when ctrl.fulltbl is on. Alternately defined elsewhere */
-		out_str ("m4_define([[M4_HOOK_NXT_TYPE]], [[%s]])", ptype->name);
 		out_dec ("m4_define([[M4_HOOK_NXT_ROWS]], [[%d]])", num_full_table_rows);
-		outn ("m4_define([[M4_HOOK_NXT_BODY]], [[m4_dnl");
+		table_body_begin ("M4_HOOK_NXT_BODY");
 		outn ("M4_HOOK_TABLE_OPENER");
 		if (gentables)
 			outn ("M4_HOOK_TABLE_OPENER");
@@ -562,6 +1410,10 @@ size_t ntod (void)
 		++todo_next;
 	}
 
+#ifdef HAVE_PTHREAD_H
+	if (env.threads > 1 && fill_closure_cache ())
+		start_subset_workers (env.threads);
+#endif
 
 	while (todo_head < todo_next) {
 		targptr = 0;
@@ -576,9 +1428,42 @@ size_t ntod (void)
 		dsize = dfasiz[ds];
 
 		if (env.trace)
-			fprintf (stderr, _("state # %d:\n"), ds);
+			fprintf (flex_run->err, _("state # %d:\n"), ds);
 
-		sympartition (dset, dsize, symlist, duplist);
+		stats_begin (STATS_CLOSURE);
+
+#ifdef HAVE_PTHREAD_H
+		if (num_subset_workers > 0) {
+			if (ds >= subset_batch_first + subset_batch_size)
+				expand_subset_batch (ds, todo_next);
+
+			job = &subset_jobs[ds - subset_batch_first];
+
+			if (job->failure == SUBSET_BAD_TRANSITION)
+				flexfatal (_
+					   ("bad transition character detected in sympartition()"));
+			if (job->failure == SUBSET_NO_MEMORY)
+				flexfatal (_
+					   ("memory allocation failed in expand_subset()"));
+
+			for (sym = 1; sym <= numecs; ++sym) {
+				symlist[sym] = job->symlist[sym];
+				duplist[sym] = job->duplist[sym];
+			}
+		}
+		else
+#endif
+		{
+			if (!sympartition (dset, dsize, symlist, duplist))
+				flexfatal (_
+					   ("bad transition character detected in sympartition()"));
+			if (!symfollowset (dset, dsize, symlist, duplist,
+					   &follow))
+				flexfatal (_
+					   ("memory allocation failed in symfollowset()"));
+		}
+
+		stats_end (STATS_CLOSURE);
 
 		for (sym = 1; sym <= numecs; ++sym) {
 			if (symlist[sym]) {
@@ -586,17 +1471,37 @@ size_t ntod (void)
 
 				if (duplist[sym] == NIL) {
 					/* Symbol has unique out-transitions. */
-					numstates =
-						symfollowset (dset, dsize,
-							      sym, nset);
-					nset = epsclosure (nset,
-							   &numstates,
-							   accset, &nacc,
-							   &hashval);
-
-					if (snstods
-					    (nset, numstates, accset, nacc,
-					     hashval, &newds)) {
+					stats_begin (STATS_CLOSURE);
+
+#ifdef HAVE_PTHREAD_H
+					if (job)
+						nset = subset_closure (job,
+								       sym, nset,
+								       &numstates,
+								       accset, &nacc,
+								       &hashval);
+					else
+#endif
+					{
+						numstates =
+							follow_targets (&follow,
+									sym,
+									nset);
+						nset = epsclosure (nset,
+								   &numstates,
+								   accset,
+								   &nacc,
+								   &hashval);
+					}
+
+					stats_end (STATS_CLOSURE);
+					stats_begin (STATS_LOOKUP);
+					is_new = snstods (nset, numstates,
+							  accset, nacc,
+							  hashval, &newds);
+					stats_end (STATS_LOOKUP);
+
+					if (is_new) {
 						totnst = totnst +
 							numstates;
 						++todo_next;
@@ -613,7 +1518,7 @@ size_t ntod (void)
 					state[sym] = newds;
 
 					if (env.trace)
-						fprintf (stderr,
+						fprintf (flex_run->err,
 							 "\t%d\t%d\n", sym,
 							 newds);
 
@@ -631,7 +1536,7 @@ size_t ntod (void)
 					state[sym] = targ;
 
 					if (env.trace)
-						fprintf (stderr,
+						fprintf (flex_run->err,
 							 "\t%d\t%d\n", sym,
 							 targ);
 
@@ -654,66 +1559,82 @@ size_t ntod (void)
 
 		numsnpairs += totaltrans;
 
-		if (ds > num_start_states)
-			check_for_backing_up (ds, state);
+		if (env.minimize) {
+			dfatrans[ds] = allocate_integer_array (numecs + 1);
+			dfatrans[ds][0] = 0;
+
+			for (i = 1; i <= numecs; ++i)
+				dfatrans[ds][i] = state[i];
 
-		if (nultrans) {
-			nultrans[ds] = state[NUL_ec];
-			state[NUL_ec] = 0;	/* remove transition */
+			continue;
 		}
 
-		if (ctrl.fulltbl) {
-
-			/* Each time we hit here, it's another td_hilen, so we realloc. */
-			yynxt_tbl->td_hilen++;
-			yynxt_tbl->td_data = yynxt_data =
-				realloc (yynxt_data,
-						     yynxt_tbl->td_hilen *
-						     yynxt_tbl->td_lolen *
-						     sizeof (flex_int32_t));
-			if (gentables)
-				outn ("M4_HOOK_TABLE_OPENER");
-
-			/* Supply array's 0-element. */
-			if (ds == end_of_buffer_state) {
-				mk2data (-end_of_buffer_state);
-				yynxt_data[yynxt_curr++] =
-					-end_of_buffer_state;
-			}
-			else {
-				mk2data (end_of_buffer_state);
-				yynxt_data[yynxt_curr++] =
-					end_of_buffer_state;
-			}
+		/* Determine which destination state is the most
+		 * common, and how many transitions to it there are.
+		 */
 
-			for (i = 1; i < num_full_table_rows; ++i) {
-				/* Jams are marked by negative of state
-				 * number.
-				 */
-				mk2data (state[i] ? state[i] : -ds);
-				yynxt_data[yynxt_curr++] =
-					state[i] ? state[i] : -ds;
+		comfreq = 0;
+		comstate = 0;
+
+		for (i = 1; i <= targptr; ++i)
+			if (targfreq[i] > comfreq) {
+				comfreq = targfreq[i];
+				comstate = targstate[i];
 			}
 
-			dataflush ();
-			if (gentables)
-				outn ("M4_HOOK_TABLE_CONTINUE");
-		}
+		stats_begin (STATS_PLACEMENT);
+		emit_dfa_state (ds, state, totaltrans, comstate, comfreq,
+				ds > num_start_states);
+		stats_end (STATS_PLACEMENT);
+	}
 
-		else if (ctrl.fullspd)
-			place_state (state, ds, totaltrans);
+#ifdef HAVE_PTHREAD_H
+	if (num_subset_workers > 0)
+		finish_subset_workers ();
+#endif
 
-		else if (ds == end_of_buffer_state)
-			/* Special case this state to make sure it does what
-			 * it's supposed to, i.e., jam on end-of-buffer.
-			 */
-			stack1 (ds, 0, 0, JAMSTATE);
+	free (follow.targets);
+	free (ecmasks);
+	ecmasks = NULL;
 
-		else {		/* normal, compressed state */
+	if (env.minimize) {
+		stats_begin (STATS_MINIMIZE);
+		minimize_dfa (num_start_states);
+		stats_end (STATS_MINIMIZE);
 
-			/* Determine which destination state is the most
-			 * common, and how many transitions to it there are.
-			 */
+		/* A state needs checking for backing up if it can be
+		 * entered in the middle of a token, i.e., if some state
+		 * has a transition to it.
+		 */
+		entered = allocate_integer_array (lastdfa + 1);
+
+		for (ds = 0; ds <= lastdfa; ++ds)
+			entered[ds] = false;
+
+		for (ds = 1; ds <= lastdfa; ++ds)
+			for (i = 1; i <= numecs; ++i)
+				entered[dfatrans[ds][i]] = true;
+
+		for (ds = 1; ds <= lastdfa; ++ds) {
+			targptr = 0;
+			totaltrans = 0;
+
+			for (sym = 1; sym <= numecs; ++sym) {
+				if (!(targ = dfatrans[ds][sym]))
+					continue;
+
+				for (i = 1; i <= targptr; ++i)
+					if (targstate[i] == targ)
+						break;
+
+				if (i > targptr) {
+					targfreq[++targptr] = 0;
+					targstate[targptr] = targ;
+				}
+
+				++targfreq[i];
+				++totaltrans;
+			}
 
 			comfreq = 0;
 			comstate = 0;
@@ -724,13 +1645,30 @@ size_t ntod (void)
 					comstate = targstate[i];
 				}
 
-			bldtbl (state, ds, totaltrans, comstate, comfreq);
+			stats_begin (STATS_PLACEMENT);
+			emit_dfa_state (ds, dfatrans[ds], totaltrans,
+					comstate, comfreq, entered[ds]);
+			stats_end (STATS_PLACEMENT);
+			free (dfatrans[ds]);
 		}
+
+		free (entered);
+		free (dfatrans);
+		dfatrans = NULL;
 	}
 
 	if (ctrl.fulltbl) {
 		dataend ("M4_HOOK_TABLE_CLOSER");
-		outn("/* body */]])");
+		out ("/* body */");
+		table_body_end ();
+
+		/* Now that the number of dfas is known, the table can be
+		 * given an element type that holds them.
+		 * Note: Used when ctrl.fulltbl is on. Alternately defined
+		 * elsewhere.
+		 */
+		out_str ("m4_define([[M4_HOOK_NXT_TYPE]], [[%s]])",
+			 optimize_pack ((size_t) lastdfa + 1)->name);
 		if (tablesext) {
 			yytbl_data_compress (yynxt_tbl);
 			if (yytbl_data_fwrite (&tableswr, yynxt_tbl) < 0)
@@ -744,7 +1682,18 @@ size_t ntod (void)
 	}
 
 	else if (!ctrl.fullspd) {
+		stats_begin (STATS_PLACEMENT);
+		if (env.tune_tables)
+			tune_tables ();
+		stats_end (STATS_PLACEMENT);
+
+		stats_begin (STATS_CMPTMPS);
 		cmptmps ();	/* create compressed template entries */
+		stats_end (STATS_CMPTMPS);
+
+		stats_begin (STATS_PLACEMENT);
+		if (env.pack)
+			pack_tables ();
 
 		/* Create tables for all the states with only one
 		 * out-transition.
@@ -756,33 +1705,126 @@ size_t ntod (void)
 		}
 
 		mkdeftbl ();
+		stats_end (STATS_PLACEMENT);
 	}
 
+	else if (env.pack) {
+		stats_begin (STATS_PLACEMENT);
+		pack_tables ();
+		stats_end (STATS_PLACEMENT);
+	}
+
+	freetbl ();
 
 	free(accset);
 	free(nset);
+	ntod_cleanup ();
 
 	return (yynxt_tbl != NULL) ? (yynxt_tbl->td_hilen * sizeof(int32_t)) : 0;
 }
 
 
+/* ntod_cleanup - release what ntod() keeps while it runs
+ *
+ * ntod() calls it when it is done; so does the end of a run, in case an
+ * error cut ntod() short with the worker threads still waiting.
+ */
+
+void ntod_cleanup (void)
+{
+	int     i;
+
+#ifdef HAVE_PTHREAD_H
+	if (num_subset_workers > 0)
+		finish_subset_workers ();
+#endif
+
+	free (ecmasks);
+	ecmasks = NULL;
+
+	free(dfa_hash_tbl);
+	dfa_hash_tbl = NULL;
+	dfa_hash_size = 0;
+
+	for (i = 0; i < closure_cache_size; ++i)
+		free(closure_cache[i]);
+	free(closure_cache);
+	closure_cache = NULL;
+	closure_cache_size = 0;
+
+	free(closure_scratch);
+	closure_scratch = NULL;
+	closure_scratch_max = 0;
+}
+
+
+/* dfa_hash_slot - first slot to probe for a dfa hash value */
+
+static int dfa_hash_slot (uint64_t hashval)
+{
+	return (int) (hashval & (uint64_t) (dfa_hash_size - 1));
+}
+
+
+/* grow_dfa_hash - enlarge the dfa hash table
+ *
+ * The table is kept at most half full.  The dfas are re-entered in
+ * increasing order so that ones with equal hash values are still probed
+ * in the order in which they were created.
+ */
+
+static void grow_dfa_hash (void)
+{
+	int i, slot;
+
+	if (dfa_hash_size == 0)
+		dfa_hash_size = 256;
+
+	while (dfa_hash_size < 2 * (lastdfa + 1))
+		dfa_hash_size *= 2;
+
+	free (dfa_hash_tbl);
+	dfa_hash_tbl = allocate_integer_array (dfa_hash_size);
+
+	for (slot = 0; slot < dfa_hash_size; ++slot)
+		dfa_hash_tbl[slot] = 0;
+
+	for (i = 1; i <= lastdfa; ++i) {
+		for (slot = dfa_hash_slot (dhash[i]); dfa_hash_tbl[slot];
+		     slot = (slot + 1) & (dfa_hash_size - 1)) ;
+
+		dfa_hash_tbl[slot] = i;
+	}
+}
+
+
 /* snstods - converts a set of ndfa states into a dfa state
  *
  * synopsis
  *    is_new_state = snstods( int sns[numstates], int numstates,
  *				int accset[num_rules+1], int nacc,
- *				int hashval, int *newds_addr );
+ *				uint64_t hashval, int *newds_addr );
  *
  * On return, the dfa state number is in newds.
  */
 
-int snstods (int sns[], int numstates, int accset[], int nacc, int hashval, int *newds_addr)
+int snstods (int sns[], int numstates, int accset[], int nacc, uint64_t hashval, int *newds_addr)
 {
 	int didsort = 0;
-	int i, j;
+	int i, j, slot;
 	int newds, *oldsns;
 
-	for (i = 1; i <= lastdfa; ++i)
+	++dfalookups;
+
+	if (2 * (lastdfa + 1) > dfa_hash_size)
+		grow_dfa_hash ();
+
+	/* Look for an existing dfa with the same set of NFA states.  Ones
+	 * with equal hash values share a probe sequence and so are visited
+	 * in the order in which they were created.
+	 */
+	for (slot = dfa_hash_slot (hashval); (i = dfa_hash_tbl[slot]) != 0;
+	     slot = (slot + 1) & (dfa_hash_size - 1))
 		if (hashval == dhash[i]) {
 			if (numstates == dfasiz[i]) {
 				oldsns = dss[i];
@@ -833,6 +1875,7 @@ int snstods (int sns[], int numstates, int accset[], int nacc, int hashval, int
 
 	dfasiz[newds] = numstates;
 	dhash[newds] = hashval;
+	dfa_hash_tbl[slot] = newds;
 
 	if (nacc == 0) {
 		if (reject)
@@ -893,76 +1936,103 @@ int snstods (int sns[], int numstates, int accset[], int nacc, int hashval, int
 /* symfollowset - follow the symbol transitions one step
  *
  * synopsis
- *    numstates = symfollowset( int ds[current_max_dfa_size], int dsize,
- *				int transsym, int nset[current_max_dfa_size] );
+ *    symfollowset( int ds[current_max_dfa_size], int dsize,
+ *		    int symlist[numecs], int duplist[numecs],
+ *		    struct sym_follow *f );
+ *
+ * Does the one step for every symbol that sympartition() left with
+ * unique out-transitions, in one sweep over the nfa states of ds.  Each
+ * state adds its out-transition to the bucket of every such symbol in its
+ * ecmask, so the bucket of a symbol lists its targets in the order of
+ * ds.  follow_targets() fetches a bucket.
+ *
+ * Returns false if there was no memory for the buckets.
  */
 
-int symfollowset (int ds[], int dsize, int transsym, int nset[])
+static bool symfollowset (int ds[], int dsize, int symlist[], int duplist[], struct sym_follow *f)
 {
-	int     ns, tsp, sym, i, j, lenccl, ch, numstates, ccllist;
+	uint64_t wanted[ECMASK_WORDS], bits;
+	int     i, k, ns, sym, total, *count = f->start + 1;
 
-	numstates = 0;
+	for (k = 0; k < ECMASK_WORDS; ++k)
+		wanted[k] = 0;
 
-	for (i = 1; i <= dsize; ++i) {	/* for each nfa state ns in the state set of ds */
+	for (sym = 1; sym <= numecs; ++sym) {
+		count[sym] = 0;
+
+		if (symlist[sym] && duplist[sym] == NIL)
+			wanted[sym / 64] |= (uint64_t) 1 << (sym % 64);
+	}
+
+	/* First count the targets for each symbol, then lay the buckets
+	 * out one after another and fill them.
+	 */
+	for (i = 1; i <= dsize; ++i) {
 		ns = ds[i];
-		sym = transchar[ns];
-		tsp = trans1[ns];
-
-		if (sym < 0) {	/* it's a character class */
-			sym = -sym;
-			ccllist = cclmap[sym];
-			lenccl = ccllen[sym];
-
-			if (cclng[sym]) {
-				for (j = 0; j < lenccl; ++j) {
-					/* Loop through negated character
-					 * class.
-					 */
-					ch = ccltbl[ccllist + j];
 
-					if (ch == 0)
-						ch = NUL_ec;
+		if (transchar[ns] == SYM_EPSILON)
+			continue;
 
-					if (ch > transsym)
-						/* Transsym isn't in negated
-						 * ccl.
-						 */
-						break;
+		for (k = 0; k < ECMASK_WORDS; ++k)
+			for (bits = ECMASK (ns)[k] & wanted[k]; bits;
+			     bits &= bits - 1)
+				++count[64 * k + lowest_bit (bits)];
+	}
 
-					else if (ch == transsym)
-						/* next 2 */
-						goto bottom;
-				}
+	f->start[0] = f->start[1] = 0;
 
-				/* Didn't find transsym in ccl. */
-				nset[++numstates] = tsp;
-			}
+	for (sym = 1; sym <= numecs; ++sym)
+		f->start[sym + 1] += f->start[sym];
 
-			else
-				for (j = 0; j < lenccl; ++j) {
-					ch = ccltbl[ccllist + j];
+	total = f->start[numecs + 1];
 
-					if (ch == 0)
-						ch = NUL_ec;
+	if (total > f->max) {
+		int    *targets = try_reallocate_integer_array (f->targets,
+							    total + total / 2);
 
-					if (ch > transsym)
-						break;
-					else if (ch == transsym) {
-						nset[++numstates] = tsp;
-						break;
-					}
-				}
-		}
+		if (!targets)
+			return false;
+		f->targets = targets;
+		f->max = total + total / 2;
+	}
 
-		else if (sym == SYM_EPSILON) {	/* do nothing */
-		}
+	/* Now the bucket of sym runs from start[sym] to start[sym + 1].
+	 * Filling it moves start[sym] along to the end of the bucket, so
+	 * afterwards start[] is shifted back down one place.
+	 */
+	for (i = 1; i <= dsize; ++i) {
+		ns = ds[i];
 
-		else if (ABS (ecgroup[sym]) == transsym)
-			nset[++numstates] = tsp;
+		if (transchar[ns] == SYM_EPSILON)
+			continue;
 
-	      bottom:;
+		for (k = 0; k < ECMASK_WORDS; ++k)
+			for (bits = ECMASK (ns)[k] & wanted[k]; bits;
+			     bits &= bits - 1) {
+				sym = 64 * k + lowest_bit (bits);
+				f->targets[f->start[sym]++] = trans1[ns];
+			}
 	}
 
+	for (sym = numecs; sym >= 1; --sym)
+		f->start[sym] = f->start[sym - 1];
+
+	return true;
+}
+
+
+/* follow_targets - copy symfollowset()'s targets for sym to nset
+ *
+ * Returns the number of targets.
+ */
+
+static int follow_targets (struct sym_follow *f, int sym, int nset[])
+{
+	int     numstates = f->start[sym + 1] - f->start[sym];
+
+	memcpy (nset + 1, f->targets + f->start[sym],
+		(size_t) numstates * sizeof (int));
+
 	return numstates;
 }
 
@@ -970,41 +2040,37 @@ int symfollowset (int ds[], int dsize, int transsym, int nset[])
 /* sympartition - partition characters with same out-transitions
  *
  * synopsis
- *    sympartition( int ds[current_max_dfa_size], int numstates,
+ *    int sympartition( int ds[current_max_dfa_size], int numstates,
  *			int symlist[numecs], int duplist[numecs] );
+ *
+ * Returns false if a state of ds has a bad transition character, leaving
+ * the caller, which may be a -j worker thread, to report it.
  */
 
-void sympartition (int ds[], int numstates, int symlist[], int duplist[])
+int sympartition (int ds[], int numstates, int symlist[], int duplist[])
 {
-	int     tch, i, j, k, ns, dupfwd[CSIZE + 1], lenccl, cclp, ich;
+	int     tch, i, j, k, ns, lenccl, cclp, ich;
+	struct ec_partition part;
 
 	/* Partitioning is done by creating equivalence classes for those
 	 * characters which have out-transitions from the given state.  Thus
 	 * we are really creating equivalence classes of equivalence classes.
 	 */
 
-	for (i = 1; i <= numecs; ++i) {	/* initialize equivalence class list */
-		duplist[i] = i - 1;
-		dupfwd[i] = i + 1;
-	}
-
-	duplist[1] = NIL;
-	dupfwd[numecs] = NIL;
+	ecpart_init (&part, numecs);
 
 	for (i = 1; i <= numstates; ++i) {
 		ns = ds[i];
 		tch = transchar[ns];
 
 		if (tch != SYM_EPSILON) {
-			if (tch < -lastccl || tch >= ctrl.csize) {
-				flexfatal (_
-					   ("bad transition character detected in sympartition()"));
-			}
+			if (tch < -lastccl || tch >= ctrl.csize)
+				return false;
 
 			if (tch >= 0) {	/* character transition */
 				int     ec = ecgroup[tch];
 
-				mkechar (ec, dupfwd, duplist);
+				ecpart_split1 (&part, ec);
 				symlist[ec] = 1;
 			}
 
@@ -1013,8 +2079,7 @@ void sympartition (int ds[], int numstates, int symlist[], int duplist[])
 
 				lenccl = ccllen[tch];
 				cclp = cclmap[tch];
-				mkeccl (ccltbl + cclp, lenccl, dupfwd,
-					duplist, numecs, NUL_ec);
+				ecpart_split (&part, ccltbl + cclp, lenccl, NUL_ec);
 
 				if (cclng[tch]) {
 					j = 0;
@@ -1045,4 +2110,7 @@ void sympartition (int ds[], int numstates, int symlist[], int duplist[])
 			}
 		}
 	}
+
+	ecpart_links (&part, duplist);
+	return true;
 }
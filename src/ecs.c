@@ -110,74 +110,80 @@ int     cre8ecs (int fwd[], int bck[], int num)
  * characters, bck is the backward link-list, and llsiz size of the link-list.
  *
  * NUL_mapping is the value which NUL (0) should be mapped to.
+ *
+ * mkeccl() keeps no state between calls, so it may be called from the
+ * subset construction's worker threads.
  */
 
 void    mkeccl (unsigned char ccls[], int lenccl, int fwd[], int bck[], int llsiz, int NUL_mapping)
 {
 	int     cclp, oldec, newec;
-	int     cclm, i, j;
-	static unsigned char cclflags[CSIZE];	/* initialized to all '\0' */
-
-	/* Note that it doesn't matter whether or not the character class is
+	int     cclm, i, next;
+	unsigned char cclflags[CSIZE + 1];
+
+	/* cclflags[c] is 1 for a member of the ccl that has not yet been
+	 * put in a new equivalence class and 2 once it has, and 0 for
+	 * anything else.  So finding out whether an equivalence class
+	 * companion is in the ccl is one lookup, rather than a search of
+	 * the ccl.
+	 *
+	 * Note that it doesn't matter whether or not the character class is
 	 * negated.  The same results will be obtained in either case.
 	 */
+	memset (cclflags, 0, sizeof (cclflags));
 
-	cclp = 0;
+	for (cclp = 0; cclp < lenccl; ++cclp) {
+		cclm = ccls[cclp];
 
-	while (cclp < lenccl) {
+		if (NUL_mapping && cclm == 0)
+			cclm = NUL_mapping;
+
+		cclflags[cclm] = 1;
+	}
+
+	for (cclp = 0; cclp < lenccl; ++cclp) {
 		cclm = ccls[cclp];
 
 		if (NUL_mapping && cclm == 0)
 			cclm = NUL_mapping;
 
+		if (cclflags[cclm] != 1)
+			/* already moved along with an earlier member */
+			continue;
+
+		cclflags[cclm] = 2;
+
 		oldec = bck[cclm];
 		newec = cclm;
 
-		j = cclp + 1;
-
-		for (i = fwd[cclm]; i != NIL && i <= llsiz; i = fwd[i]) {	/* look for the symbol in the character class */
-			for (; j < lenccl; ++j) {
-				int ccl_char;
-
-				if (NUL_mapping && ccls[j] == 0)
-					ccl_char = NUL_mapping;
-				else
-					ccl_char = ccls[j];
-
-				if (ccl_char > i)
-					break;
-
-				if (ccl_char == i && !cclflags[j]) {
-					/* We found an old companion of cclm
-					 * in the ccl.  Link it into the new
-					 * equivalence class and flag it as
-					 * having been processed.
-					 */
-
-					bck[i] = newec;
-					fwd[newec] = i;
-					newec = i;
-					/* Set flag so we don't reprocess. */
-					cclflags[j] = 1;
-
-					/* Get next equivalence class member. */
-					/* continue 2 */
-					goto next_pt;
-				}
-			}
+		for (i = fwd[cclm]; i != NIL && i <= llsiz; i = next) {
+			next = fwd[i];
 
-			/* Symbol isn't in character class.  Put it in the old
-			 * equivalence class.
-			 */
+			if (cclflags[i] == 1) {
+				/* We found an old companion of cclm
+				 * in the ccl.  Link it into the new
+				 * equivalence class and flag it as
+				 * having been processed.
+				 */
+
+				bck[i] = newec;
+				fwd[newec] = i;
+				newec = i;
+				cclflags[i] = 2;
+			}
 
-			bck[i] = oldec;
+			else {
+				/* Symbol isn't in character class.  Put it
+				 * in the old equivalence class.
+				 */
 
-			if (oldec != NIL)
-				fwd[oldec] = i;
+				bck[i] = oldec;
 
-			oldec = i;
+				if (oldec != NIL)
+					fwd[oldec] = i;
 
-		      next_pt:;
+				oldec = i;
+			}
 		}
 
 		if (bck[cclm] != NIL || oldec != bck[cclm]) {
@@ -186,13 +192,6 @@ void    mkeccl (unsigned char ccls[], int lenccl, int fwd[], int bck[], int llsi
 		}
 
 		fwd[newec] = NIL;
-
-		/* Find next ccl member to process. */
-
-		for (++cclp; cclp < lenccl && cclflags[cclp]; ++cclp) {
-			/* Reset "doesn't need processing" flag. */
-			cclflags[cclp] = 0;
-		}
 	}
 }
 
@@ -214,3 +213,124 @@ void    mkechar (int tch, int fwd[], int bck[])
 	fwd[tch] = NIL;
 	bck[tch] = NIL;
 }
+
+
+/* The subset construction needs, for each dfa, the partition of the
+ * equivalence classes by the out-transitions they share.  Doing that
+ * with mkeccl() means walking linked lists for every class-labelled nfa
+ * state of every dfa.  A struct ec_partition instead gives every symbol
+ * the number of its class, which stands for the set of transitions (the
+ * signature) the symbol has been seen in so far.  Splitting by one more
+ * transition touches only the symbols on that transition, so
+ * partitioning a dfa costs about the total length of its transitions'
+ * symbol lists.
+ */
+
+/* ecpart_init - start a partition of the symbols 1..num as one class */
+
+void    ecpart_init (struct ec_partition *p, int num)
+{
+	int     i;
+
+	p->num = num;
+	p->numcls = 1;
+	p->size[0] = num;
+
+	for (i = 0; i <= num; ++i) {
+		p->cls[i] = 0;
+		p->moved[i] = 0;
+	}
+}
+
+
+/* ecpart_split - split classes by a ccl's symbols
+ *
+ * ccls and NUL_mapping are as for mkeccl().  Symbols beyond p->num are
+ * ignored, as are repeated ones.
+ */
+
+void    ecpart_split (struct ec_partition *p, unsigned char ccls[], int lenccl,
+		      int NUL_mapping)
+{
+	int     syms[CSIZE + 1];
+	int     i, c, len, sym, numtouched;
+
+	len = numtouched = 0;
+
+	for (i = 0; i < lenccl; ++i) {
+		sym = ccls[i];
+
+		if (NUL_mapping && sym == 0)
+			sym = NUL_mapping;
+
+		if (sym < 1 || sym > p->num || p->cls[sym] < 0)
+			continue;
+
+		/* Count the symbol against its class, and mark it so that
+		 * a repeat of it is not counted again.
+		 */
+		c = p->cls[sym];
+
+		if (p->moved[c]++ == 0)
+			p->touched[numtouched++] = c;
+
+		p->cls[sym] = -1 - c;
+		syms[len++] = sym;
+	}
+
+	/* A class some of whose symbols were counted splits in two, with
+	 * the counted symbols going to a new class.  One all of whose
+	 * symbols were counted is left as it is.
+	 */
+	for (i = 0; i < numtouched; ++i) {
+		c = p->touched[i];
+
+		if (p->moved[c] < p->size[c]) {
+			p->split[c] = p->numcls;
+			p->size[p->numcls++] = p->moved[c];
+			p->size[c] -= p->moved[c];
+		}
+		else
+			p->split[c] = c;
+	}
+
+	for (i = 0; i < len; ++i)
+		p->cls[syms[i]] = p->split[-1 - p->cls[syms[i]]];
+
+	for (i = 0; i < numtouched; ++i)
+		p->moved[p->touched[i]] = 0;
+}
+
+
+/* ecpart_split1 - give a single symbol a class of its own */
+
+void    ecpart_split1 (struct ec_partition *p, int sym)
+{
+	int     c = p->cls[sym];
+
+	if (p->size[c] > 1) {
+		--p->size[c];
+		p->size[p->numcls] = 1;
+		p->cls[sym] = p->numcls++;
+	}
+}
+
+
+/* ecpart_links - list the classes the way mkeccl() does
+ *
+ * Sets bck[sym] to the next smaller symbol in sym's class, or NIL if sym
+ * is the smallest.
+ */
+
+void    ecpart_links (struct ec_partition *p, int bck[])
+{
+	int     i;
+
+	for (i = 0; i < p->numcls; ++i)
+		p->split[i] = NIL;
+
+	for (i = 1; i <= p->num; ++i) {
+		bck[i] = p->split[p->cls[i]];
+		p->split[p->cls[i]] = i;
+	}
+}
@@ -31,6 +31,16 @@ static const char * check_4_gnu_m4 =
 /** global chain. */
 struct filter *output_chain = NULL;
 
+/* An internal chain waiting for flex's output, which goes to spool in the
+ * meantime; spooled_out is where the chain's own output is to go.
+ */
+static struct filter *spooled_chain = NULL;
+static FILE *spool = NULL;
+static FILE *spooled_out = NULL;
+
+/** side file for table bodies; see table_body_begin(). */
+FILE   *table_bodies = NULL;
+
 /* Allocate and initialize an external filter.
  * @param chain the current chain or NULL for new chain
  * @param cmd the command to execute.
@@ -141,7 +151,7 @@ bool filter_apply_chain (struct filter * chain)
 	 */
 
 	fflush (stdout);
-	fflush (stderr);
+	fflush (flex_run->err);
 
 
 	if (pipe (pipes) == -1)
@@ -172,6 +182,8 @@ bool filter_apply_chain (struct filter * chain)
 		if (chain->filter_func) {
 			int     r;
 
+			chain->in = stdin;
+			chain->out = stdout;
 			if ((r = chain->filter_func (chain)) == -1)
 				flexfatal (_("filter_func failed"));
 			FLEX_EXIT (0);
@@ -217,6 +229,45 @@ int filter_truncate (struct filter *chain, int max_len)
 	return len;
 }
 
+/* tee_prologue - start a branch of the output with the m4 setup it needs */
+
+static void tee_prologue (FILE *f, bool header)
+{
+	const char *name = header ? env.headerfilename : env.outfilename;
+
+	fputs (check_4_gnu_m4, f);
+	fputs ("m4_changecom`'m4_dnl\n", f);
+	fputs ("m4_changequote`'m4_dnl\n", f);
+	fputs ("m4_changequote([[,]])[[]]m4_dnl\n", f);
+	fputs ("m4_define([[M4_YY_NOOP]])[[]]m4_dnl\n", f);
+	if (header)
+		fputs ("m4_define([[M4_YY_IN_HEADER]],[[]])m4_dnl\n", f);
+	fprintf (f, "m4_define( [[M4_YY_OUTFILE_NAME]],[[%s]])m4_dnl\n",
+		 name != NULL ? name : "<stdout>");
+}
+
+/* tee_close - end a branch of the output and close it */
+
+static void tee_close (FILE *f, bool header, const char *name)
+{
+	if (header) {
+		fprintf (f, "\n");
+
+		/* write a fake line number. It will get fixed by the linedir filter. */
+		if (ctrl.gen_line_dirs)
+			line_directive_out (f, NULL, 4000);
+	}
+
+	fflush (f);
+	if (ferror (f))
+		lerr (_("error writing output file %s"),
+			name != NULL ? name : "<stdout>");
+
+	else if (fclose (f))
+		lerr (_("error closing output file %s"),
+			name != NULL ? name : "<stdout>");
+}
+
 /** Splits the chain in order to write to a header file.
  *  Similar in spirit to the 'tee' program.
  *  The header file name is in extra.
@@ -255,25 +306,9 @@ int filter_tee_header (struct filter *chain)
 	/* Now to_c is a pipe to the C branch, and to_h is a pipe to the H branch.
 	 */
 
-	if (write_header) {
-		fputs (check_4_gnu_m4, to_h);
-		fputs ("m4_changecom`'m4_dnl\n", to_h);
-		fputs ("m4_changequote`'m4_dnl\n", to_h);
-	fputs ("m4_changequote([[,]])[[]]m4_dnl\n", to_h);
-		fputs ("m4_define([[M4_YY_NOOP]])[[]]m4_dnl\n", to_h);
-		fputs ("m4_define([[M4_YY_IN_HEADER]],[[]])m4_dnl\n", to_h);
-		fprintf (to_h,
-			 "m4_define( [[M4_YY_OUTFILE_NAME]],[[%s]])m4_dnl\n",
-			 env.headerfilename != NULL ? env.headerfilename : "<stdout>");
-	}
-
-	fputs (check_4_gnu_m4, to_c);
-	fputs ("m4_changecom`'m4_dnl\n", to_c);
-	fputs ("m4_changequote`'m4_dnl\n", to_c);
-	fputs ("m4_changequote([[,]])[[]]m4_dnl\n", to_c);
-	fputs ("m4_define([[M4_YY_NOOP]])[[]]m4_dnl\n", to_c);
-	fprintf (to_c, "m4_define( [[M4_YY_OUTFILE_NAME]],[[%s]])m4_dnl\n",
-		 env.outfilename != NULL ? env.outfilename : "<stdout>");
+	if (write_header)
+		tee_prologue (to_h, true);
+	tee_prologue (to_c, false);
 
 	while (fgets (buf, sizeof buf, stdin)) {
 		fputs (buf, to_c);
@@ -281,35 +316,186 @@ int filter_tee_header (struct filter *chain)
 			fputs (buf, to_h);
 	}
 
-	if (write_header) {
-		fprintf (to_h, "\n");
+	if (write_header)
+		tee_close (to_h, true, (char *) chain->extra);
+	tee_close (to_c, false, env.outfilename);
 
-		/* write a fake line number. It will get fixed by the linedir filter. */
-		if (ctrl.gen_line_dirs)
-			line_directive_out (to_h, NULL, 4000);
-		fflush (to_h);
-		if (ferror (to_h))
-			lerr (_("error writing output file %s"),
-				(char *) chain->extra);
-
-		else if (fclose (to_h))
-			lerr (_("error closing output file %s"),
-				(char *) chain->extra);
+	while (wait (0) > 0) ;
+
+	FLEX_EXIT (0);
+	return 0;
+}
+
+/* filter_tmpfile - a temporary file to pass output from one filter to the
+ * next, and in *w a stream writing to it that can be closed on its own.
+ */
+static FILE *filter_tmpfile (FILE **w)
+{
+	FILE   *f;
+	int     fd;
+
+	if ((f = tmpfile ()) == NULL)
+		flexfatal (_("tmpfile failed in filter_tmpfile"));
+	if ((fd = dup (fileno (f))) == -1 || (*w = fdopen (fd, "w")) == NULL)
+		flexfatal (_("dup failed in filter_tmpfile"));
+	return f;
+}
+
+static void run_chain (struct filter *chain, FILE *in, FILE *out);
+
+/* run_tee - filter_tee_header() for run_chain(): write each branch out in
+ * full, then run the rest of the chain on the scanner and on its header.
+ */
+static void run_tee (struct filter *chain, FILE *in, FILE *out)
+{
+	char    buf[65536];
+	FILE   *c = NULL, *h = NULL, *to_c = out, *to_h = NULL, *h_out = NULL;
+	size_t  n;
+
+	if (chain->extra != NULL) {
+		if (flex_run->header != NULL) {
+			/* Under libflex, the header goes to the caller. */
+			int     fd = dup (fileno (flex_run->header));
+
+			if (fd == -1 || (h_out = fdopen (fd, "w")) == NULL)
+				flexfatal (_("dup failed in run_tee"));
+		}
+		else if ((h_out = fopen ((char *) chain->extra, "w")) == NULL)
+			lerr (_("could not create %s"), (char *) chain->extra);
+		to_h = h_out;
+	}
+	if (chain->next) {
+		c = filter_tmpfile (&to_c);
+		if (to_h)
+			h = filter_tmpfile (&to_h);
 	}
 
-	fflush (to_c);
-	if (ferror (to_c))
-		lerr (_("error writing output file %s"),
-			env.outfilename != NULL ? env.outfilename : "<stdout>");
+	if (to_h)
+		tee_prologue (to_h, true);
+	tee_prologue (to_c, false);
 
-	else if (fclose (to_c))
-		lerr (_("error closing output file %s"),
-			env.outfilename != NULL ? env.outfilename : "<stdout>");
+	while ((n = fread (buf, 1, sizeof buf, in)) > 0) {
+		fwrite (buf, 1, n, to_c);
+		if (to_h)
+			fwrite (buf, 1, n, to_h);
+	}
+	fclose (in);
+
+	if (to_h)
+		tee_close (to_h, true, (char *) chain->extra);
+	tee_close (to_c, false, env.outfilename);
+
+	if (chain->next) {
+		rewind (c);
+		run_chain (chain->next, c, out);
+		if (h) {
+			rewind (h);
+			run_chain (chain->next, h, h_out);
+		}
+	}
+}
 
-	while (wait (0) > 0) ;
+/* run_chain - run the internal filters of chain in turn, in this process,
+ * each on the output of the one before.  in is the input of the first and
+ * out the output of the last; both end up closed.
+ */
+static void run_chain (struct filter *chain, FILE *in, FILE *out)
+{
+	while (chain) {
+		FILE   *next = NULL;
 
-	FLEX_EXIT (0);
-	return 0;
+		if (chain->filter_func == filter_tee_header) {
+			run_tee (chain, in, out);
+			return;
+		}
+
+		chain->in = in;
+		if (chain->next)
+			next = filter_tmpfile (&chain->out);
+		else
+			chain->out = out;
+
+		if (chain->filter_func (chain) == -1)
+			flexfatal (_("filter_func failed"));
+		fclose (in);
+
+		if (next)
+			rewind (next);
+		in = next;
+		chain = chain->next;
+	}
+}
+
+/** Arrange to run a chain of internal filters in flex's own process, with
+ *  no forks or pipes: flex's output goes to a spool file until
+ *  filter_run_spooled() runs the chain over it.
+ *  @param chain The head of the chain.
+ *  @return false, having done nothing, if the chain has an external filter.
+ */
+bool filter_spool_chain (struct filter *chain)
+{
+	struct filter *f;
+
+	for (f = chain; f; f = f->next)
+		if (!f->filter_func)
+			return false;
+
+	fflush (flex_run->out);
+	spooled_out = flex_run->out;
+	spool = filter_tmpfile (&flex_run->out);
+
+	spooled_chain = chain;
+	return true;
+}
+
+/** Run the chain filter_spool_chain() set aside over flex's output, and
+ *  give flex back its own output stream.  Does nothing the second time.
+ *  @param ok false to throw the output away, as when flex failed.
+ */
+void filter_run_spooled (bool ok)
+{
+	struct filter *chain = spooled_chain;
+	FILE   *out;
+	int     fd;
+
+	if (chain == NULL)
+		return;
+	spooled_chain = NULL;
+
+	fclose (flex_run->out);
+	flex_run->out = spooled_out;
+	spooled_out = NULL;
+
+	if (!ok) {
+		fclose (spool);
+		spool = NULL;
+		return;
+	}
+
+	if (table_bodies != NULL)
+		fflush (table_bodies);
+	if ((fd = dup (fileno (flex_run->out))) == -1
+	    || (out = fdopen (fd, "w")) == NULL)
+		flexfatal (_("dup failed in filter_run_spooled"));
+	rewind (spool);
+	run_chain (chain, spool, out);
+	spool = NULL;
+}
+
+/** Free the output chain and close the side file, once a run is over. */
+void filter_cleanup (void)
+{
+	struct filter *f;
+
+	while ((f = output_chain) != NULL) {
+		output_chain = f->next;
+		free (f->argv);
+		free (f);
+	}
+	if (table_bodies != NULL) {
+		fclose (table_bodies);
+		table_bodies = NULL;
+	}
 }
 
 static bool is_blank_line (const char *str)
@@ -319,103 +505,285 @@ static bool is_blank_line (const char *str)
 	return (*str == '\0');
 }
 
+/* What filter_fix_linedirs() carries from one line to the next. */
+struct linedir_state {
+	char    buf[4096];	/* the line being assembled */
+	size_t  len;		/* bytes of it assembled so far */
+	int     lineno;
+	bool    in_gen;		/* in generated code */
+	bool    last_was_blank;
+	FILE   *out;
+};
+
+/* fix_linedir - adjust a #line directive, squeeze blank lines, and write
+ * out the line in st->buf.
+ */
+static void fix_linedir (struct linedir_state *st)
+{
+	char   *buf = st->buf;
+	const size_t readsz = sizeof st->buf;
+	regmatch_t m[10];
+
+	/* Check for directive. Note wired-in assumption:
+	 * field reference 1 is line number, 2 is filename.
+	 */
+	if (ctrl.traceline_re != NULL &&
+	    ctrl.traceline_template != NULL &&
+	    regexec (&regex_linedir, buf, 3, m, 0) == 0) {
+
+		char   *fname;
+
+		/* extract the line number and filename */
+		fname = regmatch_dup (&m[2], buf);
+
+		if (strcmp (fname,
+			env.outfilename != NULL ? env.outfilename : "<stdout>")
+				== 0
+		 || strcmp (fname,
+		 	env.headerfilename != NULL ? env.headerfilename : "<stdout>")
+				== 0) {
+
+			char    *s1, *s2;
+			char	filename[MAXLINE];
+
+			s1 = fname;
+			s2 = filename;
+
+			while ((s2 - filename) < (MAXLINE - 1) && *s1) {
+				/* Escape the backslash */
+				if (*s1 == '\\')
+					*s2++ = '\\';
+				/* Escape the double quote */
+				if (*s1 == '\"')
+					*s2++ = '\\';
+				/* Copy the character as usual */
+				*s2++ = *s1++;
+			}
+
+			*s2 = '\0';
+
+			/* Adjust the line directives. */
+			st->in_gen = true;
+			snprintf (buf, readsz, ctrl.traceline_template,
+				  st->lineno + 1, filename);
+			strncat(buf, "\n", readsz-1);
+		}
+		else {
+			/* it's a #line directive for code we didn't write */
+			st->in_gen = false;
+		}
+
+		free (fname);
+		st->last_was_blank = false;
+	}
+
+	/* squeeze blank lines from generated code */
+	else if (st->in_gen && is_blank_line(buf)) {
+		if (st->last_was_blank)
+			return;
+		else
+			st->last_was_blank = true;
+	}
+
+	else {
+		/* it's a line of normal, non-empty code. */
+		st->last_was_blank = false;
+	}
+
+	fputs (buf, st->out);
+	st->lineno++;
+}
+
+/* splice_put - add text to the line being assembled, breaking it into
+ * lines exactly where fgets() would have.
+ */
+static void splice_put (struct linedir_state *st, const char *str, size_t n)
+{
+	while (n-- > 0) {
+		char    c = *str++;
+
+		st->buf[st->len++] = c;
+		if (c == '\n' || st->len == sizeof st->buf - 1) {
+			st->buf[st->len] = '\0';
+			st->len = 0;
+			fix_linedir (st);
+		}
+	}
+}
+
+/* The hooks that may appear in a table body, as m4 would have seen them. */
+static const char *const table_hooks[] = {
+	"M4_HOOK_TABLE_OPENER",
+	"M4_HOOK_TABLE_CONTINUE",
+	"M4_HOOK_TABLE_CLOSER",
+};
+
+#define NUM_TABLE_HOOKS (sizeof table_hooks / sizeof table_hooks[0])
+
+/* splice_hooks - pass on one line of a table body, replacing its hooks
+ * with the expansions m4 gave them.
+ */
+static void splice_hooks (struct linedir_state *st, char *line,
+			  char *expansion[])
+{
+	char   *hook;
+
+	while ((hook = strstr (line, "M4_HOOK_TABLE_")) != NULL) {
+		size_t  i;
+
+		for (i = 0; i < NUM_TABLE_HOOKS; ++i)
+			if (strncmp (hook, table_hooks[i],
+				     strlen (table_hooks[i])) == 0)
+				break;
+
+		if (i == NUM_TABLE_HOOKS) {
+			splice_put (st, line, (size_t) (hook - line) + 1);
+			line = hook + 1;
+			continue;
+		}
+
+		splice_put (st, line, (size_t) (hook - line));
+		splice_put (st, expansion[i], strlen (expansion[i]));
+		line = hook + strlen (table_hooks[i]);
+	}
+
+	splice_put (st, line, strlen (line));
+}
+
+/* splice_body - pass on the table body at offset off in table_bodies.
+ *
+ * The body is read with pread() so that the flex process, which shares
+ * the file offset, can go on writing to the file.
+ */
+static void splice_body (struct linedir_state *st, off_t off, off_t len,
+			 char *expansion[])
+{
+	char    block[65536];
+	char   *line = NULL;
+	size_t  linelen = 0, linemax = 0;
+
+	while (len > 0) {
+		ssize_t n;
+		char   *p, *nl;
+
+		n = pread (fileno (table_bodies), block,
+			   (size_t) MIN (len, (off_t) sizeof block), off);
+		if (n <= 0)
+			flexerror (_("error reading table bodies"));
+		off += n;
+		len -= n;
+
+		for (p = block; p < block + n; p = nl) {
+			nl = memchr (p, '\n', (size_t) (block + n - p));
+			nl = nl != NULL ? nl + 1 : block + n;
+
+			if (linelen + (size_t) (nl - p) + 1 > linemax) {
+				linemax = MAX (2 * linemax,
+					       linelen + (size_t) (nl - p) + 1);
+				line = realloc (line, linemax);
+				if (line == NULL)
+					flexfatal (_("memory allocation failed in splice_body()"));
+			}
+			memcpy (line + linelen, p, (size_t) (nl - p));
+			linelen += (size_t) (nl - p);
+
+			if (line[linelen - 1] == '\n') {
+				line[linelen] = '\0';
+				splice_hooks (st, line, expansion);
+				linelen = 0;
+			}
+		}
+	}
+
+	/* The body may end without a newline. */
+	if (linelen > 0) {
+		line[linelen] = '\0';
+		splice_hooks (st, line, expansion);
+	}
+
+	free (line);
+}
+
+/* splice_table_body - replace the table body marker in st->buf with the
+ * body it stands for, and pass on the line around it.  Returns false if
+ * there is no well-formed marker in the line.
+ */
+static bool splice_table_body (struct linedir_state *st)
+{
+	char    line[sizeof st->buf];
+	char   *expansion[NUM_TABLE_HOOKS];
+	char   *marker, *p;
+	long long off, len;
+	size_t  i;
+
+	if ((marker = strstr (st->buf, TABLE_BODY_MARKER)) == NULL)
+		return false;
+
+	strcpy (line, st->buf);
+	st->len = 0;
+	marker = line + (marker - st->buf);
+	p = marker + strlen (TABLE_BODY_MARKER);
+	if (sscanf (p, "%lld %lld", &off, &len) != 2 ||
+	    (p = strstr (p, "@@")) == NULL)
+		return false;
+
+	/* The expanded hooks follow, each closed by "@@". */
+	for (i = 0; i < NUM_TABLE_HOOKS; ++i) {
+		expansion[i] = p + 2;
+		if ((p = strstr (p + 2, "@@")) == NULL)
+			return false;
+		*p = '\0';
+	}
+
+	splice_put (st, line, (size_t) (marker - line));
+	splice_body (st, (off_t) off, (off_t) len, expansion);
+	splice_put (st, p + 2, strlen (p + 2));
+	return true;
+}
+
 /** Adjust the line numbers in the #line directives of the generated scanner.
  * After the m4 expansion, the line numbers are incorrect since the m4 macros
  * can add or remove lines.  This only adjusts line numbers for generated code,
  * not user code. This also happens to be a good place to squeeze multiple
- * blank lines into a single blank line.
+ * blank lines into a single blank line, and to splice in the table bodies
+ * that went around m4.
  */
 int filter_fix_linedirs (struct filter *chain)
 {
-	char   buf[4096];
-	const char *cp;
-	const size_t readsz = sizeof buf;
-	int     lineno = 1;
-	bool    in_gen = true;	/* in generated code */
-	bool    last_was_blank = false;
+	struct linedir_state st;
 
 	if (!chain)
 		return 0;
 
-	while (fgets (buf, (int) readsz, stdin)) {
-
-		regmatch_t m[10];
-
-		/* Check for directive. Note wired-in assumption:
-		 * field reference 1 is line number, 2 is filename.
-		 */
-		if (ctrl.traceline_re != NULL &&
-		    ctrl.traceline_template != NULL &&
-		    regexec (&regex_linedir, buf, 3, m, 0) == 0) {
-
-			char   *fname;
-
-			/* extract the line number and filename */
-			fname = regmatch_dup (&m[2], buf);
-
-			if (strcmp (fname,
-				env.outfilename != NULL ? env.outfilename : "<stdout>")
-					== 0
-			 || strcmp (fname,
-			 	env.headerfilename != NULL ? env.headerfilename : "<stdout>")
-					== 0) {
-
-				char    *s1, *s2;
-				char	filename[MAXLINE];
-
-				s1 = fname;
-				s2 = filename;
-
-				while ((s2 - filename) < (MAXLINE - 1) && *s1) {
-					/* Escape the backslash */
-					if (*s1 == '\\')
-						*s2++ = '\\';
-					/* Escape the double quote */
-					if (*s1 == '\"')
-						*s2++ = '\\';
-					/* Copy the character as usual */
-					*s2++ = *s1++;
-				}
-
-				*s2 = '\0';
-
-				/* Adjust the line directives. */
-				in_gen = true;
-				snprintf (buf, readsz, ctrl.traceline_template,
-					  lineno + 1, filename);
-				strncat(buf, "\n", sizeof(buf)-1);
-			}
-			else {
-				/* it's a #line directive for code we didn't write */
-				in_gen = false;
-			}
+	st.len = 0;
+	st.lineno = 1;
+	st.in_gen = true;
+	st.last_was_blank = false;
+	st.out = chain->out;
 
-			free (fname);
-			last_was_blank = false;
-		}
-
-		/* squeeze blank lines from generated code */
-		else if (in_gen && is_blank_line(buf)) {
-			if (last_was_blank)
-				continue;
-			else
-				last_was_blank = true;
-		}
+	/* A splice can leave a partial line behind; reading the rest of it
+	 * into place keeps the line breaks where m4's output had them.
+	 */
+	while (fgets (st.buf + st.len, (int) (sizeof st.buf - st.len), chain->in)) {
+		if (table_bodies != NULL && splice_table_body (&st))
+			continue;
 
-		else {
-			/* it's a line of normal, non-empty code. */
-			last_was_blank = false;
-		}
+		st.len = 0;
+		fix_linedir (&st);
+	}
 
-		fputs (buf, stdout);
-		lineno++;
+	if (st.len > 0) {
+		st.buf[st.len] = '\0';
+		st.len = 0;
+		fix_linedir (&st);
 	}
-	fflush (stdout);
-	if (ferror (stdout))
+
+	fflush (st.out);
+	if (ferror (st.out))
 		lerr (_("error writing output file %s"),
 			env.outfilename != NULL ? env.outfilename : "<stdout>");
 
-	else if (fclose (stdout))
+	else if (fclose (st.out))
 		lerr (_("error closing output file %s"),
 			env.outfilename != NULL ? env.outfilename : "<stdout>");
 
@@ -150,25 +150,38 @@
 #define INITIAL_MAX_DFA_SIZE 750
 #define MAX_DFA_SIZE_INCREMENT 750
 
+/* Most words the epsilon closures ntod() caches may take up.  Past it,
+ * closures are walked each time they're needed.
+ */
+#define MAX_CLOSURE_CACHE_WORDS 4000000
+
 
 /* A note on the following masks.  They are used to mark accepting numbers
  * as being special.  As such, they implicitly limit the number of accepting
  * numbers (i.e., rules) because if there are too many rules the rule numbers
- * will overload the mask bits.  Fortunately, this limit is \large/ (0x2000 ==
- * 8192) so unlikely to actually cause any problems.  A check is made in
- * new_rule() to ensure that this limit is not reached.
+ * will overload the mask bits.  These are the masks flex uses internally;
+ * the generated scanner gets the smallest ones above its own accepting
+ * numbers (see scanner_trailing_mask()), so small scanners keep their
+ * 16-bit tables.  A check is made in new_rule() to ensure that the limit
+ * is not reached.
  */
 
 /* Mask to mark a trailing context accepting number. */
-#define YY_TRAILING_MASK 0x2000
+#define YY_TRAILING_MASK 0x20000000
 
 /* Mask to mark the accepting number of the "head" of a trailing context
  * rule.
  */
-#define YY_TRAILING_HEAD_MASK 0x4000
+#define YY_TRAILING_HEAD_MASK 0x40000000
+
+/* Maximum number of rules, as outlined in the above note.  The
+ * end-of-buffer action, one past the last rule, must stay below the
+ * masks too.
+ */
+#define MAX_RULE (YY_TRAILING_MASK - 2)
 
-/* Maximum number of rules, as outlined in the above note. */
-#define MAX_RULE (YY_TRAILING_MASK - 1)
+/* Smallest masks the generated scanner uses; see scanner_trailing_mask(). */
+#define MIN_SCANNER_TRAILING_MASK 0x2000
 
 
 /* NIL must be 0.  If not, its special meaning when making equivalence classes
@@ -180,6 +193,7 @@
 #define NO_TRANSITION NIL
 #define UNIQUE -1		/* marks a symbol as an e.c. representative */
 #define INFINITE_REPEAT -1		/* for x{5,} constructions */
+#define MIN_COUNTED_REPEAT 32	/* smallest m - n that --counted-repeats loops */
 
 #define INITIAL_MAX_CCLS 100	/* max number of unique character classes */
 #define MAX_CCLS_INCREMENT 100
@@ -192,21 +206,17 @@
 #define MAX_RULES_INCREMENT 100
 
 #define INITIAL_MNS 2000	/* default maximum number of nfa states */
-#define MNS_INCREMENT 1000	/* amount to bump above by if it's not enough */
 
 #define INITIAL_MAX_DFAS 1000	/* default maximum number of dfa states */
 #define MAX_DFAS_INCREMENT 1000
 
 #define JAMSTATE -32766		/* marks a reference to the state that always jams */
 
-/* Maximum number of NFA states. */
-#define MAXIMUM_MNS 31999
-#define MAXIMUM_MNS_LONG 1999999999
-
-/* Enough so that if it's subtracted from an NFA state number, the result
- * is guaranteed to be negative.
+/* Maximum number of NFA states.  NFA state numbers never reach the
+ * generated tables, so this only keeps the sizes of the arrays that hold
+ * the states within an int.
  */
-#define MARKER_DIFFERENCE (maximum_mns+2)
+#define MAXIMUM_MNS 1999999999
 
 /* Maximum number of nxt/chk pairs for non-templates. */
 #define INITIAL_MAX_XPAIRS 2000
@@ -323,8 +333,12 @@ struct ctrl_bundle_t {
 	bool fulltbl;		// (-Cf flag) don't compress the DFA state table 
  	bool gen_line_dirs;	// (no -L flag) generate #line directives 
 	trit interactive;	// (-I) generate an interactive scanner
+	bool large_input;	// buffer sizes, offsets and yyleng are ptrdiff_t
 	bool never_interactive;	// always use buffered input, don't check for tty.
 	bool lex_compat;	// (-l), maximize compatibility with AT&T lex 
+	bool mmap;		// generate yy_scan_file_mmap()
+	bool prefetch;		// generate yy_create_buffer_prefetch()
+	bool token_view;	// yytext is a view, not NUL-terminated
 	bool long_align;	// (-Ca flag), favor long-word alignment for speed 
 	bool no_yyinput;	// suppress use of yyinput()
 	bool no_unistd;		// suppress inclusion of unistd.h
@@ -397,18 +411,27 @@ struct ctrl_bundle_t {
 struct env_bundle_t {
 	bool backing_up_report;	// (-b flag), generate "lex.backup" file 
 				// listing backing-up states
+	char *cache_dir;	// (--cache-dir) where to keep built tables
+	bool counted_repeats;	// (--counted-repeats) loop large x{n,m}
 	bool did_outfilename;	// whether outfilename was explicitly set
 	char *headerfilename;	// name of the .h file to generate
+	const char *m4;		// (--m4) m4 program to run, or "builtin"
+	bool minimize;		// (--minimize) merge equivalent DFA states
 	bool nowarn;		// (-w) do not generate warnings 
 	int performance_hint;	// if > 0 (i.e., -p flag), generate a report 
 				// relating to scanner performance; 
 				// if > 1 (-p -p), report 
  				// on minor performance problems, too.
 	char *outfilename;	// output file name
+	bool pack;		// (-Cp) pack the tables largest state first
 	bool printstats;	// (-v) dump statistics
+	bool proto_index;	// (--proto-index) search all protos
 	char *skelname;		// name of skeleton for code generation
 	FILE *skelfile;		// the skeleton file'd descriptor
+	int stats;		// (--stats) 0, or a STATS_REPORT_* format
+	int threads;		// (-j) threads for the subset construction
 	bool trace;		// (-T) env.trace processing 
+	bool tune_tables;	// (--tune-tables) try compression settings
 	bool trace_hex; 	// use hex in trace/debug outputs not octal
 	bool use_stdout;	// the -t flag
 };
@@ -438,10 +461,14 @@ extern struct env_bundle_t env;
  * yymore_really_used - whether to treat yymore() as really used, regardless
  *   of what we think based on references to it in the user's actions.
  * reject_really_used - same for REJECT
+ * token_text_used - if true, an action uses yytext under %option token-view
+ * yytext_outside_action - first line that names yytext in code outside the
+ *   rule actions, or 0
   */
 
 extern int syntaxerror, eofseen;
 extern int yymore_used, reject, real_reject, continued_action, in_rule;
+extern int token_text_used, yytext_outside_action;
 
 /* Variables used in the flex input routines:
  * datapos - characters on current output line
@@ -492,7 +519,6 @@ extern int onenext[ONE_STACK_SIZE], onedef[ONE_STACK_SIZE], onesp;
 
 
 /* Variables for nfa machine data:
- * maximum_mns - maximal number of NFA states supported by tables
  * current_mns - current maximum on number of NFA states
  * num_rules - number of the last accepting state; also is number of
  * 	rules created so far
@@ -525,7 +551,7 @@ extern int onenext[ONE_STACK_SIZE], onedef[ONE_STACK_SIZE], onesp;
  * footprint - total size of tables, in bytes.
  */
 
-extern int maximum_mns, current_mns, current_max_rules;
+extern int current_mns, current_max_rules;
 extern int num_rules, num_eof_rules, default_rule, lastnfa;
 extern int *firstst, *lastst, *finalst, *transchar, *trans1, *trans2;
 extern int *accptnum, *assoc_rule, *state_type;
@@ -632,6 +658,7 @@ extern char **scname;
  *	number, if not
  * accsiz - size of accepting set for each dfa state
  * dhash - dfa state hash value
+ * dfatrans - out-transitions of each dfa, held while the dfa is minimized
  * numas - number of DFA accepting states created; note that this
  *	is not necessarily the same value as num_rules, which is the analogous
  *	value for the NFA
@@ -650,7 +677,8 @@ extern union dfaacc_union {
 	int    *dfaacc_set;
 	int     dfaacc_state;
 }      *dfaacc;
-extern int *accsiz, *dhash, numas;
+extern int *accsiz, numas, **dfatrans;
+extern uint64_t *dhash;
 extern int numsnpairs, jambase, jamstate;
 extern int end_of_buffer_state;
 
@@ -677,6 +705,7 @@ extern unsigned char *ccltbl;
  * sectnum - section number currently being parsed
  * nummt - number of empty nxt/chk table entries
  * hshcol - number of hash collisions detected by snstods
+ * dfalookups - number of times snstods looked up a set of NFA states
  * dfaeql - number of times a newly created dfa was equal to an old one
  * numeps - number of epsilon NFA states created
  * eps2 - number of epsilon states which have 2 out-transitions
@@ -689,16 +718,27 @@ extern unsigned char *ccltbl;
  * numdup - number of duplicate transitions
  * hshsave - number of hash collisions saved by checking number of states
  * num_backing_up - number of DFA states requiring backing up
+ * num_premin_dfas - number of DFA states before minimization
+ * pack_saved - number of nxt-chk entries saved by packing with -Cp
+ * proto_index_uses - number of states built on protos from --proto-index
+ * num_counted_repeats - number of x{n,m} left as loops by --counted-repeats
+ * num_cached_closures - number of epsilon closures ntod() cached
+ * closure_cache_words - number of words those closures took up
+ * num_uncached_closures - number of closures walked with the cache full
  * bol_needed - whether scanner needs beginning-of-line recognition
  */
 
 extern char nmstr[MAXLINE];
-extern int sectnum, nummt, hshcol, dfaeql, numeps, eps2, num_reallocs, nmval;
+extern int sectnum, nummt, hshcol, dfalookups, dfaeql, numeps, eps2;
+extern int num_reallocs, nmval;
 extern int tmpuses, totnst, peakpairs, numuniq, numdup, hshsave;
-extern int num_backing_up, bol_needed;
+extern int num_backing_up, num_premin_dfas, pack_saved, bol_needed;
+extern int proto_index_uses, num_counted_repeats;
+extern int num_cached_closures, closure_cache_words, num_uncached_closures;
 
 void   *allocate_array(int, size_t);
 void   *reallocate_array(void *, int, size_t);
+void   *try_reallocate_array(void *, int, size_t);
 
 #define allocate_integer_array(size) \
 	allocate_array(size, sizeof(int))
@@ -706,6 +746,9 @@ void   *reallocate_array(void *, int, size_t);
 #define reallocate_integer_array(array,size) \
 	reallocate_array((void *) array, size, sizeof(int))
 
+#define try_reallocate_integer_array(array,size) \
+	try_reallocate_array((void *) array, size, sizeof(int))
+
 #define allocate_bool_array(size) \
 	allocate_array(size, sizeof(bool))
 
@@ -730,6 +773,12 @@ void   *reallocate_array(void *, int, size_t);
 #define reallocate_dfaacc_union(array, size) \
 	reallocate_array((void *) array, size, sizeof(union dfaacc_union))
 
+#define allocate_hash_array(size) \
+	allocate_array(size, sizeof(uint64_t))
+
+#define reallocate_hash_array(array,size) \
+	reallocate_array((void *) array, size, sizeof(uint64_t))
+
 #define allocate_character_array(size) \
 	allocate_array( size, sizeof(char))
 
@@ -751,6 +800,7 @@ void   *reallocate_array(void *, int, size_t);
 extern void ccladd(int, int);	/* add a single character to a ccl */
 extern int cclinit(void);	/* make an empty ccl */
 extern void cclnegate(int);	/* negate a ccl */
+extern bool ccl_contains(const int, const int); /* test a character */
 extern int ccl_set_diff (int a, int b); /* set difference of two ccls. */
 extern int ccl_set_union (int a, int b); /* set union of two ccls. */
 
@@ -767,15 +817,16 @@ extern void check_for_backing_up(int, int[]);
 extern void check_trailing_context(int *, int, int *, int);
 
 /* Construct the epsilon closure of a set of ndfa states. */
-extern int *epsclosure(int *, int *, int[], int *, int *);
+extern int *epsclosure(int *, int *, int[], int *, uint64_t *);
 
 /* Increase the maximum number of dfas. */
 extern void increase_max_dfas(void);
 
 extern size_t ntod(void);	/* convert a ndfa to a dfa */
+extern void ntod_cleanup(void);	/* release what ntod() keeps */
 
 /* Converts a set of ndfa states into a dfa state. */
-extern int snstods(int[], int, int[], int, int, int *);
+extern int snstods(int[], int, int[], int, uint64_t, int *);
 
 
 /* from file ecs.c */
@@ -792,6 +843,28 @@ extern void mkeccl(unsigned char[], int, int[], int[], int, int);
 /* Create equivalence class for single character. */
 extern void mkechar(int, int[], int[]);
 
+/* A partition of the symbols 1..num into classes, which ecpart_split()
+ * and ecpart_split1() refine one transition at a time.
+ */
+struct ec_partition {
+	int     num, numcls;
+	int     cls[CSIZE + 1];	/* class number of each symbol */
+	int     size[CSIZE + 1];	/* number of symbols in each class */
+	int     moved[CSIZE + 1], split[CSIZE + 1], touched[CSIZE + 1];
+};
+
+/* Start a partition with all symbols in one class. */
+extern void ecpart_init(struct ec_partition *, int);
+
+/* Split classes by the members of a character class. */
+extern void ecpart_split(struct ec_partition *, unsigned char[], int, int);
+
+/* Give a single symbol a class of its own. */
+extern void ecpart_split1(struct ec_partition *, int);
+
+/* Link each symbol to the previous one of its class, as mkeccl() does. */
+extern void ecpart_links(struct ec_partition *, int[]);
+
 
 /* from file gen.c */
 
@@ -824,9 +897,15 @@ extern void indent_puts(const char *);
 /* generate transition tables */
 extern void make_tables(void);
 
+/* Generate the table mapping rules to line numbers for -d. */
+extern void gendebugtbl(void);
+
 /* Select a type for optimal packing */
 struct packtype_t *optimize_pack(size_t);
 
+/* The scanner's YY_TRAILING_MASK; YY_TRAILING_HEAD_MASK is twice it. */
+extern int scanner_trailing_mask(void);
+
 /* from file main.c */
 
 extern void check_options(void);
@@ -876,7 +955,7 @@ extern void flexfatal(const char *);
 #if HAVE_DECL___FUNC__
 #define flex_die(msg) \
     do{ \
-        fprintf (stderr,\
+        fprintf (flex_run->err,\
                 _("%s: fatal internal error at %s:%d (%s): %s\n"),\
                 program_name, __FILE__, (int)__LINE__,\
                 __func__,msg);\
@@ -885,7 +964,7 @@ extern void flexfatal(const char *);
 #else /* ! HAVE_DECL___FUNC__ */
 #define flex_die(msg) \
     do{ \
-        fprintf (stderr,\
+        fprintf (flex_run->err,\
                 _("%s: fatal internal error at %s:%d %s\n"),\
                 program_name, __FILE__, (int)__LINE__,\
                 msg);\
@@ -910,6 +989,13 @@ extern void lerr_fatal(const char *, ...)
 /* Spit out a "#line" statement. */
 extern void line_directive_out(FILE *, char *, int);
 
+/* Return the number of the lowest set bit of a non-zero word. */
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define lowest_bit(word) __builtin_ctzll (word)
+#else
+extern int lowest_bit(uint64_t);
+#endif
+
 /* Mark the current position in the action array as the end of the section 1
  * user defs.
  */
@@ -940,6 +1026,16 @@ extern void outc(int);
 extern void outn(const char *);
 extern void out_m4_define(const char* def, const char* val);
 
+/* Send the output somewhere other than flex's own, or back to it. */
+extern void out_redirect(FILE *);
+
+/* Forget any redirection or open table body after a run. */
+extern void out_reset(void);
+
+/* Open and close the m4 definition of a table body. */
+extern void table_body_begin(const char *);
+extern void table_body_end(void);
+
 /* Return a printable version of the given character, which might be
  * 8-bit.
  */
@@ -963,6 +1059,15 @@ extern int copysingl(int, int);
 /* Debugging routine to write out an nfa. */
 extern void dumpnfa(int);
 
+/* Put back the copies of counted repeats that cannot stay loops. */
+extern void finish_counted_repeats(void);
+
+/* Return the length at which a rule's counted repeat stops the match. */
+extern int counted_repeat_limit(int);
+
+/* Forget the counted repeats of the last run. */
+extern void reset_counted_repeats(void);
+
 /* Finish up the processing for a rule. */
 extern void finish_rule(int, int, int, int, int);
 
@@ -1030,6 +1135,9 @@ extern int flexscan(void);
 /* Open the given file (if NULL, stdin) for scanning. */
 extern void set_input_file(char *);
 
+/* Return the scanner to its initial state after a run. */
+extern void scan_reset(void);
+
 /* from file skeletons.c */
 
 /* return the correct file suffix for the selrcted back end */
@@ -1065,6 +1173,12 @@ extern void scinstal(const char *, int);	/* make a start condition */
 /* Lookup the number associated with a start condition. */
 extern int sclookup(const char *);
 
+/* Report the occupancy of the symbol tables. */
+extern void symtab_stats(FILE *);
+
+/* Empty the symbol tables for another run. */
+extern void symtab_reset(void);
+
 /* Supply context argument for a function if required */
 extern void context_call(char *);
 
@@ -1079,6 +1193,7 @@ extern void expand_nxt_chk(void);	/* increase nxt/chk arrays */
 /* Finds a space in the table for a state to be placed. */
 extern int find_table_space(int *, int);
 extern void inittbl(void);	/* initialize transition tables */
+extern void freetbl(void);	/* release the compression tables */
 
 /* Make the default, "jam" table entries. */
 extern void mkdeftbl(void);
@@ -1088,12 +1203,18 @@ extern void mkdeftbl(void);
  */
 extern void mk1tbl(int, int, int, int);
 
+/* Place the states queued for -Cp. */
+extern void pack_tables(void);
+
 /* Place a state into full speed transition table. */
 extern void place_state(int *, int, int);
 
 /* Save states with only one out-transition to be processed later. */
 extern void stack1(int, int, int, int);
 
+/* Try several table compression settings for --tune-tables. */
+extern void tune_tables(void);
+
 
 /* from file yylex.c */
 
@@ -1121,10 +1242,29 @@ extern struct Buf top_buf;     /* contains %top code. String buffer. */
 #define OUT_BEGIN_CODE() outn("m4_ifdef( [[M4_YY_IN_HEADER]],,[[m4_dnl")
 #define OUT_END_CODE()   outn("]])")
 
-/* For setjmp/longjmp (instead of calling exit(2)). Linkage in main.c */
-extern jmp_buf flex_main_jmp_buf;
+/* One run of the generator, from the options to the finished scanner.
+ * flex_main() sets one up on the process's standard streams; libflex
+ * sets one up for each flex_generate(), with the caller's text as the
+ * input and temporary files standing in for the outputs, so that a run
+ * touches nothing of the process it runs in.  Linkage in main.c.
+ */
+struct flex_run_t {
+	jmp_buf exit_to;	// where FLEX_EXIT() ends the run
+	FILE *in;		// (libflex) the text of the input file in_name
+	const char *in_name;
+	FILE *out;		// flex's standard output, closed when the run ends
+	FILE *header;		// (libflex) where the header goes, if not to its file
+	bool in_process;	// (libflex) write no scanner file, start no processes
+	FILE *err;		// flex's messages
+};
+
+extern struct flex_run_t *flex_run;
 
-#define FLEX_EXIT(status) longjmp(flex_main_jmp_buf,(status)+1)
+/* Run the generator on the given arguments; returns the exit status. */
+extern int flex_run_args(struct flex_run_t *, int argc, char *argv[]);
+
+/* For setjmp/longjmp (instead of calling exit(2)). */
+#define FLEX_EXIT(status) longjmp(flex_run->exit_to,(status)+1)
 
 /* Removes all \n and \r chars from tail of str. returns str. */
 extern char *chomp (char *str);
@@ -1166,6 +1306,8 @@ struct filter {
     void * extra;         /**< extra data passed to filter_func */
 	int     argc;         /**< arg count */
 	const char ** argv;   /**< arg vector, \0-terminated */
+	FILE  * in;           /**< input of an internal filter */
+	FILE  * out;          /**< output of an internal filter */
     struct filter * next; /**< next filter or NULL */
 };
 
@@ -1176,10 +1318,70 @@ struct filter *filter_create_int(struct filter *chain,
 				  int (*filter_func) (struct filter *),
                   void *extra);
 extern bool filter_apply_chain(struct filter * chain);
+extern bool filter_spool_chain(struct filter * chain);
+extern void filter_run_spooled(bool ok);
+extern void filter_cleanup(void);
 extern int filter_truncate(struct filter * chain, int max_len);
 extern int filter_tee_header(struct filter *chain);
 extern int filter_fix_linedirs(struct filter *chain);
 
+/* Side file that carries table bodies past m4, or NULL when they go
+ * through it.  filter_fix_linedirs() splices a body back in where m4
+ * left its marker.
+ */
+extern FILE *table_bodies;
+#define TABLE_BODY_MARKER "@@flex-table-body "
+
+/* From "m4.c" */
+extern int filter_m4(struct filter *chain);
+
+/* From "cache.c" */
+
+/* The parts of the output the cache keeps. */
+#define CACHE_DFA 0		/* what ntod() writes */
+#define CACHE_TABLES 1		/* what make_tables() writes */
+#define CACHE_PARTS 2
+
+extern bool cache_lookup(void);
+extern void cache_record(int);
+extern void cache_replay(int);
+extern void cache_store(void);
+extern void cache_cleanup(void);
+
+/* Warn about a rule while building the DFA. */
+extern void cache_rule_warning(const char *, int);
+
+
+/* From "stats.c" */
+
+/* What --stats reports in. */
+#define STATS_REPORT_TIMING 1	/* a table */
+#define STATS_REPORT_JSON 2	/* a JSON object */
+
+/* The phases --stats times.  Those from STATS_CLOSURE to STATS_CMPTMPS
+ * are parts of STATS_NTOD.
+ */
+enum stats_phase {
+	STATS_PARSE,		/* reading the rules and building the NFA */
+	STATS_ECS,		/* making the equivalence classes */
+	STATS_NTOD,		/* building the DFA and compressing it */
+	STATS_CLOSURE,		/* computing the state sets */
+	STATS_LOOKUP,		/* finding them among the DFA states */
+	STATS_PLACEMENT,	/* placing the states in the tables */
+	STATS_MINIMIZE,
+	STATS_CMPTMPS,		/* compressing the templates */
+	STATS_TABLES,		/* make_tables() */
+	STATS_OUTPUT,		/* the skeleton, actions and user code */
+	STATS_FILTERS,		/* waiting for m4 and the other filters */
+	STATS_TOTAL,
+	NUM_STATS_PHASES
+};
+
+extern void stats_begin(enum stats_phase);
+extern void stats_end(enum stats_phase);
+extern void stats_report(void);
+extern void stats_cache(bool hit);	/* what --cache-dir did */
+
 
 /*
  * From "regex.c"
@@ -59,6 +59,39 @@ struct packtype_t *optimize_pack(size_t sz)
 	return &out;
 }
 
+/* scanner_trailing_mask - the generated scanner's YY_TRAILING_MASK
+ *
+ * This is the smallest power of two, from MIN_SCANNER_TRAILING_MASK up,
+ * above all the scanner's accepting numbers, the end-of-buffer action
+ * included.  YY_TRAILING_HEAD_MASK is the next power of two.
+ */
+int scanner_trailing_mask (void)
+{
+	int     mask = MIN_SCANNER_TRAILING_MASK;
+
+	while (mask <= num_rules + 1)
+		mask <<= 1;
+
+	return mask;
+}
+
+/* scanner_accnum - move an accepting number onto the scanner's masks */
+static int scanner_accnum (int accnum)
+{
+	int     mask = scanner_trailing_mask ();
+
+	if (accnum <= 0)
+		return accnum;
+
+	if (accnum & YY_TRAILING_HEAD_MASK)
+		return (accnum & ~YY_TRAILING_HEAD_MASK) | (mask << 1);
+
+	if (accnum & YY_TRAILING_MASK)
+		return (accnum & ~YY_TRAILING_MASK) | mask;
+
+	return accnum;
+}
+
 /** Make the table for possible eol matches.
  *  @return the newly allocated rule_can_match_eol table
  */
@@ -90,7 +123,7 @@ static void geneoltbl (void)
 	outn ("m4_ifdef( [[M4_MODE_YYLINENO]],[[");
 	out_str ("m4_define([[M4_HOOK_EOLTABLE_TYPE]], [[%s]])\n", ptype->name);
 	out_dec ("m4_define([[M4_HOOK_EOLTABLE_SIZE]], [[%d]])", num_rules + 1);
-	outn ("m4_define([[M4_HOOK_EOLTABLE_BODY]], [[m4_dnl");
+	table_body_begin ("M4_HOOK_EOLTABLE_BODY");
 
 	if (gentables) {
 		for (i = 1; i <= num_rules; i++) {
@@ -101,8 +134,33 @@ static void geneoltbl (void)
 		}
 	}
 	footprint += num_rules * ptype->width;
+	table_body_end ();
 	outn ("]])");
-	outn ("]])");
+}
+
+/* Generate the table of lengths at which counted repeats stop the match. */
+static void genreplimtbl (void)
+{
+	int     i, limit, max_limit = 0;
+	struct packtype_t *ptype;
+
+	for (i = 1; i <= num_rules; i++)
+		max_limit = MAX (max_limit, counted_repeat_limit (i));
+	ptype = optimize_pack((size_t) max_limit);
+
+	out_str ("m4_define([[M4_HOOK_REPLIMIT_TYPE]], [[%s]])\n", ptype->name);
+	out_dec ("m4_define([[M4_HOOK_REPLIMIT_SIZE]], [[%d]])", num_rules + 2);
+	table_body_begin ("M4_HOOK_REPLIMIT_BODY");
+
+	for (i = 1; i <= num_rules + 1; i++) {
+		limit = i <= num_rules ? counted_repeat_limit (i) : 0;
+		out_dec ("%d, ", limit);
+		/* format nicely, 20 numbers per line. */
+		if ((i % 20) == 19)
+			out ("\n    ");
+	}
+	footprint += (num_rules + 1) * ptype->width;
+	table_body_end ();
 }
 
 
@@ -244,7 +302,7 @@ void genctbl (void)
 
 	/* Table of verify for transition and offset to next state. */
 	out_dec ("m4_define([[M4_HOOK_TRANSTABLE_SIZE]], [[%d]])", tblend + numecs + 1);
-	outn ("m4_define([[M4_HOOK_TRANSTABLE_BODY]], [[m4_dnl");
+	table_body_begin ("M4_HOOK_TRANSTABLE_BODY");
 
 	/* We want the transition to be represented as the offset to the
 	 * next state, not the actual state number, which is what it currently
@@ -311,7 +369,7 @@ void genctbl (void)
 	transition_struct_out (chk[tblend + 1], nxt[tblend + 1]);
 	transition_struct_out (chk[tblend + 2], nxt[tblend + 2]);
 
-	outn ("]])");
+	table_body_end ();
 	footprint += sizeof(struct yy_trans_info) * (tblend + numecs + 1);
 
 	out_dec ("m4_define([[M4_HOOK_STARTTABLE_SIZE]], [[%d]])", lastsc * 2 + 1);
@@ -364,7 +422,7 @@ void genecs (void)
 	int     numrows;
 
 	out_dec ("m4_define([[M4_HOOK_ECSTABLE_SIZE]], [[%d]])", ctrl.csize);
-	outn ("m4_define([[M4_HOOK_ECSTABLE_BODY]], [[m4_dnl");
+	table_body_begin ("M4_HOOK_ECSTABLE_BODY");
 
 	for (ch = 1; ch < ctrl.csize; ++ch) {
 		ecgroup[ch] = ABS (ecgroup[ch]);
@@ -372,24 +430,24 @@ void genecs (void)
 	}
 
 	dataend (NULL);
-	outn("]])");
+	table_body_end ();
 	footprint += sizeof(YY_CHAR) * ctrl.csize;
 
 	if (env.trace) {
-		fputs (_("\n\nEquivalence Classes:\n\n"), stderr);
+		fputs (_("\n\nEquivalence Classes:\n\n"), flex_run->err);
 
 		/* Print in 8 columns */
 		numrows = ctrl.csize / 8;
 
 		for (row = 0; row < numrows; ++row) {
 			for (ch = row; ch < ctrl.csize; ch += numrows) {
-				fprintf (stderr, "%4s = %-2d",
+				fprintf (flex_run->err, "%4s = %-2d",
 					 readable_form (ch), ecgroup[ch]);
 
-				putc (' ', stderr);
+				putc (' ', flex_run->err);
 			}
 
-			putc ('\n', stderr);
+			putc ('\n', flex_run->err);
 		}
 	}
 }
@@ -422,7 +480,7 @@ struct yytbl_data *mkftbl (void)
 		tdata[i] = anum;
 
 		if (env.trace && anum)
-			fprintf (stderr, _("state # %d accepts: [%d]\n"),
+			fprintf (flex_run->err, _("state # %d accepts: [%d]\n"),
 				 i, anum);
 	}
 
@@ -443,7 +501,7 @@ void genftbl (void)
 	outn ("m4_define([[M4_HOOK_NEED_ACCEPT]], 1)");
 	out_str ("m4_define([[M4_HOOK_ACCEPT_TYPE]], [[%s]])", ptype->name);
 	out_dec ("m4_define([[M4_HOOK_ACCEPT_SIZE]], [[%d]])", lastdfa + 1);
-	outn ("m4_define([[M4_HOOK_ACCEPT_BODY]], [[m4_dnl");
+	table_body_begin ("M4_HOOK_ACCEPT_BODY");
 
 	for (i = 1; i <= lastdfa; ++i) {
 		int anum = dfaacc[i].dfaacc_state;
@@ -451,12 +509,12 @@ void genftbl (void)
 		mkdata (anum);
 
 		if (env.trace && anum)
-			fprintf (stderr, _("state # %d accepts: [%d]\n"),
+			fprintf (flex_run->err, _("state # %d accepts: [%d]\n"),
 				 i, anum);
 	}
 
 	dataend (NULL);
-	outn("]])");
+	table_body_end ();
 	footprint += (lastdfa + 1) * ptype->width;
 
 	if (ctrl.useecs)
@@ -497,7 +555,7 @@ void gentabs (void)
 		 * we compute the indices that will go into the "yy_accept"
 		 * array, and save the indices in the dfaacc array.
 		 */
-		int     EOB_accepting_list[2];
+		int     EOB_accepting_list[2], maxacc;
 
 		/* Set up accepting structures for the End Of Buffer state. */
 		EOB_accepting_list[0] = 0;
@@ -507,10 +565,15 @@ void gentabs (void)
 		    EOB_accepting_list;
 
 		sz = MAX (numas, 1) + 1;
-		ptype = optimize_pack(sz);
+
+		/* The type must also hold the largest accepting number. */
+		maxacc = variable_trailing_context_rules ?
+			2 * scanner_trailing_mask () + num_rules + 1 :
+			num_rules + 2;
+		ptype = optimize_pack(MAX (sz, maxacc));
 		out_str ("m4_define([[M4_HOOK_ACCLIST_TYPE]], [[%s]])", ptype->name);
 		out_dec ("m4_define([[M4_HOOK_ACCLIST_SIZE]], [[%d]])", sz);
-		outn ("m4_define([[M4_HOOK_ACCLIST_BODY]], [[m4_dnl");
+		table_body_begin ("M4_HOOK_ACCLIST_BODY");
 
 		yyacclist_tbl = calloc(1,sizeof(struct yytbl_data));
 		yytbl_data_init (yyacclist_tbl, YYTD_ID_ACCLIST);
@@ -529,7 +592,7 @@ void gentabs (void)
 				nacc = accsiz[i];
 
 				if (env.trace)
-					fprintf (stderr,
+					fprintf (flex_run->err,
 						 _("state # %d accepts: "),
 						 i);
 
@@ -552,19 +615,20 @@ void gentabs (void)
 						accnum |= YY_TRAILING_MASK;
 					}
 
+					accnum = scanner_accnum (accnum);
 					mkdata (accnum);
 					yyacclist_data[yyacclist_curr++] = accnum;
 
 					if (env.trace) {
-						fprintf (stderr, "[%d]",
-							 accset[k]);
+						fprintf (flex_run->err, "[%d]",
+							 scanner_accnum (accset[k]));
 
 						if (k < nacc)
 							fputs (", ",
-							       stderr);
+							       flex_run->err);
 						else
 							putc ('\n',
-							      stderr);
+							      flex_run->err);
 					}
 				}
 			}
@@ -574,7 +638,7 @@ void gentabs (void)
 		acc_array[i] = j;
 
 		dataend (NULL);
-		outn("]])");
+		table_body_end ();
 		footprint += sz * ptype->width;
 		if (tablesext) {
 			yytbl_data_compress (yyacclist_tbl);
@@ -616,12 +680,15 @@ void gentabs (void)
 		 */
 		++sz;
 
-	/* Note that this table is alternately defined if ctrl.fulltbl */
-	ptype = optimize_pack(sz);
+	/* Note that this table is alternately defined if ctrl.fulltbl.
+	 * Its entries are indices into yy_acclist with REJECT, and
+	 * accepting numbers otherwise, so its type must hold those too.
+	 */
+	ptype = optimize_pack(MAX (sz, reject ? numas + 2 : num_rules + 2));
 	outn ("m4_define([[M4_HOOK_NEED_ACCEPT]], 1)");
 	out_str ("m4_define([[M4_HOOK_ACCEPT_TYPE]], [[%s]])", ptype->name);
 	out_dec ("m4_define([[M4_HOOK_ACCEPT_SIZE]], [[%d]])", sz);
-	outn ("m4_define([[M4_HOOK_ACCEPT_BODY]], [[m4_dnl");
+	table_body_begin ("M4_HOOK_ACCEPT_BODY");
 
 	yyacc_tbl = calloc(1, sizeof (struct yytbl_data));
 	yytbl_data_init (yyacc_tbl, YYTD_ID_ACCEPT);
@@ -635,7 +702,7 @@ void gentabs (void)
 		yyacc_data[yyacc_curr++] = acc_array[i];
 
 		if (!reject && env.trace && acc_array[i])
-			fprintf (stderr, _("state # %d accepts: [%d]\n"),
+			fprintf (flex_run->err, _("state # %d accepts: [%d]\n"),
 				 i, acc_array[i]);
 	}
 
@@ -650,7 +717,7 @@ void gentabs (void)
 	}
 
 	dataend (NULL);
-	outn ("]])");
+	table_body_end ();
 	footprint += sz * ptype->width;
 
 	if (tablesext) {
@@ -692,13 +759,13 @@ void gentabs (void)
 
 		if (env.trace)
 			fputs (_("\n\nMeta-Equivalence Classes:\n"),
-			       stderr);
+			       flex_run->err);
 		out_dec ("m4_define([[M4_HOOK_MECSTABLE_SIZE]], [[%d]])", numecs+1);
-		outn ("m4_define([[M4_HOOK_MECSTABLE_BODY]], [[m4_dnl");
+		table_body_begin ("M4_HOOK_MECSTABLE_BODY");
  	
 		for (i = 1; i <= numecs; ++i) {
 			if (env.trace)
-				fprintf (stderr, "%d = %d\n",
+				fprintf (flex_run->err, "%d = %d\n",
 					 i, ABS (tecbck[i]));
 
 			mkdata (ABS (tecbck[i]));
@@ -706,7 +773,7 @@ void gentabs (void)
 		}
 
 		dataend (NULL);
-		outn ("]])");
+		table_body_end ();
 		footprint += sizeof(YY_CHAR) * (numecs + 1);
 		if (tablesext) {
 			yytbl_data_compress (yymeta_tbl);
@@ -725,7 +792,7 @@ void gentabs (void)
 	ptype = optimize_pack(sz);
 	out_str ("m4_define([[M4_HOOK_BASE_TYPE]], [[%s]])", ptype->name);
 	out_dec ("m4_define([[M4_HOOK_BASE_SIZE]], [[%d]])", sz);
-	outn ("m4_define([[M4_HOOK_BASE_BODY]], [[m4_dnl");
+	table_body_begin ("M4_HOOK_BASE_BODY");
 
 	yybase_tbl = calloc (1, sizeof (struct yytbl_data));
 	yytbl_data_init (yybase_tbl, YYTD_ID_BASE);
@@ -765,7 +832,7 @@ void gentabs (void)
 	}
 
 	dataend (NULL);
-	outn ("]])");
+	table_body_end ();
 	footprint += sz * ptype->width;
 
 	if (tablesext) {
@@ -782,7 +849,7 @@ void gentabs (void)
 	ptype = optimize_pack(total_states + 1);
 	out_str ("m4_define([[M4_HOOK_DEF_TYPE]], [[%s]])", ptype->name);
 	out_dec ("m4_define([[M4_HOOK_DEF_SIZE]], [[%d]])", total_states + 1);
-	outn ("m4_define([[M4_HOOK_DEF_BODY]], [[m4_dnl");
+	table_body_begin ("M4_HOOK_DEF_BODY");
 
 	yydef_tbl = calloc(1, sizeof (struct yytbl_data));
 	yytbl_data_init (yydef_tbl, YYTD_ID_DEF);
@@ -796,7 +863,7 @@ void gentabs (void)
 	}
 
 	dataend (NULL);
-	outn ("]])");
+	table_body_end ();
 	footprint += (total_states + 1) * ptype->width;
 
 	if (tablesext) {
@@ -815,7 +882,7 @@ void gentabs (void)
 	 */
 	out_str ("m4_define([[M4_HOOK_YYNXT_TYPE]], [[%s]])", ptype->name);
 	out_dec ("m4_define([[M4_HOOK_YYNXT_SIZE]], [[%d]])", tblend + 1);
-	outn ("m4_define([[M4_HOOK_YYNXT_BODY]], [[m4_dnl");
+	table_body_begin ("M4_HOOK_YYNXT_BODY");
 
 	yynxt_tbl = calloc (1, sizeof (struct yytbl_data));
 	yytbl_data_init (yynxt_tbl, YYTD_ID_NXT);
@@ -835,7 +902,7 @@ void gentabs (void)
 	}
 
 	dataend (NULL);
-	outn("]])");
+	table_body_end ();
 	footprint += ptype->width * (tblend + 1);
 
 	if (tablesext) {
@@ -851,7 +918,7 @@ void gentabs (void)
 	ptype = optimize_pack(tblend + 1);
 	out_str ("m4_define([[M4_HOOK_CHK_TYPE]], [[%s]])", ptype->name);
 	out_dec ("m4_define([[M4_HOOK_CHK_SIZE]], [[%d]])", tblend + 1);
-	outn ("m4_define([[M4_HOOK_CHK_BODY]], [[m4_dnl");
+	table_body_begin ("M4_HOOK_CHK_BODY");
 	
 	yychk_tbl = calloc (1, sizeof (struct yytbl_data));
 	yytbl_data_init (yychk_tbl, YYTD_ID_CHK);
@@ -868,7 +935,7 @@ void gentabs (void)
 	}
 
 	dataend (NULL);
-	outn ("]])");
+	table_body_end ();
 	footprint += ptype->width * (tblend + 1);
 
 	if (tablesext) {
@@ -998,9 +1065,16 @@ void make_tables (void)
 	if ((num_backing_up > 0 && !reject) && (ctrl.fullspd || ctrl.fulltbl))
 		visible_define ( "M4_MODE_NULTRANS_WRAP");
 
+	// Counted repeats stop the match in the scanner's loop.
+	if (num_counted_repeats > 0)
+		visible_define ( "M4_MODE_REPEAT_LIMIT");
+
 	comment("m4 controls end\n");
 	out ("\n");
 
+	if (num_counted_repeats > 0)
+		genreplimtbl ();
+
 	if (ctrl.do_yylineno) {
 
 		geneoltbl ();
@@ -1023,7 +1097,7 @@ void make_tables (void)
 		/* Begin generating yy_NUL_trans */
 		out_str ("m4_define([[M4_HOOK_NULTRANS_TYPE]], [[%s]])", (ctrl.fullspd) ? "struct yy_trans_info*" : "M4_HOOK_INT32");
 		out_dec ("m4_define([[M4_HOOK_NULTRANS_SIZE]], [[%d]])", lastdfa + 1);
-		outn ("m4_define([[M4_HOOK_NULTRANS_BODY]], [[m4_dnl");
+		table_body_begin ("M4_HOOK_NULTRANS_BODY");
 
 		yynultrans_tbl = calloc(1, sizeof (struct yytbl_data));
 		yytbl_data_init (yynultrans_tbl, YYTD_ID_NUL_TRANS);
@@ -1051,7 +1125,7 @@ void make_tables (void)
 		}
 
 		dataend (NULL);
-		outn("]])");
+		table_body_end ();
 		footprint += (lastdfa + 1) * (ctrl.fullspd ? sizeof(struct yy_trans_info *) : sizeof(int32_t));
 		if (tablesext) {
 			yytbl_data_compress (yynultrans_tbl);
@@ -1068,19 +1142,39 @@ void make_tables (void)
 
 		/* End generating yy_NUL_trans */
 	}
+}
 
-	if (ctrl.ddebug) {		/* Spit out table mapping rules to line numbers. */
-		/* Policy choice: we don't include this space
-		 * in the table metering.
-		 */
-		struct packtype_t *ptype = optimize_pack(num_rules);
-		out_str ("m4_define([[M4_HOOK_DEBUGTABLE_TYPE]], [[%s]])", ptype->name);
-		out_dec ("m4_define([[M4_HOOK_DEBUGTABLE_SIZE]], [[%d]])", num_rules);
-		outn ("m4_define([[M4_HOOK_DEBUGTABLE_BODY]], [[m4_dnl");
 
-		for (i = 1; i < num_rules; ++i)
-			mkdata (rule_linenum[i]);
-		dataend (NULL);
-		outn("]])");
-	}
+/* gendebugtbl - generate the table mapping rules to line numbers
+ *
+ * Kept out of make_tables() because the line numbers move whenever an
+ * action is edited, while the rest of the tables only depend on the
+ * rules; see cache.c.
+ */
+
+void gendebugtbl (void)
+{
+	/* Policy choice: we don't include this space
+	 * in the table metering.  The type must hold the
+	 * largest line number as well as the size.
+	 */
+	int     maxline = num_rules;
+	struct packtype_t *ptype;
+	int     i;
+
+	if (!ctrl.ddebug)
+		return;
+
+	for (i = 1; i < num_rules; ++i)
+		maxline = MAX (maxline, rule_linenum[i]);
+
+	ptype = optimize_pack(maxline);
+	out_str ("m4_define([[M4_HOOK_DEBUGTABLE_TYPE]], [[%s]])", ptype->name);
+	out_dec ("m4_define([[M4_HOOK_DEBUGTABLE_SIZE]], [[%d]])", num_rules);
+	table_body_begin ("M4_HOOK_DEBUGTABLE_BODY");
+
+	for (i = 1; i < num_rules; ++i)
+		mkdata (rule_linenum[i]);
+	dataend (NULL);
+	table_body_end ();
 }
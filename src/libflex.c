@@ -0,0 +1,319 @@
+/* libflex - generate scanners from within another program */
+
+/*  This file is part of flex. */
+
+/*  Redistribution and use in source and binary forms, with or without */
+/*  modification, are permitted provided that the following conditions */
+/*  are met: */
+
+/*  1. Redistributions of source code must retain the above copyright */
+/*     notice, this list of conditions and the following disclaimer. */
+/*  2. Redistributions in binary form must reproduce the above copyright */
+/*     notice, this list of conditions and the following disclaimer in the */
+/*     documentation and/or other materials provided with the distribution. */
+
+/*  Neither the name of the University nor the names of its contributors */
+/*  may be used to endorse or promote products derived from this software */
+/*  without specific prior written permission. */
+
+/*  THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR */
+/*  IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED */
+/*  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR */
+/*  PURPOSE. */
+
+#include "flexdef.h"
+#include <errno.h>
+#include "libflex.h"
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+/* flex_generate() runs the generator in the calling process, on a
+ * flex_run_t of its own: the caller's text is the input file, temporary
+ * files stand in for flex's output, its header and its messages, and
+ * the run returns where the program would have exited.  Nothing is
+ * forked or exec'd; the output filters, m4 included, are flex's own
+ * functions.  Once the run is over the temporary files are handed to the
+ * sinks.
+ *
+ * The generator keeps its state in globals, which each run sets up
+ * afresh and releases when it ends, so the runs of a process take turns.
+ */
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t generate_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+struct flex_generator {
+	char  **argv;		/* "flex" and the options */
+	int     argc, max_args;
+
+	const char *input_name, *input_text;
+	size_t  input_len;
+
+	flex_sink *output, *header;
+	void   *output_cookie, *header_cookie;
+	flex_messages *messages;
+	void   *messages_cookie;
+
+	char   *line;		/* the message being assembled */
+	size_t  line_len, line_max;
+};
+
+flex_generator *flex_generator_new (void)
+{
+	flex_generator *g;
+
+	if ((g = calloc (1, sizeof (*g))) == NULL)
+		return NULL;
+
+	g->max_args = 16;
+	if ((g->argv = malloc (sizeof (char *) * (size_t) g->max_args)) == NULL) {
+		free (g);
+		return NULL;
+	}
+	g->argv[g->argc++] = "flex";
+
+	return g;
+}
+
+void flex_generator_free (flex_generator *g)
+{
+	if (g == NULL)
+		return;
+
+	flex_generator_clear_options (g);
+	free (g->argv);
+	free (g->line);
+	free (g);
+}
+
+int flex_generator_add_option (flex_generator *g, const char *option)
+{
+	char   *copy;
+
+	if (g->argc + 1 >= g->max_args) {
+		char  **argv;
+
+		argv = realloc (g->argv,
+				sizeof (char *) * (size_t) (2 * g->max_args));
+		if (argv == NULL)
+			return -1;
+		g->argv = argv;
+		g->max_args *= 2;
+	}
+
+	if ((copy = strdup (option)) == NULL)
+		return -1;
+	g->argv[g->argc++] = copy;
+	return 0;
+}
+
+void flex_generator_clear_options (flex_generator *g)
+{
+	while (g->argc > 1)
+		free (g->argv[--g->argc]);
+}
+
+void flex_generator_set_input (flex_generator *g, const char *name,
+			       const char *text, size_t len)
+{
+	g->input_name = name;
+	g->input_text = text;
+	g->input_len = len;
+}
+
+void flex_generator_set_output (flex_generator *g, flex_sink *sink,
+				void *cookie)
+{
+	g->output = sink;
+	g->output_cookie = cookie;
+}
+
+void flex_generator_set_header (flex_generator *g, flex_sink *sink,
+				void *cookie)
+{
+	g->header = sink;
+	g->header_cookie = cookie;
+}
+
+void flex_generator_set_messages (flex_generator *g,
+				  flex_messages *messages, void *cookie)
+{
+	g->messages = messages;
+	g->messages_cookie = cookie;
+}
+
+/* open_text - a stream reading the caller's text, or NULL */
+
+static FILE *open_text (const char *text, size_t len)
+{
+	FILE   *f;
+
+#ifdef HAVE_FMEMOPEN
+	/* fmemopen() of no bytes fails on some systems. */
+	if (len > 0)
+		return fmemopen ((void *) text, len, "r");
+#endif
+
+	if ((f = tmpfile ()) == NULL)
+		return NULL;
+	if ((len > 0 && fwrite (text, 1, len, f) != len) ||
+	    fflush (f) != 0 || fseek (f, 0, SEEK_SET) != 0) {
+		fclose (f);
+		return NULL;
+	}
+	return f;
+}
+
+/* open_writer - a stream writing to f that can be closed on its own */
+
+static FILE *open_writer (FILE *f)
+{
+	FILE   *w;
+	int     fd;
+
+	if ((fd = dup (fileno (f))) == -1)
+		return NULL;
+	if ((w = fdopen (fd, "w")) == NULL)
+		close (fd);
+	return w;
+}
+
+/* pass_messages - hand the complete lines in data to the caller */
+
+static int pass_messages (flex_generator *g, const char *data, size_t len)
+{
+	while (len > 0) {
+		const char *nl = memchr (data, '\n', len);
+		size_t  n = nl != NULL ? (size_t) (nl - data) : len;
+
+		if (g->line_len + n + 1 > g->line_max) {
+			size_t  max = 2 * g->line_max;
+			char   *line;
+
+			if (max < g->line_len + n + 1)
+				max = g->line_len + n + 1;
+			line = realloc (g->line, max);
+			if (line == NULL)
+				return -1;
+			g->line = line;
+			g->line_max = max;
+		}
+		memcpy (g->line + g->line_len, data, n);
+		g->line_len += n;
+
+		if (nl == NULL)
+			break;
+		g->line[g->line_len] = '\0';
+		g->messages (g->messages_cookie, g->line);
+		g->line_len = 0;
+		data = nl + 1;
+		len -= n + 1;
+	}
+	return 0;
+}
+
+/* pass_file - hand what flex wrote to f to the sink, or for messages,
+ * to the callback a line at a time.  Returns 0, or an errno value.
+ */
+
+static int pass_file (flex_generator *g, FILE *f, flex_sink *sink,
+		      void *cookie)
+{
+	char    buf[65536];
+	size_t  n;
+
+	if (fflush (f) != 0 || fseek (f, 0, SEEK_SET) != 0)
+		return errno;
+
+	while ((n = fread (buf, 1, sizeof buf, f)) > 0) {
+		if (sink != NULL)
+			sink (cookie, buf, n);
+		else if (pass_messages (g, buf, n) == -1)
+			return ENOMEM;
+	}
+	if (ferror (f))
+		return EIO;
+
+	/* A last message may lack its newline. */
+	if (sink == NULL && g->line_len > 0) {
+		g->line[g->line_len] = '\0';
+		g->messages (g->messages_cookie, g->line);
+		g->line_len = 0;
+	}
+
+	return 0;
+}
+
+int flex_generate (flex_generator *g)
+{
+	struct flex_run_t run;
+	FILE   *in = NULL, *out = NULL, *header = NULL, *messages = NULL;
+	char  **args;
+	int     argc, status = -1, err = 0;
+
+	if ((args = malloc (sizeof (char *) * (size_t) (g->argc + 2))) == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy (args, g->argv, sizeof (char *) * (size_t) g->argc);
+	argc = g->argc;
+	if (g->input_name != NULL)
+		args[argc++] = (char *) g->input_name;
+	args[argc] = NULL;
+
+	memset (&run, 0, sizeof (run));
+	run.in_process = true;
+	run.in_name = g->input_name;
+	run.err = stderr;
+
+	if ((in = open_text (g->input_text, g->input_len)) == NULL ||
+	    (out = tmpfile ()) == NULL ||
+	    (run.out = open_writer (out)) == NULL ||
+	    (g->header != NULL && (header = tmpfile ()) == NULL) ||
+	    (g->messages != NULL && (messages = tmpfile ()) == NULL)) {
+		err = errno;
+		if (run.out != NULL)
+			fclose (run.out);
+		goto close_files;
+	}
+	run.in = in;
+	run.header = header;
+	if (messages != NULL)
+		run.err = messages;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_lock (&generate_lock);
+#endif
+	/* flex closes run.out when the run ends. */
+	status = flex_run_args (&run, argc, args);
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_unlock (&generate_lock);
+#endif
+
+	if (g->output != NULL)
+		err = pass_file (g, out, g->output, g->output_cookie);
+	if (err == 0 && header != NULL)
+		err = pass_file (g, header, g->header, g->header_cookie);
+	if (err == 0 && messages != NULL)
+		err = pass_file (g, messages, NULL, NULL);
+
+  close_files:
+	if (in != NULL)
+		fclose (in);
+	if (out != NULL)
+		fclose (out);
+	if (header != NULL)
+		fclose (header);
+	if (messages != NULL)
+		fclose (messages);
+	free (args);
+
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return status;
+}
@@ -0,0 +1,115 @@
+/* libflex.h - generate scanners from within another program */
+
+/*  This file is part of flex. */
+
+/*  Redistribution and use in source and binary forms, with or without */
+/*  modification, are permitted provided that the following conditions */
+/*  are met: */
+
+/*  1. Redistributions of source code must retain the above copyright */
+/*     notice, this list of conditions and the following disclaimer. */
+/*  2. Redistributions in binary form must reproduce the above copyright */
+/*     notice, this list of conditions and the following disclaimer in the */
+/*     documentation and/or other materials provided with the distribution. */
+
+/*  Neither the name of the University nor the names of its contributors */
+/*  may be used to endorse or promote products derived from this software */
+/*  without specific prior written permission. */
+
+/*  THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR */
+/*  IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED */
+/*  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR */
+/*  PURPOSE. */
+
+/* A flex_generator holds the options, input and sinks of one scanner.
+ * flex_generate() runs flex on it within the calling process, starting
+ * no other program, and hands the generated scanner, its header and
+ * flex's messages to the sinks once the run is over.  An error ends the
+ * run, never the calling process.  Each generator belongs to one thread
+ * at a time.  flex keeps its state in globals, so the runs of all the
+ * generators in a process take turns, and each run builds its tables
+ * afresh.
+ *
+ * Typical use:
+ *
+ *	flex_generator *g = flex_generator_new ();
+ *
+ *	flex_generator_add_option (g, "--header-file=scan.h");
+ *	flex_generator_set_input (g, "scan.l", text, len);
+ *	flex_generator_set_output (g, write_scanner, cookie);
+ *	flex_generator_set_header (g, write_header, cookie);
+ *	flex_generator_set_messages (g, report, cookie);
+ *	status = flex_generate (g);
+ *	flex_generator_free (g);
+ *
+ * A generator can be run again, with or without changing its input.
+ */
+
+#ifndef LIBFLEX_H
+#define LIBFLEX_H 1
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct flex_generator flex_generator;
+
+/* Receives the next len bytes of the scanner or of its header. */
+typedef void flex_sink (void *cookie, const char *data, size_t len);
+
+/* Receives one line of flex's messages, without its newline. */
+typedef void flex_messages (void *cookie, const char *line);
+
+/* Returns NULL if out of memory. */
+flex_generator *flex_generator_new (void);
+void    flex_generator_free (flex_generator *g);
+
+/* Add one command-line argument, such as "-Cf" or "--prefix=xx".  File
+ * names given by options such as -o and --header-file name the outputs
+ * in #line directives and the like; what flex writes to them goes to
+ * the sinks instead.  Returns 0, or -1 if out of memory.
+ */
+int     flex_generator_add_option (flex_generator *g, const char *option);
+
+/* Forget the options added so far. */
+void    flex_generator_clear_options (flex_generator *g);
+
+/* Scan the len bytes at text as the input file name.  The text is not
+ * copied and must stay valid while flex_generate() runs.  Without an
+ * input, flex reads an empty one.
+ */
+void    flex_generator_set_input (flex_generator *g, const char *name,
+				  const char *text, size_t len);
+
+/* Where the scanner goes.  With no sink, it is discarded. */
+void    flex_generator_set_output (flex_generator *g, flex_sink *sink,
+				   void *cookie);
+
+/* Where the header asked for by --header-file goes.  With no sink, it
+ * is written to its file as the flex program would.
+ */
+void    flex_generator_set_header (flex_generator *g, flex_sink *sink,
+				   void *cookie);
+
+/* Where flex's warnings and errors go.  With no callback, they are
+ * written to stderr.
+ */
+void    flex_generator_set_messages (flex_generator *g,
+				     flex_messages *messages, void *cookie);
+
+/* Generate the scanner.  Returns what the flex program exits with: 0 on
+ * success, 1 if the input or options were in error, 2 if one of flex's
+ * filters failed.  Returns -1 with errno set if flex could not be run
+ * at all.  The output is expanded by flex's built-in m4; an --m4 option
+ * naming another is an error.  The sinks are called once the run is
+ * over, and a call waits for any other thread's to finish.
+ */
+int     flex_generate (flex_generator *g);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBFLEX_H */
@@ -0,0 +1,700 @@
+/* m4 - built-in expander for the m4 used in flex's output */
+
+/*  This file is part of flex. */
+
+/*  Redistribution and use in source and binary forms, with or without */
+/*  modification, are permitted provided that the following conditions */
+/*  are met: */
+
+/*  1. Redistributions of source code must retain the above copyright */
+/*     notice, this list of conditions and the following disclaimer. */
+/*  2. Redistributions in binary form must reproduce the above copyright */
+/*     notice, this list of conditions and the following disclaimer in the */
+/*     documentation and/or other materials provided with the distribution. */
+
+/*  Neither the name of the University nor the names of its contributors */
+/*  may be used to endorse or promote products derived from this software */
+/*  without specific prior written permission. */
+
+/*  THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR */
+/*  IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED */
+/*  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR */
+/*  PURPOSE. */
+
+#include "flexdef.h"
+
+/* The skeletons, and the definitions flex writes ahead of them, use only
+ * a handful of m4's builtins: m4_define, m4_undefine, m4_ifdef,
+ * m4_ifelse, m4_dnl, m4_changequote and m4_changecom, plus user macros
+ * taking $0..$N, $#, $* and $@.  filter_m4() expands that subset the way
+ * GNU m4 -P does, so --m4=builtin writes the same scanner as the
+ * external m4 filter without running a separate program.  Words naming
+ * any other m4 builtin are copied through unexpanded.
+ *
+ * Input is a stack of frames: standard input at the bottom, and above it
+ * the text of each macro expansion waiting to be rescanned.  Reading
+ * runs on from one frame into the next, so a token may span the end of
+ * an expansion, just as in m4.
+ */
+
+struct m4_text {
+	char   *str;
+	size_t  len, max;
+};
+
+struct m4_input {
+	char   *str;
+	size_t  len, pos;
+	struct m4_input *prev;
+};
+
+enum m4_type {
+	M4_UNDEFINED = 0,
+	M4_USER,
+	M4_CHANGECOM,
+	M4_CHANGEQUOTE,
+	M4_DEFINE,
+	M4_DNL,
+	M4_IFDEF,
+	M4_IFELSE,
+	M4_UNDEFINE
+};
+
+/* A macro.  The table is open-addressed and entries are never removed;
+ * m4_undefine only marks them M4_UNDEFINED.
+ */
+struct m4_macro {
+	char   *name;		/* NULL in an empty slot */
+	char   *defn;		/* text of an M4_USER macro */
+	enum m4_type type;
+	uint64_t hash;
+};
+
+/* The arguments of a macro call, $0 being the macro's name. */
+struct m4_args {
+	struct m4_text text;	/* the arguments, each '\0'-terminated */
+	size_t *start;		/* offset of each argument in text */
+	int     argc, max;
+};
+
+enum m4_token { M4_EOF, M4_WORD, M4_STRING, M4_SIMPLE };
+
+#define M4_WORD_START(c) (((c) >= 'a' && (c) <= 'z') || \
+			  ((c) >= 'A' && (c) <= 'Z') || (c) == '_')
+#define M4_WORD_CHAR(c) (M4_WORD_START (c) || ((c) >= '0' && (c) <= '9'))
+#define M4_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || \
+		     (c) == '\v' || (c) == '\f' || (c) == '\r')
+
+static struct m4_input *input;
+static struct m4_text token;
+static char *lquote, *rquote, *bcomm, *ecomm;
+static FILE *m4_out;		/* where the expansion goes */
+
+static struct {
+	struct m4_macro *slots;
+	size_t  size, used;
+} macros;
+
+static const struct {
+	const char *name;
+	enum m4_type type;
+} m4_builtins[] = {
+	{"m4_changecom", M4_CHANGECOM},
+	{"m4_changequote", M4_CHANGEQUOTE},
+	{"m4_define", M4_DEFINE},
+	{"m4_dnl", M4_DNL},
+	{"m4_ifdef", M4_IFDEF},
+	{"m4_ifelse", M4_IFELSE},
+	{"m4_undefine", M4_UNDEFINE},
+};
+
+
+/* text_room - make room for n more characters in t */
+
+static void text_room (struct m4_text *t, size_t n)
+{
+	if (t->len + n <= t->max)
+		return;
+
+	t->max = t->max ? t->max * 2 : 256;
+	while (t->len + n > t->max)
+		t->max *= 2;
+	t->str = realloc (t->str, t->max);
+	if (!t->str)
+		flexfatal (_("memory allocation failed in text_room()"));
+}
+
+static void text_grow (struct m4_text *t, const char *s, size_t n)
+{
+	text_room (t, n);
+	memcpy (t->str + t->len, s, n);
+	t->len += n;
+}
+
+static void text_add (struct m4_text *t, int c)
+{
+	if (t->len == t->max)
+		text_room (t, 1);
+	t->str[t->len++] = (char) c;
+}
+
+
+/* m4_push - push the text of t, which it takes over, onto the input */
+
+static void m4_push (struct m4_text *t)
+{
+	struct m4_input *in;
+
+	if (t->len == 0) {
+		free (t->str);
+		return;
+	}
+
+	in = malloc (sizeof (struct m4_input));
+	if (!in)
+		flexfatal (_("memory allocation failed in m4_push()"));
+	in->str = t->str;
+	in->len = t->len;
+	in->pos = 0;
+	in->prev = input;
+	input = in;
+}
+
+static int m4_getc (void)
+{
+	struct m4_input *in;
+
+	while ((in = input) != NULL) {
+		if (in->pos < in->len)
+			return (unsigned char) in->str[in->pos++];
+		input = in->prev;
+		free (in->str);
+		free (in);
+	}
+	return EOF;
+}
+
+/* m4_peek - the character k places ahead in the input, without reading it */
+
+static int m4_peek (size_t k)
+{
+	struct m4_input *in;
+
+	for (in = input; in; in = in->prev) {
+		if (in->pos + k < in->len)
+			return (unsigned char) in->str[in->pos + k];
+		k -= in->len - in->pos;
+	}
+	return EOF;
+}
+
+/* m4_match - whether delim follows, its first character c just read
+ *
+ * If it does, the rest of delim is read too.
+ */
+
+static bool m4_match (int c, const char *delim)
+{
+	size_t  i;
+
+	if (c != (unsigned char) delim[0])
+		return false;
+
+	for (i = 1; delim[i]; ++i)
+		if (m4_peek (i - 1) != (unsigned char) delim[i])
+			return false;
+
+	while (--i > 0)
+		(void) m4_getc ();
+	return true;
+}
+
+
+/* m4_token - read the next token into token
+ *
+ * A quoted string's text loses its outer quotes; a comment keeps its
+ * delimiters.
+ */
+
+static enum m4_token m4_token (void)
+{
+	int     c, depth;
+
+	token.len = 0;
+	if ((c = m4_getc ()) == EOF)
+		return M4_EOF;
+
+	if (*bcomm && m4_match (c, bcomm)) {
+		text_grow (&token, bcomm, strlen (bcomm));
+		for (;;) {
+			if ((c = m4_getc ()) == EOF)
+				lerr (_("m4: end of file in comment"));
+			if (m4_match (c, ecomm))
+				break;
+			text_add (&token, c);
+		}
+		text_grow (&token, ecomm, strlen (ecomm));
+		return M4_STRING;
+	}
+
+	if (M4_WORD_START (c)) {
+		text_add (&token, c);
+		while (M4_WORD_CHAR (m4_peek (0)))
+			text_add (&token, m4_getc ());
+		text_add (&token, '\0');
+		--token.len;
+		return M4_WORD;
+	}
+
+	if (*lquote && m4_match (c, lquote)) {
+		for (depth = 1;;) {
+			if ((c = m4_getc ()) == EOF)
+				lerr (_("m4: end of file in string"));
+			if (m4_match (c, rquote)) {
+				if (--depth == 0)
+					break;
+				text_grow (&token, rquote, strlen (rquote));
+			}
+			else if (m4_match (c, lquote)) {
+				++depth;
+				text_grow (&token, lquote, strlen (lquote));
+			}
+			else
+				text_add (&token, c);
+		}
+		return M4_STRING;
+	}
+
+	text_add (&token, c);
+	return M4_SIMPLE;
+}
+
+
+static uint64_t m4_hash (const char *s)
+{
+	uint64_t h = UINT64_C (14695981039346656037);
+
+	while (*s)
+		h = (h ^ (unsigned char) *s++) * UINT64_C (1099511628211);
+	return h;
+}
+
+/* m4_lookup - the slot for name; if insert, name gets one if it has none */
+
+static struct m4_macro *m4_lookup (const char *name, bool insert)
+{
+	uint64_t hash = m4_hash (name);
+	struct m4_macro *old = macros.slots, *m;
+	size_t  old_size = macros.size, i;
+
+	if (insert && macros.used + 1 > macros.size / 2) {
+		macros.size = old_size ? old_size * 2 : 512;
+		macros.slots = calloc (macros.size, sizeof (struct m4_macro));
+		if (!macros.slots)
+			flexfatal (_("memory allocation failed in m4_lookup()"));
+		for (i = 0; i < old_size; ++i)
+			if (old[i].name) {
+				m = &macros.slots[old[i].hash & (macros.size - 1)];
+				while (m->name)
+					if (++m == macros.slots + macros.size)
+						m = macros.slots;
+				*m = old[i];
+			}
+		free (old);
+	}
+
+	if (!macros.size)
+		return NULL;
+
+	m = &macros.slots[hash & (macros.size - 1)];
+	while (m->name) {
+		if (m->hash == hash && strcmp (m->name, name) == 0)
+			return m;
+		if (++m == macros.slots + macros.size)
+			m = macros.slots;
+	}
+
+	if (!insert)
+		return NULL;
+
+	m->name = xstrdup (name);
+	m->defn = NULL;
+	m->type = M4_UNDEFINED;
+	m->hash = hash;
+	++macros.used;
+	return m;
+}
+
+
+/* m4_emit - append text to dest, or write it out if dest is NULL */
+
+static void m4_emit (struct m4_text *dest, const char *s, size_t n)
+{
+	if (dest)
+		text_grow (dest, s, n);
+	else
+		fwrite (s, 1, n, m4_out);
+}
+
+static void m4_warn (const char *msg, const char *name)
+{
+	fprintf (flex_run->err, "%s: m4: ", program_name);
+	fprintf (flex_run->err, msg, name);
+	fputc ('\n', flex_run->err);
+}
+
+/* m4_argc_bad - warn if a builtin has too few or too many arguments
+ *
+ * Returns true if it has too few, when the call expands to nothing.
+ * As in m4, a max of -1 allows any number.
+ */
+
+static bool m4_argc_bad (struct m4_args *args, int min, int max)
+{
+	const char *name = args->text.str;
+
+	if (args->argc - 1 < min) {
+		m4_warn (_("Warning: too few arguments to builtin `%s'"), name);
+		return true;
+	}
+	if (max >= 0 && args->argc - 1 > max)
+		m4_warn (_("Warning: excess arguments to builtin `%s' ignored"),
+			 name);
+	return false;
+}
+
+/* M4_ARG - argument i of a call, or "" if there are fewer */
+#define M4_ARG(a, i) ((i) < (a)->argc ? (a)->text.str + (a)->start[i] : "")
+
+static void m4_arg_start (struct m4_args *args)
+{
+	if (args->argc == args->max) {
+		args->max = args->max ? args->max * 2 : 16;
+		args->start = realloc (args->start,
+				       (size_t) args->max * sizeof (size_t));
+		if (!args->start)
+			flexfatal (_("memory allocation failed in m4_arg_start()"));
+	}
+	args->start[args->argc++] = args->text.len;
+}
+
+static void m4_expand_token (enum m4_token t, struct m4_text *dest);
+
+/* m4_collect - read the arguments of a macro call, after its '('
+ *
+ * Leading unquoted white space is dropped from each argument; macros in
+ * the arguments are expanded as they are read.
+ */
+
+static void m4_collect (struct m4_args *args)
+{
+	enum m4_token t;
+	int     c = 0, depth;
+
+	while (c != ')') {
+		m4_arg_start (args);
+
+		do
+			t = m4_token ();
+		while (t == M4_SIMPLE && M4_SPACE (token.str[0]));
+
+		for (depth = 0;; t = m4_token ()) {
+			if (t == M4_EOF)
+				lerr (_("m4: end of file in argument list"));
+			if (t != M4_SIMPLE) {
+				m4_expand_token (t, &args->text);
+				continue;
+			}
+			c = token.str[0];
+			if (depth == 0 && (c == ',' || c == ')'))
+				break;
+			if (c == '(')
+				++depth;
+			else if (c == ')')
+				--depth;
+			text_add (&args->text, c);
+		}
+		text_add (&args->text, '\0');
+	}
+}
+
+/* m4_user - expand the user macro defn with args, onto the input */
+
+static void m4_user (const char *defn, struct m4_args *args)
+{
+	struct m4_text t = { NULL, 0, 0 };
+	const char *p;
+	char    num[32];
+	int     i;
+
+	while ((p = strchr (defn, '$')) != NULL) {
+		text_grow (&t, defn, (size_t) (p - defn));
+		defn = p + 1;
+
+		if (*defn >= '0' && *defn <= '9') {
+			for (i = 0; *defn >= '0' && *defn <= '9'; ++defn)
+				i = i * 10 + (*defn - '0');
+			if (i < args->argc)
+				text_grow (&t, M4_ARG (args, i),
+					   strlen (M4_ARG (args, i)));
+		}
+		else if (*defn == '#') {
+			snprintf (num, sizeof (num), "%d", args->argc - 1);
+			text_grow (&t, num, strlen (num));
+			++defn;
+		}
+		else if (*defn == '*' || *defn == '@') {
+			for (i = 1; i < args->argc; ++i) {
+				if (i > 1)
+					text_add (&t, ',');
+				if (*defn == '@')
+					text_grow (&t, lquote, strlen (lquote));
+				text_grow (&t, M4_ARG (args, i),
+					   strlen (M4_ARG (args, i)));
+				if (*defn == '@')
+					text_grow (&t, rquote, strlen (rquote));
+			}
+			++defn;
+		}
+		else
+			text_add (&t, '$');
+	}
+	text_grow (&t, defn, strlen (defn));
+	m4_push (&t);
+}
+
+/* m4_result - push a copy of s onto the input, to be rescanned */
+
+static void m4_result (const char *s)
+{
+	struct m4_text t = { NULL, 0, 0 };
+
+	text_grow (&t, s, strlen (s));
+	m4_push (&t);
+}
+
+/* m4_set_delims - set a pair of quote or comment delimiters, as m4 does
+ *
+ * With no start, the defaults are restored.  A non-empty start always
+ * gets a non-empty end; an empty start turns the delimiters off.
+ */
+
+static void m4_set_delims (char **start, char **end, const char *s,
+			   const char *e, const char *def_s, const char *def_e)
+{
+	free (*start);
+	free (*end);
+	if (!s) {
+		s = def_s;
+		e = def_e;
+	}
+	else if (!e || (*s && !*e))
+		e = def_e;
+	*start = xstrdup (s);
+	*end = xstrdup (e);
+}
+
+/* m4_call - expand a call of macro m, whose name is in token */
+
+static void m4_call (struct m4_macro *m)
+{
+	struct m4_args args = { { NULL, 0, 0 }, NULL, 0, 0 }, *a = &args;
+	enum m4_type type = m->type;
+	char   *defn = type == M4_USER ? xstrdup (m->defn) : NULL;
+	int     i;
+
+	m4_arg_start (a);
+	text_grow (&a->text, token.str, token.len + 1);
+	if (m4_peek (0) == '(') {
+		(void) m4_getc ();
+		m4_collect (a);
+	}
+
+	switch (type) {
+	case M4_USER:
+		m4_user (defn, a);
+		free (defn);
+		break;
+
+	case M4_DEFINE:
+		if (m4_argc_bad (a, 1, 2))
+			break;
+		m = m4_lookup (M4_ARG (a, 1), true);
+		free (m->defn);
+		m->defn = xstrdup (M4_ARG (a, 2));
+		m->type = M4_USER;
+		break;
+
+	case M4_UNDEFINE:
+		if (m4_argc_bad (a, 1, -1))
+			break;
+		for (i = 1; i < a->argc; ++i)
+			if ((m = m4_lookup (M4_ARG (a, i), false)) != NULL) {
+				free (m->defn);
+				m->defn = NULL;
+				m->type = M4_UNDEFINED;
+			}
+		break;
+
+	case M4_IFDEF:
+		if (m4_argc_bad (a, 2, 3))
+			break;
+		m = m4_lookup (M4_ARG (a, 1), false);
+		if (m && m->type != M4_UNDEFINED)
+			m4_result (M4_ARG (a, 2));
+		else if (a->argc >= 4)
+			m4_result (M4_ARG (a, 3));
+		break;
+
+	case M4_IFELSE: {
+		int     argc = a->argc - 1, arg = 1;
+
+		/* One argument is a comment. */
+		if (argc == 1 || m4_argc_bad (a, 3, -1))
+			break;
+		if (argc % 3 == 2) {
+			m4_argc_bad (a, 0, argc - 1);
+			--argc;
+		}
+
+		for (;;) {
+			if (strcmp (M4_ARG (a, arg), M4_ARG (a, arg + 1)) == 0) {
+				m4_result (M4_ARG (a, arg + 2));
+				break;
+			}
+			if (argc == 3)
+				break;
+			if (argc <= 5) {
+				m4_result (M4_ARG (a, arg + 3));
+				break;
+			}
+			argc -= 3;
+			arg += 3;
+		}
+		break;
+	}
+
+	case M4_CHANGEQUOTE:
+		(void) m4_argc_bad (a, 0, 2);
+		m4_set_delims (&lquote, &rquote,
+			       a->argc >= 2 ? M4_ARG (a, 1) : NULL,
+			       a->argc >= 3 ? M4_ARG (a, 2) : NULL, "`", "'");
+		break;
+
+	case M4_CHANGECOM:
+		(void) m4_argc_bad (a, 0, 2);
+		if (a->argc == 1)
+			m4_set_delims (&bcomm, &ecomm, "", "", "#", "\n");
+		else
+			m4_set_delims (&bcomm, &ecomm, M4_ARG (a, 1),
+				       a->argc >= 3 ? M4_ARG (a, 2) : NULL,
+				       "#", "\n");
+		break;
+
+	case M4_DNL:
+		(void) m4_argc_bad (a, 0, 0);
+		while ((i = m4_getc ()) != EOF && i != '\n') ;
+		break;
+
+	case M4_UNDEFINED:
+		break;
+	}
+
+	free (a->text.str);
+	free (a->start);
+}
+
+/* m4_expand_token - expand the token just read, or copy it to dest */
+
+static void m4_expand_token (enum m4_token t, struct m4_text *dest)
+{
+	struct m4_macro *m;
+
+	if (t == M4_WORD && (m = m4_lookup (token.str, false)) != NULL &&
+	    m->type != M4_UNDEFINED) {
+		switch (m->type) {
+		case M4_DEFINE:
+		case M4_UNDEFINE:
+		case M4_IFDEF:
+		case M4_IFELSE:
+			/* These are only recognized with arguments. */
+			if (m4_peek (0) != '(')
+				break;
+			/* FALLTHROUGH */
+		default:
+			m4_call (m);
+			return;
+		}
+	}
+
+	if (dest || token.len != 1)
+		m4_emit (dest, token.str, token.len);
+	else
+		putc (token.str[0], m4_out);
+}
+
+
+/* m4_reset - forget the macros and input of an earlier expansion
+ *
+ * An in-process chain expands the scanner and its header one after the
+ * other, and each must start from m4's initial state.
+ */
+
+static void m4_reset (void)
+{
+	size_t  i;
+
+	for (i = 0; i < macros.size; ++i) {
+		free (macros.slots[i].name);
+		free (macros.slots[i].defn);
+	}
+	free (macros.slots);
+	macros.slots = NULL;
+	macros.size = macros.used = 0;
+
+	while (m4_getc () != EOF) ;
+}
+
+
+/** Expand the m4 on the filter's input onto its output, as the external
+ *  m4 -P would.
+ *  @return 0 (zero) on success; errors exit.
+ */
+int filter_m4 (struct filter *chain)
+{
+	struct m4_text in = { NULL, 0, 0 };
+	enum m4_token t;
+	size_t  i, n;
+
+	if (!chain)
+		return 0;
+
+	m4_reset ();
+	m4_out = chain->out;
+	for (i = 0; i < sizeof (m4_builtins) / sizeof (m4_builtins[0]); ++i)
+		m4_lookup (m4_builtins[i].name, true)->type =
+			m4_builtins[i].type;
+	m4_set_delims (&lquote, &rquote, NULL, NULL, "`", "'");
+	m4_set_delims (&bcomm, &ecomm, NULL, NULL, "#", "\n");
+
+	do {
+		text_room (&in, 65536);
+		n = fread (in.str + in.len, 1, in.max - in.len, chain->in);
+		in.len += n;
+	} while (n > 0);
+	m4_push (&in);
+
+	while ((t = m4_token ()) != M4_EOF)
+		m4_expand_token (t, NULL);
+
+	fflush (m4_out);
+	if (ferror (m4_out))
+		lerr (_("error writing output file %s"),
+			env.outfilename != NULL ? env.outfilename : "<stdout>");
+
+	else if (fclose (m4_out))
+		lerr (_("error closing output file %s"),
+			env.outfilename != NULL ? env.outfilename : "<stdout>");
+
+	return 0;
+}
@@ -45,10 +45,12 @@ static char flex_version[] = FLEX_VERSION;
 void flexinit(int, char **);
 void readin(void);
 void set_up_initial_allocations(void);
+static void flexcleanup(void);
 
 /* these globals are all defined and commented in flexdef.h */
 int     syntaxerror, eofseen;
 int     yymore_used, reject, real_reject, continued_action, in_rule;
+int     token_text_used, yytext_outside_action;
 int     datapos, dataline, linenum;
 FILE   *skelfile = NULL;
 int     skel_ind = 0;
@@ -59,7 +61,7 @@ char   *infilename = NULL;
 char   *extra_type = NULL;
 int     onestate[ONE_STACK_SIZE], onesym[ONE_STACK_SIZE];
 int     onenext[ONE_STACK_SIZE], onedef[ONE_STACK_SIZE], onesp;
-int     maximum_mns, current_mns, current_max_rules;
+int     current_mns, current_max_rules;
 int     num_rules, num_eof_rules, default_rule, lastnfa;
 int    *firstst, *lastst, *finalst, *transchar, *trans1, *trans2;
 int    *accptnum, *assoc_rule, *state_type;
@@ -79,19 +81,22 @@ int     current_max_template_xpairs, current_max_dfas;
 int     lastdfa, *nxt, *chk, *tnxt;
 int    *base, *def, *nultrans, NUL_ec, tblend, firstfree, **dss, *dfasiz;
 union dfaacc_union *dfaacc;
-int    *accsiz, *dhash, numas;
+int    *accsiz, numas, **dfatrans;
+uint64_t *dhash;
 int     numsnpairs, jambase, jamstate;
 int     lastccl, *cclmap, *ccllen, *cclng, cclreuse;
 int     current_maxccls, current_max_ccl_tbl_size;
 unsigned char   *ccltbl;
 char    nmstr[MAXLINE];
-int     sectnum, nummt, hshcol, dfaeql, numeps, eps2, num_reallocs, nmval;
+int     sectnum, nummt, hshcol, dfalookups, dfaeql, numeps, eps2;
+int     num_reallocs, nmval;
 int     tmpuses, totnst, peakpairs, numuniq, numdup, hshsave;
-int     num_backing_up, bol_needed;
+int     num_backing_up, num_premin_dfas, pack_saved, bol_needed;
+int     proto_index_uses, num_counted_repeats;
+int     num_cached_closures, closure_cache_words, num_uncached_closures;
 int     end_of_buffer_state;
 char  **input_files;
 int     num_input_files;
-jmp_buf flex_main_jmp_buf;
 bool   *rule_has_nl, *ccl_has_nl;
 int     nlch = '\n';
 
@@ -102,6 +107,7 @@ size_t footprint;
 
 struct ctrl_bundle_t ctrl;
 struct env_bundle_t env;
+struct flex_run_t *flex_run;
 
 /* Make sure program_name is initialized so we don't crash if writing
  * out an error message before getting the program name from argv[0].
@@ -118,6 +124,7 @@ extern FILE* yyout;
 static char outfile_path[MAXLINE];
 static int outfile_created = 0;
 static int _stdout_closed = 0; /* flag to prevent double-fclose() on stdout. */
+static int flexend_called = 0;
 const char *escaped_qstart = "]]M4_YY_NOOP[M4_YY_NOOP[M4_YY_NOOP[[";
 const char *escaped_qend   = "]]M4_YY_NOOP]M4_YY_NOOP]M4_YY_NOOP[[";
 
@@ -126,10 +133,33 @@ static int preproc_level = 1000;
 
 int flex_main (int argc, char *argv[]);
 
+/* flex_main - run flex as the program, on the process's standard streams */
+
 int flex_main (int argc, char *argv[])
+{
+	struct flex_run_t run;
+
+	memset (&run, 0, sizeof (run));
+	run.out = stdout;
+	run.err = stderr;
+
+	return flex_run_args (&run, argc, argv);
+}
+
+/* flex_run_args - generate a scanner as the options in argv say
+ *
+ * The run goes through run, which stays flex_run until it ends.  The
+ * generator's globals are set up afresh at the start of each run, so
+ * that a process can make any number of them, one at a time.
+ */
+
+int flex_run_args (struct flex_run_t *run, int argc, char *argv[])
 {
 	int     i, exit_status, child_status;
 	int	did_eof_rule = false;
+	bool	cached;
+
+	flex_run = run;
 
 	/* Set a longjmp target. Yes, I know it's a hack, but it gets worse: The
 	 * return value of setjmp, if non-zero, is the desired exit code PLUS ONE.
@@ -138,13 +168,17 @@ int flex_main (int argc, char *argv[])
 	 * specify a value of 0 to longjmp. FLEX_EXIT(n) should be used instead of
 	 * exit(n);
 	 */
-	exit_status = setjmp (flex_main_jmp_buf);
+	exit_status = setjmp (run->exit_to);
 	if (exit_status){
-		if (stdout && !_stdout_closed && !ferror(stdout)){
-			fflush(stdout);
-			fclose(stdout);
+		stats_begin (STATS_FILTERS);
+		/* A chain of internal filters runs here, unless flex failed. */
+		filter_run_spooled (exit_status == 1);
+		if (run->out && !_stdout_closed) {
+			fflush(run->out);
+			fclose(run->out);
 		}
-		while (wait(&child_status) > 0){
+		_stdout_closed = 1;
+		while (!run->in_process && wait(&child_status) > 0){
 			if (!WIFEXITED (child_status)
 			    || WEXITSTATUS (child_status) != 0){
 				/* report an error of a child
@@ -154,15 +188,32 @@ int flex_main (int argc, char *argv[])
 
 			}
 		}
+		stats_end (STATS_FILTERS);
+		stats_end (STATS_TOTAL);
+		stats_report ();
+		flexcleanup ();
+		flex_run = NULL;
 		return exit_status - 1;
 	}
 
 	flexinit (argc, argv);
+	stats_begin (STATS_TOTAL);
 
 	readin ();
 
 	skelout (true);		/* %% [1.0] DFA */
-	footprint += ntod ();
+
+	/* With --cache-dir, the DFA and tables may come from an earlier
+	 * run on the same rules.
+	 */
+	stats_begin (STATS_NTOD);
+	cached = cache_lookup ();
+	if (!cached) {
+		cache_record (CACHE_DFA);
+		footprint += ntod ();
+	}
+	cache_replay (CACHE_DFA);
+	stats_end (STATS_NTOD);
 
 	for (i = 1; i <= num_rules; ++i)
 		if (!rule_useful[i] && i != default_rule)
@@ -210,27 +261,37 @@ int flex_main (int argc, char *argv[])
 	skelout (true);		/* %% [2.0] - tables get dumped here */
 
 	/* Generate the C state transition tables from the DFA. */
-	make_tables ();
+	stats_begin (STATS_TABLES);
+	if (!cached) {
+		cache_record (CACHE_TABLES);
+		make_tables ();
+	}
+	cache_replay (CACHE_TABLES);
+	cache_store ();
+	gendebugtbl ();
+	stats_end (STATS_TABLES);
+
+	stats_begin (STATS_OUTPUT);
 
 	skelout (true);		/* %% [3.0] - mode-dependent static declarations get dumped here */
 
 	out (&action_array[defs1_offset]);
 
-	line_directive_out (stdout, NULL, linenum);
+	line_directive_out (run->out, NULL, linenum);
 
 	skelout (true);		/* %% [4.0] - various random yylex internals get dumped here */
 
 	/* Copy prolog to output file. */
 	out (&action_array[prolog_offset]);
 
-	line_directive_out (stdout, NULL, linenum);
+	line_directive_out (run->out, NULL, linenum);
 
 	skelout (true);		/* %% [5.0] - main loop of matching-engine code gets dumped here */
 
 	/* Copy actions to output file. */
 	out (&action_array[action_offset]);
 
-	line_directive_out (stdout, NULL, linenum);
+	line_directive_out (run->out, NULL, linenum);
 
 	/* generate cases for any missing EOF rules */
 	for (i = 1; i <= lastsc; ++i)
@@ -250,26 +311,35 @@ int flex_main (int argc, char *argv[])
 
 	/* Copy remainder of input to output. */
 
-	line_directive_out (stdout, infilename, linenum);
+	line_directive_out (run->out, infilename, linenum);
 
 	if (sectnum == 3) {
 		OUT_BEGIN_CODE ();
                 if (!ctrl.no_section3_escape)
-                   fputs("[[", stdout);
+                   fputs("[[", run->out);
 		(void) flexscan ();	/* copy remainder of input to output */
                 if (!ctrl.no_section3_escape)
-                   fputs("]]", stdout);
+                   fputs("]]", run->out);
 		OUT_END_CODE ();
 	}
 
+	/* Only actions get the NUL-terminated copy of the token; code in
+	 * sections 1 and 3 sees yytext pointing into the input buffer.
+	 */
+	if (ctrl.token_view && yytext_outside_action)
+		line_warning (_("yytext outside a rule action is not NUL-terminated with %option token-view; use yyview and yyleng"),
+			      yytext_outside_action);
+
 	/* Note, flexend does not return.  It exits with its argument
 	 * as status.
 	 */
+	stats_end (STATS_OUTPUT);
 	flexend (0);
 
 	return 0;		/* keep compilers/lint happy */
 }
 
+#ifndef FLEX_LIBRARY
 /* Wrapper around flex_main, so flex_main can be built as a library. */
 int main (int argc, char *argv[])
 {
@@ -284,6 +354,7 @@ int main (int argc, char *argv[])
 
 	return flex_main (argc, argv);
 }
+#endif /* !FLEX_LIBRARY */
 
 /* Set up the output filter chain. */
 
@@ -292,16 +363,34 @@ void initialize_output_filters(void)
 	const char * m4 = NULL;
 
 	output_chain = filter_create_int(NULL, filter_tee_header, env.headerfilename);
-	if ( !(m4 = getenv("M4"))) {
+	if (flex_run->in_process) {
+		/* libflex starts no processes, so only its own m4 will do. */
+		if (env.m4 != NULL && strcmp(env.m4, "builtin") != 0)
+			flexerror(_("--m4 must be builtin when flex runs in process"));
+		m4 = "builtin";
+	}
+	else if ( !(m4 = env.m4) && !(m4 = getenv("M4"))) {
 		m4 = M4;
 	}
-	filter_create_ext(output_chain, m4, "-P", (char *) 0);
+	if (strcmp(m4, "builtin") == 0)
+		filter_create_int(output_chain, filter_m4, NULL);
+	else
+		filter_create_ext(output_chain, m4, "-P", (char *) 0);
 	filter_create_int(output_chain, filter_fix_linedirs, NULL);
 
 	/* For debugging, only run the requested number of filters. */
 	if (preproc_level > 0) {
-		filter_truncate(output_chain, preproc_level);
-		filter_apply_chain(output_chain);
+		/* Table bodies can go around m4 when filter_fix_linedirs()
+		 * is there to splice them back in.  The side file must exist
+		 * before the filters are forked, so that they share it.
+		 */
+		if (filter_truncate(output_chain, preproc_level) >= 3)
+			table_bodies = tmpfile();
+		/* With the builtin m4, every filter is a function of flex's
+		 * own, and they run in this process once the output is done.
+		 */
+		if (!filter_spool_chain(output_chain))
+			filter_apply_chain(output_chain);
 	}
 }
 
@@ -376,6 +465,19 @@ void check_options (void)
 		ctrl.yytext_is_array = false;
 	}
 
+#ifndef HAVE_PTHREAD_H
+	if (env.threads > 1) {
+		lwarn (_("this flex was built without threads; -j/%option threads ignored"));
+		env.threads = 1;
+	}
+#endif
+
+	if (ctrl.mmap && !ctrl.token_view)
+		flexerror (_("%option mmap requires %option token-view"));
+
+	if (ctrl.token_view && ctrl.yytext_is_array)
+		flexerror (_("%option token-view and %array are incompatible"));
+
 	if (ctrl.C_plus_plus && (ctrl.reentrant))
 		flexerror (_("Options -+ and --reentrant are mutually exclusive."));
 
@@ -416,12 +518,17 @@ void check_options (void)
 			env.outfilename = outfile_path;
 		}
 
-		prev_stdout = freopen (env.outfilename, "w+", stdout);
+		/* Under libflex, the scanner goes to the caller, and
+		 * outfilename only names it.
+		 */
+		if (!flex_run->in_process) {
+			prev_stdout = freopen (env.outfilename, "w+", stdout);
 
-		if (prev_stdout == NULL)
-			lerr (_("could not create %s"), env.outfilename);
+			if (prev_stdout == NULL)
+				lerr (_("could not create %s"), env.outfilename);
 
-		outfile_created = 1;
+			outfile_created = 1;
+		}
 	}
 }
 
@@ -433,10 +540,9 @@ void check_options (void)
 
 void flexend (int exit_status)
 {
-	static int called_before = -1;	/* prevent infinite recursion. */
 	int     tblsiz;
 
-	if (++called_before)
+	if (flexend_called++)	/* prevent infinite recursion */
 		FLEX_EXIT (exit_status);
 
 	if (ctrl.yyclass != NULL && !ctrl.C_plus_plus)
@@ -489,49 +595,49 @@ void flexend (int exit_status)
 	}
 
 	if (env.printstats) {
-		fprintf (stderr, _("%s version %s usage statistics:\n"),
+		fprintf (flex_run->err, _("%s version %s usage statistics:\n"),
 			 program_name, flex_version);
 
-		fprintf (stderr, _("  scanner options: -"));
+		fprintf (flex_run->err, _("  scanner options: -"));
 
 		if (ctrl.C_plus_plus)
-			putc ('+', stderr);
+			putc ('+', flex_run->err);
 		if (env.backing_up_report)
-			putc ('b', stderr);
+			putc ('b', flex_run->err);
 		if (ctrl.ddebug)
-			putc ('d', stderr);
+			putc ('d', flex_run->err);
 		if (sf_case_ins())
-			putc ('i', stderr);
+			putc ('i', flex_run->err);
 		if (ctrl.lex_compat)
-			putc ('l', stderr);
+			putc ('l', flex_run->err);
 		if (ctrl.posix_compat)
-			putc ('X', stderr);
+			putc ('X', flex_run->err);
 		if (env.performance_hint > 0)
-			putc ('p', stderr);
+			putc ('p', flex_run->err);
 		if (env.performance_hint > 1)
-			putc ('p', stderr);
+			putc ('p', flex_run->err);
 		if (ctrl.spprdflt)
-			putc ('s', stderr);
+			putc ('s', flex_run->err);
 		if (ctrl.reentrant)
-			fputs ("--reentrant", stderr);
+			fputs ("--reentrant", flex_run->err);
         if (ctrl.bison_bridge_lval)
-            fputs ("--bison-bridge", stderr);
+            fputs ("--bison-bridge", flex_run->err);
         if (ctrl.bison_bridge_lloc)
-            fputs ("--bison-locations", stderr);
+            fputs ("--bison-locations", flex_run->err);
 		if (env.use_stdout)
-			putc ('t', stderr);
+			putc ('t', flex_run->err);
 		if (env.printstats)
-			putc ('v', stderr);	/* always true! */
+			putc ('v', flex_run->err);	/* always true! */
 		if (env.nowarn)
-			putc ('w', stderr);
+			putc ('w', flex_run->err);
 		if (ctrl.interactive == trit_false)
-			putc ('B', stderr);
+			putc ('B', flex_run->err);
 		if (ctrl.interactive == trit_true)
-			putc ('I', stderr);
+			putc ('I', flex_run->err);
 		if (!ctrl.gen_line_dirs)
-			putc ('L', stderr);
+			putc ('L', flex_run->err);
 		if (env.trace)
-			putc ('T', stderr);
+			putc ('T', flex_run->err);
 
 		if (ctrl.csize == trit_unspecified)
 			/* We encountered an error fairly early on, so ctrl.csize
@@ -541,117 +647,142 @@ void flexend (int exit_status)
 			ctrl.csize = 256;
 
 		if (ctrl.csize == 128)
-			putc ('7', stderr);
+			putc ('7', flex_run->err);
 		else
-			putc ('8', stderr);
+			putc ('8', flex_run->err);
 
-		fprintf (stderr, " -C");
+		fprintf (flex_run->err, " -C");
 
 		if (ctrl.long_align)
-			putc ('a', stderr);
+			putc ('a', flex_run->err);
 		if (ctrl.fulltbl)
-			putc ('f', stderr);
+			putc ('f', flex_run->err);
 		if (ctrl.fullspd)
-			putc ('F', stderr);
+			putc ('F', flex_run->err);
 		if (ctrl.useecs)
-			putc ('e', stderr);
+			putc ('e', flex_run->err);
 		if (ctrl.usemecs)
-			putc ('m', stderr);
+			putc ('m', flex_run->err);
 		if (ctrl.use_read)
-			putc ('r', stderr);
+			putc ('r', flex_run->err);
 
 		if (env.did_outfilename)
-			fprintf (stderr, " -o%s", env.outfilename);
+			fprintf (flex_run->err, " -o%s", env.outfilename);
 
 		if (env.skelname != NULL)
-			fprintf (stderr, " -S%s", env.skelname);
+			fprintf (flex_run->err, " -S%s", env.skelname);
 
 		if (strcmp (ctrl.prefix, "yy"))
-			fprintf (stderr, " -P%s", ctrl.prefix);
+			fprintf (flex_run->err, " -P%s", ctrl.prefix);
 
-		putc ('\n', stderr);
+		putc ('\n', flex_run->err);
 
-		fprintf (stderr, _("  %d/%d NFA states\n"),
+		fprintf (flex_run->err, _("  %d/%d NFA states\n"),
 			 lastnfa, current_mns);
-		fprintf (stderr, _("  %d/%d DFA states (%d words)\n"),
+		fprintf (flex_run->err, _("  %d/%d DFA states (%d words)\n"),
 			 lastdfa, current_max_dfas, totnst);
-		fprintf (stderr, _("  %d rules\n"),
+		if (env.minimize)
+			fprintf (flex_run->err,
+				 _
+				 ("  %d DFA states before minimization, %d after\n"),
+				 num_premin_dfas, lastdfa);
+		fprintf (flex_run->err, _("  %d rules\n"),
 			 num_rules + num_eof_rules -
 			 1 /* - 1 for def. rule */ );
+		if (env.counted_repeats)
+			fprintf (flex_run->err,
+				 _("  %d counted repeats built as loops\n"),
+				 num_counted_repeats);
 
 		if (num_backing_up == 0)
-			fprintf (stderr, _("  No backing up\n"));
+			fprintf (flex_run->err, _("  No backing up\n"));
 		else if (ctrl.fullspd || ctrl.fulltbl)
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("  %d backing-up (non-accepting) states\n"),
 				 num_backing_up);
 		else
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("  Compressed tables always back-up\n"));
 
 		if (bol_needed)
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _("  Beginning-of-line patterns used\n"));
 
-		fprintf (stderr, _("  %d/%d start conditions\n"), lastsc,
+		fprintf (flex_run->err, _("  %d/%d start conditions\n"), lastsc,
 			 current_max_scs);
-		fprintf (stderr,
+		symtab_stats (flex_run->err);
+		fprintf (flex_run->err,
 			 _
 			 ("  %d epsilon states, %d double epsilon states\n"),
 			 numeps, eps2);
+		fprintf (flex_run->err,
+			 _
+			 ("  %d epsilon closures cached in %d words, %d walked uncached\n"),
+			 num_cached_closures, closure_cache_words,
+			 num_uncached_closures);
 
 		if (lastccl == 0)
-			fprintf (stderr, _("  no character classes\n"));
+			fprintf (flex_run->err, _("  no character classes\n"));
 		else
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("  %d/%d character classes needed %d/%d words of storage, %d reused\n"),
 				 lastccl, current_maxccls,
 				 cclmap[lastccl] + ccllen[lastccl],
 				 current_max_ccl_tbl_size, cclreuse);
 
-		fprintf (stderr, _("  %d state/nextstate pairs created\n"),
+		fprintf (flex_run->err, _("  %d state/nextstate pairs created\n"),
 			 numsnpairs);
-		fprintf (stderr,
+		fprintf (flex_run->err,
 			 _("  %d/%d unique/duplicate transitions\n"),
 			 numuniq, numdup);
 
 		if (ctrl.fulltbl) {
 			tblsiz = lastdfa * numecs;
-			fprintf (stderr, _("  %d table entries\n"),
+			fprintf (flex_run->err, _("  %d table entries\n"),
 				 tblsiz);
 		}
 
 		else {
 			tblsiz = 2 * (lastdfa + numtemps) + 2 * tblend;
 
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _("  %d/%d base-def entries created\n"),
 				 lastdfa + numtemps, current_max_dfas);
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("  %d/%d (peak %d) nxt-chk entries created\n"),
 				 tblend, current_max_xpairs, peakpairs);
-			fprintf (stderr,
+			if (env.pack)
+				fprintf (flex_run->err,
+					 _
+					 ("  %d nxt-chk entries saved by -Cp packing (%d without it)\n"),
+					 pack_saved, tblend + pack_saved);
+			fprintf (flex_run->err,
 				 _
 				 ("  %d/%d (peak %d) template nxt-chk entries created\n"),
 				 numtemps * nummecs,
 				 current_max_template_xpairs,
 				 numtemps * numecs);
-			fprintf (stderr, _("  %d empty table entries\n"),
+			fprintf (flex_run->err, _("  %d empty table entries\n"),
 				 nummt);
-			fprintf (stderr, _("  %d protos created\n"),
+			fprintf (flex_run->err, _("  %d protos created\n"),
 				 numprots);
-			fprintf (stderr,
+			if (env.proto_index)
+				fprintf (flex_run->err,
+					 _
+					 ("  %d states built on protos found by --proto-index\n"),
+					 proto_index_uses);
+			fprintf (flex_run->err,
 				 _("  %d templates created, %d uses\n"),
 				 numtemps, tmpuses);
 		}
 
 		if (ctrl.useecs) {
 			tblsiz = tblsiz + ctrl.csize;
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("  %d/%d equivalence classes created\n"),
 				 numecs, ctrl.csize);
@@ -659,19 +790,25 @@ void flexend (int exit_status)
 
 		if (ctrl.usemecs) {
 			tblsiz = tblsiz + numecs;
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("  %d/%d meta-equivalence classes created\n"),
 				 nummecs, ctrl.csize);
 		}
 
-		fprintf (stderr,
+		fprintf (flex_run->err,
 			 _
 			 ("  %d (%d saved) hash collisions, %d DFAs equal\n"),
 			 hshcol, hshsave, dfaeql);
-		fprintf (stderr, _("  %d sets of reallocations needed\n"),
+		if (dfalookups > 0)
+			fprintf (flex_run->err,
+				 _
+				 ("  %d DFA state lookups, %.2f%% hash collisions\n"),
+				 dfalookups,
+				 100.0 * (hshcol + hshsave) / dfalookups);
+		fprintf (flex_run->err, _("  %d sets of reallocations needed\n"),
 			 num_reallocs);
-		fprintf (stderr, _("  %d total table entries needed\n"),
+		fprintf (flex_run->err, _("  %d total table entries needed\n"),
 			 tblsiz);
 	}
 
@@ -679,6 +816,59 @@ void flexend (int exit_status)
 }
 
 
+/* flexcleanup - release what a run holds once it is over, however it
+ * ended, so that the next run in the process starts from nothing
+ */
+
+static void flexcleanup (void)
+{
+	int     i;
+
+	scan_reset ();
+	ntod_cleanup ();
+	freetbl ();
+	cache_cleanup ();
+	filter_cleanup ();
+	out_reset ();
+
+	for (i = 1; i <= lastdfa; ++i) {
+		free (dss[i]);
+		/* gen.c points the end-of-buffer state's at an array of its own. */
+		if (reject && i != end_of_buffer_state)
+			free (dfaacc[i].dfaacc_set);
+	}
+	lastdfa = 0;
+
+	/* A run that failed early may not have made them, and the next
+	 * run may fail early too.
+	 */
+#define FREE_TABLE(p) do { free (p); (p) = NULL; } while (0)
+	FREE_TABLE (firstst); FREE_TABLE (lastst); FREE_TABLE (finalst);
+	FREE_TABLE (transchar); FREE_TABLE (trans1); FREE_TABLE (trans2);
+	FREE_TABLE (accptnum); FREE_TABLE (assoc_rule); FREE_TABLE (state_type);
+	FREE_TABLE (rule_type); FREE_TABLE (rule_linenum);
+	FREE_TABLE (rule_useful); FREE_TABLE (rule_has_nl);
+	FREE_TABLE (scset); FREE_TABLE (scbol); FREE_TABLE (scxclu);
+	FREE_TABLE (sceof);
+	FREE_TABLE (scname);	/* the names went with the symbol table */
+	FREE_TABLE (cclmap); FREE_TABLE (ccllen); FREE_TABLE (cclng);
+	FREE_TABLE (ccl_has_nl); FREE_TABLE (ccltbl);
+	FREE_TABLE (nxt); FREE_TABLE (chk); FREE_TABLE (tnxt);
+	FREE_TABLE (base); FREE_TABLE (def); FREE_TABLE (dfasiz);
+	FREE_TABLE (accsiz); FREE_TABLE (dhash); FREE_TABLE (dss);
+	FREE_TABLE (dfaacc); FREE_TABLE (nultrans);
+	FREE_TABLE (action_array);
+	FREE_TABLE (infilename);
+#undef FREE_TABLE
+
+	buf_destroy (&userdef_buf);
+	buf_destroy (&top_buf);
+	free ((void *) ctrl.backend_name);
+	free ((void *) ctrl.traceline_re);
+	free ((void *) ctrl.traceline_template);
+}
+
+
 /* flexinit - initialize flex */
 
 void flexinit (int argc, char **argv)
@@ -687,10 +877,24 @@ void flexinit (int argc, char **argv)
 	char   *arg;
 	scanopt_t sopt;
 
+	/* Whatever an earlier run in this process left is set back here. */
+	outfile_created = _stdout_closed = flexend_called = 0;
+	preproc_level = 1000;
+	backing_name = "lex.backup";
+	skelfile = NULL;
+	skel_ind = 0;
+	extra_type = NULL;
+	footprint = 0;
+	symtab_reset ();
+	reset_counted_repeats ();
+
 	memset(&ctrl, '\0', sizeof(ctrl));
+	memset(&env, '\0', sizeof(env));
 	syntaxerror = false;
 	yymore_used = continued_action = false;
-	in_rule = reject = false;
+	token_text_used = false;
+	yytext_outside_action = 0;
+	in_rule = reject = real_reject = false;
 	ctrl.yymore_really_used = ctrl.reject_really_used = trit_unspecified;
 
 	ctrl.do_main = trit_unspecified;
@@ -698,6 +902,7 @@ void flexinit (int argc, char **argv)
 	ctrl.do_yywrap = ctrl.gen_line_dirs = ctrl.usemecs = ctrl.useecs = true;
 	ctrl.reentrant = ctrl.bison_bridge_lval = ctrl.bison_bridge_lloc = false;
 	env.performance_hint = 0;
+	env.threads = 1;
 	ctrl.prefix = "yy";
 	ctrl.rewrite = false;
 	ctrl.yylmax = BUFSIZ;
@@ -731,7 +936,7 @@ void flexinit (int argc, char **argv)
 	sopt = scanopt_init (flexopts, argc, argv, 0);
 	if (!sopt) {
 		/* This will only happen when flexopts array is altered. */
-		fprintf (stderr,
+		fprintf (flex_run->err,
 			 _("Internal error. flexopts are malformed.\n"));
 		FLEX_EXIT (1);
 	}
@@ -740,7 +945,7 @@ void flexinit (int argc, char **argv)
 
 		if (rv < 0) {
 			/* Scanopt has already printed an option-specific error message. */
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("Try `%s --help' for more information.\n"),
 				 program_name);
@@ -765,6 +970,10 @@ void flexinit (int argc, char **argv)
                         backing_name = arg;
 			break;
 
+		    case OPT_CACHE_DIR:
+			env.cache_dir = arg;
+			break;
+
 		    case OPT_DONOTHING:
 			break;
 
@@ -798,6 +1007,10 @@ void flexinit (int argc, char **argv)
 					ctrl.usemecs = true;
 					break;
 
+				    case 'p':
+					env.pack = true;
+					break;
+
 				    case 'r':
 					ctrl.use_read = true;
 					break;
@@ -840,6 +1053,10 @@ void flexinit (int argc, char **argv)
 			sf_set_case_ins(true);
 			break;
 
+		    case OPT_LARGE_INPUT:
+			ctrl.large_input = true;
+			break;
+
 		    case OPT_LEX_COMPAT:
 			ctrl.lex_compat = true;
 			break;
@@ -852,6 +1069,10 @@ void flexinit (int argc, char **argv)
 			preproc_level = (int) strtol(arg,NULL,0);
 			break;
 
+		    case OPT_M4:
+			env.m4 = arg;
+			break;
+
 		    case OPT_MAIN:
 			ctrl.do_yywrap = false;
 			ctrl.do_main = trit_true;
@@ -861,6 +1082,14 @@ void flexinit (int argc, char **argv)
 			ctrl.do_main = trit_false;
 			break;
 
+		    case OPT_MMAP:
+			/* The mapping is read-only, so yytext can't be
+			 * NUL-terminated in place.
+			 */
+			ctrl.mmap = true;
+			ctrl.token_view = true;
+			break;
+
 		    case OPT_NO_LINE:
 			ctrl.gen_line_dirs = false;
 			break;
@@ -870,6 +1099,10 @@ void flexinit (int argc, char **argv)
 			env.did_outfilename = 1;
 			break;
 
+		    case OPT_PREFETCH:
+			ctrl.prefetch = true;
+			break;
+
 		    case OPT_PREFIX:
 			ctrl.prefix = arg;
 			break;
@@ -923,6 +1156,10 @@ void flexinit (int argc, char **argv)
 			tablesverify = true;
 			break;
 
+		    case OPT_TOKEN_VIEW:
+			ctrl.token_view = true;
+			break;
+
 		    case OPT_TRACE:
 			env.trace = true;
 			break;
@@ -932,7 +1169,8 @@ void flexinit (int argc, char **argv)
 			break;
 
 		    case OPT_VERSION:
-			printf ("%s %s\n", (ctrl.C_plus_plus ? "flex++" : "flex"), flex_version);
+			fprintf (flex_run->out, "%s %s\n",
+				 (ctrl.C_plus_plus ? "flex++" : "flex"), flex_version);
 			FLEX_EXIT (0);
 
 		    case OPT_WARN:
@@ -995,6 +1233,61 @@ void flexinit (int argc, char **argv)
 			ctrl.usemecs = true;
 			break;
 
+		    case OPT_COUNTED_REPEATS:
+			env.counted_repeats = true;
+			break;
+
+		    case OPT_NO_COUNTED_REPEATS:
+			env.counted_repeats = false;
+			break;
+
+		    case OPT_MINIMIZE:
+			env.minimize = true;
+			break;
+
+		    case OPT_NO_MINIMIZE:
+			env.minimize = false;
+			break;
+
+		    case OPT_PACK:
+			env.pack = true;
+			break;
+
+		    case OPT_NO_PACK:
+			env.pack = false;
+			break;
+
+		    case OPT_PROTO_INDEX:
+			env.proto_index = true;
+			break;
+
+		    case OPT_NO_PROTO_INDEX:
+			env.proto_index = false;
+			break;
+
+		    case OPT_TUNE_TABLES:
+			env.tune_tables = true;
+			break;
+
+		    case OPT_NO_TUNE_TABLES:
+			env.tune_tables = false;
+			break;
+
+		    case OPT_STATS:
+			if (strcmp (arg, "timing") == 0)
+				env.stats = STATS_REPORT_TIMING;
+			else if (strcmp (arg, "json") == 0)
+				env.stats = STATS_REPORT_JSON;
+			else
+				lerr (_("unknown --stats format %s"), arg);
+			break;
+
+		    case OPT_THREADS:
+			env.threads = (int) strtol (arg, NULL, 0);
+			if (env.threads < 1)
+				flexerror (_("number of threads must be positive"));
+			break;
+
 		    case OPT_NO_META_ECS:
 			ctrl.usemecs = false;
 			break;
@@ -1166,9 +1459,11 @@ void flexinit (int argc, char **argv)
 	num_rules = num_eof_rules = default_rule = 0;
 	numas = numsnpairs = tmpuses = 0;
 	numecs = numeps = eps2 = num_reallocs = hshcol = dfaeql = totnst =
-	    0;
+	    dfalookups = cclreuse = 0;
 	numuniq = numdup = hshsave = eofseen = datapos = dataline = 0;
-	num_backing_up = onesp = numprots = 0;
+	num_backing_up = num_premin_dfas = pack_saved = onesp = numprots = 0;
+	proto_index_uses = num_counted_repeats = 0;
+	num_cached_closures = closure_cache_words = num_uncached_closures = 0;
 	variable_trailing_context_rules = bol_needed = false;
 
 	linenum = sectnum = 1;
@@ -1191,10 +1486,12 @@ void readin (void)
 
 	line_directive_out(NULL, infilename, linenum);
 
+	stats_begin (STATS_PARSE);
 	if (yyparse ()) {
 		pinpoint_message (_("fatal parse error"));
 		flexend (1);
 	}
+	stats_end (STATS_PARSE);
 
 	if (syntaxerror)
 		flexend (1);
@@ -1207,9 +1504,23 @@ void readin (void)
 	 */
 	backend_by_name(ctrl.emit);
 
+	if (ctrl.mmap && (ctrl.C_plus_plus ||
+			  skel_property("M4_PROPERTY_MMAP") == NULL))
+		flexerror (_("%option mmap is only supported by C scanners"));
+
+	if (ctrl.prefetch && (ctrl.C_plus_plus ||
+			      skel_property("M4_PROPERTY_PREFETCH") == NULL))
+		flexerror (_("%option prefetch is only supported by C scanners"));
+
+	if (ctrl.token_view && skel_property("M4_PROPERTY_TOKEN_VIEW") == NULL)
+		flexerror (_("%option token-view is not supported by this back end"));
+
+	if (ctrl.large_input && skel_property("M4_PROPERTY_LARGE_INPUT") == NULL)
+		flexerror (_("%option large-input is not supported by this back end"));
+
 	initialize_output_filters();
 
-	yyout = stdout;
+	yyout = flex_run->out;
 
 	if (tablesext)
 		gentables = false;
@@ -1254,7 +1565,7 @@ void readin (void)
 		flexerror(_("Prefix cannot include '[' or ']'"));
 
 	if (env.did_outfilename)
-		line_directive_out (stdout, NULL, linenum);
+		line_directive_out (flex_run->out, NULL, linenum);
 
 	/* This is where we begin writing to the file. */
 
@@ -1338,43 +1649,46 @@ void readin (void)
 
 	if (env.performance_hint > 0) {
 		if (ctrl.lex_compat) {
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("-l AT&T lex compatibility option entails a large performance penalty\n"));
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 (" and may be the actual source of other reported performance penalties\n"));
 		}
 
 		else if (ctrl.do_yylineno) {
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("%%option yylineno entails a performance penalty ONLY on rules that can match newline characters\n"));
 		}
 
 		if (env.performance_hint > 1) {
 			if (ctrl.interactive == trit_true)
-				fprintf (stderr,
+				fprintf (flex_run->err,
 					 _
 					 ("-I (interactive) entails a minor performance penalty\n"));
 
 			if (yymore_used)
-				fprintf (stderr,
+				fprintf (flex_run->err,
 					 _
 					 ("yymore() entails a minor performance penalty\n"));
 		}
 
 		if (reject)
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("REJECT entails a large performance penalty\n"));
 
 		if (variable_trailing_context_rules)
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("Variable trailing context rules entail a large performance penalty\n"));
 	}
 
+	if (env.counted_repeats)
+		finish_counted_repeats ();
+
 	if (reject)
 		real_reject = true;
 
@@ -1393,6 +1707,7 @@ void readin (void)
 				   ("variable trailing context rules cannot be used with -f or -F"));
 	}
 
+	stats_begin (STATS_ECS);
 	if (ctrl.useecs)
 		numecs = cre8ecs (nextecm, ecgroup, ctrl.csize);
 	else
@@ -1404,6 +1719,7 @@ void readin (void)
 
 	if (ctrl.useecs)
 		ccl2ecl ();
+	stats_end (STATS_ECS);
 
 	// These are used to conditionalize code in the lex skeleton
 	// that historically used to be generated by C code in flex
@@ -1491,7 +1807,15 @@ void readin (void)
 
 	// mode switches for next-action code
 	if (variable_trailing_context_rules) {
+		char mask[24];
+
 		visible_define ( "M4_MODE_VARIABLE_TRAILING_CONTEXT_RULES");
+		snprintf (mask, sizeof (mask), "0x%x",
+			  (unsigned int) scanner_trailing_mask ());
+		visible_define_str ( "M4_MODE_TRAILING_MASK", mask);
+		snprintf (mask, sizeof (mask), "0x%x",
+			  (unsigned int) scanner_trailing_mask () << 1);
+		visible_define_str ( "M4_MODE_TRAILING_HEAD_MASK", mask);
 	} else {
 		visible_define ( "M4_MODE_NO_VARIABLE_TRAILING_CONTEXT_RULES");
 	}
@@ -1604,7 +1928,8 @@ void readin (void)
 		visible_define("M4_YY_NO_TOP_STATE");
 	if (ctrl.no_yyunput)
 		visible_define("M4_YY_NO_YYUNPUT");
-	if (ctrl.no_yy_scan_buffer)
+	/* yy_scan_file_mmap() sets up its buffer with yy_scan_buffer(). */
+	if (ctrl.no_yy_scan_buffer && !ctrl.mmap)
 		visible_define("M4_YY_NO_SCAN_BUFFER");
 	if (ctrl.no_yy_scan_bytes)
 		visible_define("M4_YY_NO_SCAN_BYTES");
@@ -1662,6 +1987,16 @@ void readin (void)
 		visible_define("M4_YY_NEVER_INTERACTIVE");
 	if (ctrl.stack_used)
 		visible_define("M4_YY_STACK_USED");
+	if (ctrl.mmap)
+		visible_define("M4_YY_MMAP");
+	if (ctrl.prefetch)
+		visible_define("M4_YY_PREFETCH");
+	if (ctrl.token_view)
+		visible_define("M4_YY_TOKEN_VIEW");
+	if (token_text_used)
+		visible_define("M4_MODE_TOKEN_TEXT_USED");
+	if (ctrl.large_input)
+		visible_define("M4_YY_LARGE_INPUT");
 
 	if (ctrl.rewrite)
 		visible_define ( "M4_MODE_REWRITE");
@@ -1676,7 +2011,6 @@ void readin (void)
 
 void set_up_initial_allocations (void)
 {
-	maximum_mns = (ctrl.long_align ? MAXIMUM_MNS_LONG : MAXIMUM_MNS);
 	current_mns = INITIAL_MNS;
 	firstst = allocate_integer_array (current_mns);
 	lastst = allocate_integer_array (current_mns);
@@ -1724,7 +2058,7 @@ void set_up_initial_allocations (void)
 	def = allocate_integer_array (current_max_dfas);
 	dfasiz = allocate_integer_array (current_max_dfas);
 	accsiz = allocate_integer_array (current_max_dfas);
-	dhash = allocate_integer_array (current_max_dfas);
+	dhash = allocate_hash_array (current_max_dfas);
 	dss = allocate_int_ptr_array (current_max_dfas);
 	dfaacc = allocate_dfaacc_union (current_max_dfas);
 
@@ -1734,7 +2068,7 @@ void set_up_initial_allocations (void)
 
 void usage (void)
 {
-	FILE   *f = stdout;
+	FILE   *f = flex_run->out;
 
 	if (!env.did_outfilename) {
 		snprintf (outfile_path, sizeof(outfile_path), outfile_template,
@@ -1752,10 +2086,19 @@ void usage (void)
 		  "  -Cf               do not compress tables; use -f representation\n"
 		  "  -CF               do not compress tables; use -F representation\n"
 		  "  -Cm, --meta-ecs   construct meta-equivalence classes\n"
+		  "  -Cp, --pack       pack the tables, largest states first\n"
 		  "  -Cr, --read       use read() instead of stdio for scanner input\n"
 		  "  -f, --full        generate fast, large scanner. Same as -Cfr\n"
 		  "  -F, --fast        use alternate table representation. Same as -CFr\n"
 		  "  -Cem              default compression (same as --ecs --meta-ecs)\n"
+		  "      --minimize    merge equivalent DFA states before compressing\n"
+		  "      --proto-index search all protos for the closest to each state\n"
+		  "      --tune-tables report the table sizes from several compression\n"
+		  "                    settings and use the smallest\n"
+		  "      --counted-repeats\n"
+		  "                    build large x{n,m} as loops, checking the\n"
+		  "                    length of the match at run time\n"
+		  "  -j, --threads=NUM build the DFA using NUM threads\n"
 		  "\n" "Debugging:\n"
 		  "  -d, --debug             enable debug mode in scanner\n"
 		  "  -b, --backup            write backing-up information to %s\n"
@@ -1764,6 +2107,8 @@ void usage (void)
 		  "  -T, --env.trace             %s should run in env.trace mode\n"
 		  "  -w, --nowarn            do not generate warnings\n"
 		  "  -v, --verbose           write summary of scanner statistics to stdout\n"
+		  "      --stats=FORMAT      write the time and memory each phase takes\n"
+		  "                          to stderr; FORMAT is timing or json\n"
 		  "      --hex               use hexadecimal numbers instead of octal in debug outputs\n"
 		  "\n" "Files:\n"
 		  "  -o, --outfile=FILE      specify output filename\n"
@@ -1772,7 +2117,9 @@ void usage (void)
 		  "      --yyclass=NAME      name of C++ class\n"
 		  "      --header-file=FILE   create a C header file in addition to the scanner\n"
 		  "      --tables-file[=FILE] write tables to FILE\n"
-		  "      --backup-file=FILE  write backing-up information to FILE\n" "\n"
+		  "      --backup-file=FILE  write backing-up information to FILE\n"
+		  "      --cache-dir=DIR     keep the tables in DIR, and reuse them\n"
+		  "                          while the rules stay the same\n" "\n"
 		  "Scanner behavior:\n"
 		  "  -7, --7bit              generate 7-bit scanner\n"
 		  "  -8, --8bit              generate 8-bit scanner\n"
@@ -1792,11 +2139,17 @@ void usage (void)
 		  "       --bison-bridge      scanner for Bison pure parser.\n"
 		  "       --bison-locations   include yylloc support.\n"
 		  "       --stdinit           initialize yyin/yyout to stdin/stdout\n"
+		  "       --mmap              generate yy_scan_file_mmap() to scan files in place\n"
+		  "       --prefetch          generate yy_create_buffer_prefetch() to read ahead\n"
+		  "       --token-view        scan without writing into the input buffer\n"
+		  "       --large-input       allow buffers and tokens of 2GB and more\n"
 		  "       --nounistd          do not include <unistd.h>\n"
 		  "       --noFUNCTION        do not generate a particular FUNCTION\n"
 		  "\n" "Miscellaneous:\n"
 		  "  -c                      do-nothing POSIX option\n"
 		  "  -n                      do-nothing POSIX option\n"
+		  "      --m4=PROGRAM        expand the output with PROGRAM, or with\n"
+		  "                          flex's own m4 if PROGRAM is \"builtin\"\n"
 		  "  -?\n"
 		  "  -h, --help              produce this help message\n"
 		  "  -V, --version           report %s version\n"),
@@ -219,7 +219,7 @@ void dataflush (void)
 
 void flexerror (const char *msg)
 {
-	fprintf (stderr, "%s: %s\n", program_name, msg);
+	fprintf (flex_run->err, "%s: %s\n", program_name, msg);
 	flexend (1);
 }
 
@@ -228,7 +228,7 @@ void flexerror (const char *msg)
 
 void flexfatal (const char *msg)
 {
-	fprintf (stderr, _("%s: fatal internal error, %s\n"),
+	fprintf (flex_run->err, _("%s: fatal internal error, %s\n"),
 		 program_name, msg);
 	FLEX_EXIT (1);
 }
@@ -307,6 +307,31 @@ void line_directive_out (FILE *output_file, char *path, int linenum)
 }
 
 
+/* lowest_bit - number of the lowest set bit of a non-zero word
+ *
+ * flexdef.h uses the compiler's builtin instead where there is one.
+ */
+
+#ifndef lowest_bit
+int lowest_bit (uint64_t word)
+{
+	int     bit = 0;
+
+	while ((word & 0xff) == 0) {
+		word >>= 8;
+		bit += 8;
+	}
+
+	while ((word & 1) == 0) {
+		word >>= 1;
+		++bit;
+	}
+
+	return bit;
+}
+#endif
+
+
 /* mark_defs1 - mark the current position in the action array as
  *               representing where the user's section 1 definitions end
  *		 and the prolog begins
@@ -476,47 +501,116 @@ unsigned char myesc (unsigned char array[])
 
 /* out - various flavors of outputing a (possibly formatted) string for the
  *	 generated scanner, keeping track of the line count.
+ *
+ * Between table_body_begin() and table_body_end() the output may go to
+ * the table_bodies side file instead of flex's output.  out_redirect() sends the
+ * rest of it elsewhere as well.
  */
 
+static FILE *text_out = NULL;	/* where the output goes, if not flex's */
+static FILE *body_out = NULL;	/* table_bodies while a body is open */
+static off_t body_start;	/* where the open body starts in it */
+
+#define OUT_FILE (body_out != NULL ? body_out : \
+		  text_out != NULL ? text_out : flex_run->out)
+
+/* out_redirect - send the output to fp, or back to flex's if fp is NULL */
+
+void out_redirect (FILE *fp)
+{
+	text_out = fp;
+}
+
+/* out_reset - forget any redirection or open body, once a run is over */
+
+void out_reset (void)
+{
+	text_out = body_out = NULL;
+}
+
 void out (const char *str)
 {
-	fputs (str, stdout);
+	fputs (str, OUT_FILE);
 }
 
 void out_dec (const char *fmt, int n)
 {
-	fprintf (stdout, fmt, n);
+	fprintf (OUT_FILE, fmt, n);
 }
 
 void out_dec2 (const char *fmt, int n1, int n2)
 {
-	fprintf (stdout, fmt, n1, n2);
+	fprintf (OUT_FILE, fmt, n1, n2);
 }
 
 void out_hex (const char *fmt, unsigned int x)
 {
-	fprintf (stdout, fmt, x);
+	fprintf (OUT_FILE, fmt, x);
 }
 
 void out_str (const char *fmt, const char str[])
 {
-	fprintf (stdout,fmt, str);
+	fprintf (OUT_FILE, fmt, str);
 }
 
 void out_str_dec (const char *fmt, const char str[], int n)
 {
-	fprintf (stdout,fmt, str, n);
+	fprintf (OUT_FILE, fmt, str, n);
 }
 
 void outc (int c)
 {
-	fputc (c, stdout);
+	fputc (c, OUT_FILE);
 }
 
 void outn (const char *str)
 {
-	fputs (str,stdout);
-    fputc('\n',stdout);
+	fputs (str, OUT_FILE);
+	fputc ('\n', OUT_FILE);
+}
+
+/* table_body_begin - open the m4 definition of a table body
+ *
+ * A body is nothing but numbers and the M4_HOOK_TABLE_* punctuation, yet
+ * m4 scans every byte of it, which dominates generation time for big
+ * tables.  When the table_bodies side file is open, the body is written
+ * there instead and the definition holds only a marker giving its place
+ * in the file, followed by the expanded punctuation hooks.  The skeleton
+ * still decides where the body lands; filter_fix_linedirs() replaces the
+ * expanded marker with the body itself.
+ */
+
+void table_body_begin (const char *name)
+{
+	out_str ("m4_define([[%s]], [[m4_dnl\n", name);
+
+	if (table_bodies != NULL) {
+		body_start = ftello (table_bodies);
+		body_out = table_bodies;
+	}
+}
+
+/* table_body_end - close the definition opened by table_body_begin() */
+
+void table_body_end (void)
+{
+	if (body_out != NULL) {
+		off_t   body_end;
+
+		/* The filter reads the body as soon as it sees the marker. */
+		if (fflush (body_out) != 0 || ferror (body_out))
+			flexerror (_("error writing table bodies"));
+
+		body_end = ftello (body_out);
+		body_out = NULL;
+		fprintf (OUT_FILE, TABLE_BODY_MARKER "%lld %lld@@"
+			 "M4_HOOK_TABLE_OPENER@@M4_HOOK_TABLE_CONTINUE@@"
+			 "M4_HOOK_TABLE_CLOSER@@",
+			 (long long) body_start,
+			 (long long) (body_end - body_start));
+	}
+
+	outn ("]])");
 }
 
 /** Print "m4_define( [[def]], [[val]])m4_dnl\n".
@@ -526,7 +620,7 @@ void outn (const char *str)
 void out_m4_define (const char* def, const char* val)
 {
     const char * fmt = "m4_define( [[%s]], [[%s]])m4_dnl\n";
-    fprintf(stdout, fmt, def, val?val:"");
+    fprintf(OUT_FILE, fmt, def, val?val:"");
 }
 
 
@@ -579,12 +673,26 @@ char   *readable_form (int c)
 /* reallocate_array - increase the size of a dynamic array */
 
 void   *reallocate_array (void *array, int size, size_t element_size)
+{
+	void *new_array = try_reallocate_array (array, size, element_size);
+
+	if (!new_array)
+		flexfatal (_("attempt to increase array size failed"));
+	return new_array;
+}
+
+
+/* try_reallocate_array - reallocate_array(), but return NULL, leaving the
+ * array as it was, if it can't be grown
+ */
+
+void   *try_reallocate_array (void *array, int size, size_t element_size)
 {
 	void *new_array;
 #if HAVE_REALLOCARR
 	new_array = array;
 	if (reallocarr(&new_array, (size_t) size, element_size))
-		flexfatal (_("attempt to increase array size failed"));
+		return NULL;
 #else
 # if HAVE_REALLOCARRAY
 	new_array = reallocarray(array, (size_t) size, element_size);
@@ -594,8 +702,6 @@ void   *reallocate_array (void *array, int size, size_t element_size)
 	new_array = (size && SIZE_MAX / (size_t) size < element_size) ? NULL :
 		realloc(array, num_bytes);
 # endif
-	if (!new_array)
-		flexfatal (_("attempt to increase array size failed"));
 #endif
 	return new_array;
 }
@@ -614,7 +720,13 @@ void transition_struct_out (int element_v, int element_n)
 	if (!gentables)
 		return;
 
-	out_dec2 ("M4_HOOK_TABLE_OPENER[[%4d]],[[%4d]]M4_HOOK_TABLE_CONTINUE", element_v, element_n);
+	/* The quotes keep m4 from taking the hooks and numbers for one
+	 * word; a body that bypasses m4 needs none.
+	 */
+	if (body_out != NULL)
+		out_dec2 ("M4_HOOK_TABLE_OPENER%4d,%4dM4_HOOK_TABLE_CONTINUE", element_v, element_n);
+	else
+		out_dec2 ("M4_HOOK_TABLE_OPENER[[%4d]],[[%4d]]M4_HOOK_TABLE_CONTINUE", element_v, element_n);
 	outc ('\n');
 
 	datapos += TRANS_STRUCT_PRINT_LENGTH;
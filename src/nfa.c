@@ -32,12 +32,287 @@
 /*  PURPOSE. */
 
 #include "flexdef.h"
+#include "tables.h"
 
 
 /* declare functions that have forward references */
 
 int	dupmachine(int);
 void	mkxtion(int, int);
+static int mkrep_copies(int, int, int);
+
+
+/* With --counted-repeats, a large x{n,m} whose x is a single character or
+ * character class is built as x{n,} between two epsilon states.  The
+ * scanner's match loop stops once the rule accepts at the longest length
+ * m allows, and the rule's action cuts back a match that ran on anyway,
+ * as one resumed after a NUL may.  That only matches the same text when
+ * the repeat ends the rule, nothing but single characters and classes
+ * come before it, and no other rule can match anything that starts with
+ * a run of those characters that long, so each loop is remembered here
+ * until that is known.  A loop that fails any of those tests is given
+ * its copies of x after all.
+ */
+
+struct counted_rep {
+	int     entry, exit;	/* epsilon states around the loop */
+	int     sym;		/* transition symbol of x */
+	int     lb, ub;		/* n and m */
+	int     rule;		/* rule the loop belongs to */
+	int     type;		/* state type of the loop's states */
+	int     limit;		/* length the action cuts back to, or 0 */
+	int     prefix;		/* first of the rule's leading symbols */
+};
+
+static struct counted_rep *counted_reps;
+static int num_reps, max_reps, first_rule_rep;
+static int *rep_syms;		/* leading symbols of the looping rules */
+static int num_rep_syms, max_rep_syms;
+
+
+/* add_counted_rep - remember a loop built for x{lb,ub} */
+
+static void add_counted_rep (int entry, int final, int sym, int lb, int ub,
+			     int rule, int type)
+{
+	struct counted_rep *rep;
+
+	if (num_reps >= max_reps) {
+		max_reps += MAX (MAX_RULES_INCREMENT, max_reps / 2);
+		counted_reps = reallocate_array (counted_reps, max_reps,
+						 sizeof (struct counted_rep));
+	}
+
+	rep = &counted_reps[num_reps++];
+	rep->entry = entry;
+	rep->exit = final;
+	rep->sym = sym;
+	rep->lb = lb;
+	rep->ub = ub;
+	rep->rule = rule;
+	rep->type = type;
+	rep->limit = 0;
+	rep->prefix = 0;
+}
+
+
+/* expand_counted_rep - give a loop its copies of x after all
+ *
+ * The copies go at the end of the nfa and are spliced in between the
+ * loop's epsilon states, leaving the loop itself unreachable.
+ */
+
+static void expand_counted_rep (struct counted_rep *rep)
+{
+	int     first = lastnfa + 1, saved_type = current_state_type;
+	int     copies, i;
+
+	current_state_type = rep->type;
+	copies = mkrep_copies (mkstate (rep->sym), rep->lb, rep->ub);
+	current_state_type = saved_type;
+
+	trans1[rep->entry] = copies;
+	mkxtion (finalst[copies], rep->exit);
+
+	for (i = first; i <= lastnfa; ++i)
+		assoc_rule[i] = rep->rule;
+
+	rep->entry = NIL;
+	rep->limit = 0;
+}
+
+
+/* rep_chars - mark the characters a transition on sym can be taken on */
+
+static void rep_chars (int sym, bool chars[])
+{
+	int     ch;
+
+	for (ch = 0; ch < ctrl.csize; ++ch)
+		chars[ch] = sym < 0 ? ccl_contains (-sym, ch) : ch == sym;
+}
+
+
+/* rep_meets - whether a transition on sym can be taken on one of chars
+ *
+ * The answers for character classes are kept in meets[], where -1 means
+ * not worked out yet.
+ */
+
+static bool rep_meets (int sym, const bool chars[], signed char meets[])
+{
+	int     ch;
+
+	if (sym >= 0)
+		return chars[sym];
+
+	if (meets[-sym] < 0) {
+		meets[-sym] = 0;
+
+		for (ch = 0; ch < ctrl.csize; ++ch)
+			if (chars[ch] && ccl_contains (-sym, ch)) {
+				meets[-sym] = 1;
+				break;
+			}
+	}
+
+	return meets[-sym] != 0;
+}
+
+
+/* rep_closure - add the epsilon closure of set[0 .. n-1] to set
+ *
+ * States in the set have mark[] equal to gen.  Returns the new size.
+ */
+
+static int rep_closure (int set[], int n, int mark[], int gen)
+{
+	int     i, ns, t;
+
+	for (i = 0; i < n; ++i) {
+		ns = set[i];
+
+		if (transchar[ns] != SYM_EPSILON)
+			continue;
+
+		if ((t = trans1[ns]) != NO_TRANSITION && mark[t] != gen) {
+			mark[t] = gen;
+			set[n++] = t;
+		}
+
+		if ((t = trans2[ns]) != NO_TRANSITION && mark[t] != gen) {
+			mark[t] = gen;
+			set[n++] = t;
+		}
+	}
+
+	return n;
+}
+
+
+/* rep_conflicts - whether another rule can outrun rep's bound
+ *
+ * Runs the nfa over every input that starts with the rule's leading
+ * symbols and goes on with x, without following the rule's own states.
+ * If some other rule accepts an input of rep->limit characters or more
+ * that starts that way, whatever comes after, stopping the rule's match
+ * at rep->limit would keep it from winning, and the loop has to go.
+ */
+
+static bool rep_conflicts (const struct counted_rep *rep)
+{
+	int    *cur, *nxt, *tmp, *mark[2], gen[2] = { 0, 0 };
+	int     ncur, nnxt, pos, plen, i, j, ns, sym, t, out[2];
+	bool   *chars;
+	signed char *meets;
+	bool    conflict = false, same;
+
+	cur = allocate_integer_array (lastnfa + 1);
+	nxt = allocate_integer_array (lastnfa + 1);
+	mark[0] = allocate_integer_array (lastnfa + 1);
+	mark[1] = allocate_integer_array (lastnfa + 1);
+	chars = allocate_bool_array (ctrl.csize);
+	meets = allocate_array (lastccl + 1, sizeof (signed char));
+
+	for (i = 0; i <= lastnfa; ++i)
+		mark[0][i] = mark[1][i] = 0;
+
+	/* The starting states of every start condition. */
+	++gen[0];
+	ncur = 0;
+	for (i = 1; i <= lastsc; ++i) {
+		if (mark[0][scset[i]] != gen[0]) {
+			mark[0][scset[i]] = gen[0];
+			cur[ncur++] = scset[i];
+		}
+		if (mark[0][scbol[i]] != gen[0]) {
+			mark[0][scbol[i]] = gen[0];
+			cur[ncur++] = scbol[i];
+		}
+	}
+	ncur = rep_closure (cur, ncur, mark[0], gen[0]);
+
+	plen = rep->limit - rep->ub;
+
+	for (pos = 0; pos < rep->limit; ++pos) {
+		if (pos <= plen) {
+			rep_chars (pos < plen ? rep_syms[rep->prefix + pos] :
+				   rep->sym, chars);
+			memset (meets, -1, (size_t) lastccl + 1);
+		}
+
+		++gen[1];
+		nnxt = 0;
+		for (i = 0; i < ncur; ++i) {
+			ns = cur[i];
+			sym = transchar[ns];
+
+			if (sym == SYM_EPSILON || assoc_rule[ns] == rep->rule)
+				continue;
+
+			t = trans1[ns];
+			if (t != NO_TRANSITION && mark[1][t] != gen[1] &&
+			    rep_meets (sym, chars, meets)) {
+				mark[1][t] = gen[1];
+				nxt[nnxt++] = t;
+			}
+		}
+		nnxt = rep_closure (nxt, nnxt, mark[1], gen[1]);
+
+		if (nnxt == 0)
+			goto done;
+
+		/* Once the runs of x stop changing the set of states, no
+		 * further characters will either.
+		 */
+		same = pos >= plen && nnxt == ncur;
+		for (i = 0; same && i < nnxt; ++i)
+			same = mark[0][nxt[i]] == gen[0];
+
+		tmp = cur, cur = nxt, nxt = tmp;
+		ncur = nnxt;
+		tmp = mark[0], mark[0] = mark[1], mark[1] = tmp;
+		t = gen[0], gen[0] = gen[1], gen[1] = t;
+
+		if (same)
+			break;
+	}
+
+	/* Everything reachable from here, on any input, is a match of at
+	 * least rep->limit characters.
+	 */
+	for (i = 0; i < ncur; ++i) {
+		ns = cur[i];
+
+		if (accptnum[ns] != NIL && accptnum[ns] != rep->rule) {
+			conflict = true;
+			break;
+		}
+
+		if (assoc_rule[ns] == rep->rule)
+			continue;
+
+		out[0] = trans1[ns];
+		out[1] = trans2[ns];
+
+		for (j = 0; j < 2; ++j)
+			if (out[j] != NO_TRANSITION &&
+			    mark[0][out[j]] != gen[0]) {
+				mark[0][out[j]] = gen[0];
+				cur[ncur++] = out[j];
+			}
+	}
+
+ done:
+	free (cur);
+	free (nxt);
+	free (mark[0]);
+	free (mark[1]);
+	free (chars);
+	free (meets);
+
+	return conflict;
+}
 
 
 /* add_accept - add an accepting state to a machine
@@ -95,7 +370,7 @@ void    dumpnfa (int state1)
 {
 	int     sym, tsp1, tsp2, anum, ns;
 
-	fprintf (stderr,
+	fprintf (flex_run->err,
 		 _
 		 ("\n\n********** beginning dump of nfa with start state %d\n"),
 		 state1);
@@ -108,22 +383,22 @@ void    dumpnfa (int state1)
 
 	/* for ( ns = firstst[state1]; ns <= lastst[state1]; ++ns ) */
 	for (ns = 1; ns <= lastnfa; ++ns) {
-		fprintf (stderr, _("state # %4d\t"), ns);
+		fprintf (flex_run->err, _("state # %4d\t"), ns);
 
 		sym = transchar[ns];
 		tsp1 = trans1[ns];
 		tsp2 = trans2[ns];
 		anum = accptnum[ns];
 
-		fprintf (stderr, "%3d:  %4d, %4d", sym, tsp1, tsp2);
+		fprintf (flex_run->err, "%3d:  %4d, %4d", sym, tsp1, tsp2);
 
 		if (anum != NIL)
-			fprintf (stderr, "  [%d]", anum);
+			fprintf (flex_run->err, "  [%d]", anum);
 
-		fprintf (stderr, "\n");
+		fprintf (flex_run->err, "\n");
 	}
 
-	fprintf (stderr, _("********** end of dump\n"));
+	fprintf (flex_run->err, _("********** end of dump\n"));
 }
 
 
@@ -146,7 +421,7 @@ void    dumpnfa (int state1)
 
 int     dupmachine (int mach)
 {
-	int     i, init, state_offset;
+	int     i, init, state_offset, nreps;
 	int     state = 0;
 	int     last = lastst[mach];
 
@@ -170,6 +445,17 @@ int     dupmachine (int mach)
 
 	state_offset = state - i + 1;
 
+	/* The copy of a counted repeat's loop is a loop to settle too. */
+	for (i = first_rule_rep, nreps = num_reps; i < nreps; ++i)
+		if (counted_reps[i].entry >= firstst[mach] &&
+		    counted_reps[i].entry <= last) {
+			struct counted_rep rep = counted_reps[i];
+
+			add_counted_rep (rep.entry + state_offset,
+					 rep.exit + state_offset, rep.sym,
+					 rep.lb, rep.ub, rep.rule, rep.type);
+		}
+
 	init = mach + state_offset;
 	firstst[init] = firstst[mach] + state_offset;
 	finalst[init] = finalst[mach] + state_offset;
@@ -179,6 +465,113 @@ int     dupmachine (int mach)
 }
 
 
+/* finish_counted_repeats - settle the loops left by --counted-repeats
+ *
+ * Called once all the rules are in.  Loops that another rule could outrun
+ * get their copies back, as do all of them if REJECT or variable trailing
+ * context is used, whose match loop keeps a stack of states instead, or
+ * if the tables go to a file, which has no place for the bounds.
+ */
+
+void    finish_counted_repeats (void)
+{
+	int     i;
+
+	num_counted_repeats = 0;
+
+	for (i = 0; i < num_reps; ++i) {
+		if (counted_reps[i].entry == NIL)
+			continue;
+
+		if (reject || variable_trailing_context_rules || tablesext ||
+		    rep_conflicts (&counted_reps[i]))
+			expand_counted_rep (&counted_reps[i]);
+		else
+			++num_counted_repeats;
+	}
+}
+
+
+/* counted_repeat_limit - the length at which the scanner stops rule's match
+ *
+ * Returns 0 if the rule has no loop left by --counted-repeats.
+ */
+
+int     counted_repeat_limit (int rule)
+{
+	int     i;
+
+	for (i = 0; i < num_reps; ++i)
+		if (counted_reps[i].entry != NIL && counted_reps[i].rule == rule)
+			return counted_reps[i].limit;
+
+	return 0;
+}
+
+
+/* reset_counted_repeats - forget the last run's loops, keeping the space */
+
+void    reset_counted_repeats (void)
+{
+	num_reps = first_rule_rep = num_rep_syms = 0;
+}
+
+
+/* rule_counted_rep - settle the loops of the rule just parsed
+ *
+ * Keeps the loop that ends the rule, provided only single characters and
+ * classes come before it and cut_ok says the action may cut the match
+ * back.  Every other loop of the rule gets its copies.  Returns the length
+ * the action has to cut the match back to, or 0 if there is no loop.
+ */
+
+static int rule_counted_rep (int mach, bool cut_ok)
+{
+	struct counted_rep *rep = NULL;
+	int     first_sym = num_rep_syms;
+	int     i, ns, steps;
+
+	if (cut_ok && trans1[finalst[mach]] == NO_TRANSITION)
+		for (i = first_rule_rep; i < num_reps; ++i)
+			if (counted_reps[i].entry != NIL &&
+			    counted_reps[i].exit == finalst[mach])
+				rep = &counted_reps[i];
+
+	for (ns = mach, steps = 0; rep && ns != rep->entry; ++steps) {
+		if (ns == NO_TRANSITION || steps > lastnfa ||
+		    trans2[ns] != NO_TRANSITION || accptnum[ns] != NIL) {
+			rep = NULL;
+			break;
+		}
+
+		if (transchar[ns] != SYM_EPSILON) {
+			if (num_rep_syms >= max_rep_syms) {
+				max_rep_syms += MAX (MAX_RULES_INCREMENT,
+						     max_rep_syms / 2);
+				rep_syms = reallocate_integer_array (rep_syms,
+								     max_rep_syms);
+			}
+			rep_syms[num_rep_syms++] = transchar[ns];
+		}
+
+		ns = trans1[ns];
+	}
+
+	if (rep) {
+		rep->prefix = first_sym;
+		rep->limit = num_rep_syms - first_sym + rep->ub;
+	}
+	else
+		num_rep_syms = first_sym;
+
+	for (i = first_rule_rep; i < num_reps; ++i)
+		if (counted_reps[i].entry != NIL && &counted_reps[i] != rep)
+			expand_counted_rep (&counted_reps[i]);
+
+	return rep ? rep->limit : 0;
+}
+
+
 /* finish_rule - finish up the processing for a rule
  *
  * An accepting number is added to the given machine.  If variable_trail_rule
@@ -195,9 +588,13 @@ void    finish_rule (int mach, int variable_trail_rule, int headcnt, int trailcn
 		     int pcont_act)
 {
 	char    action_text[MAXLINE];
+	int     limit;
 
 	add_accept (mach, num_rules);
 
+	limit = rule_counted_rep (mach, !variable_trail_rule && !pcont_act &&
+				  headcnt == 0 && trailcnt == 0);
+
 	/* We did this in new_rule(), but it often gets the wrong
 	 * number because we do it before we start parsing the current rule.
 	 */
@@ -229,7 +626,7 @@ void    finish_rule (int mach, int variable_trail_rule, int headcnt, int trailcn
 		rule_type[num_rules] = RULE_VARIABLE;
 
 		if (env.performance_hint > 0)
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("Variable trailing context rule at line %d\n"),
 				 rule_linenum[num_rules]);
@@ -272,6 +669,28 @@ void    finish_rule (int mach, int variable_trail_rule, int headcnt, int trailcn
 			add_action
 				("M4_HOOK_TAKE_YYTEXT\n");
 		}
+
+		else if (limit > 0) {
+			/* Cut a match that ran on past the end of a
+			 * counted repeat back to the repeat's length.
+			 */
+			snprintf (action_text, sizeof(action_text),
+				  "M4_HOOK_LENGTH_LIMIT_OPEN(%d)\n", limit);
+			add_action (action_text);
+			add_action ("M4_HOOK_RELEASE_YYTEXT\n");
+
+			if (rule_has_nl[num_rules]) {
+				snprintf (action_text, sizeof(action_text),
+					  "M4_HOOK_LINE_FORWARD(%d)\n", limit);
+				add_action (action_text);
+			}
+
+			snprintf (action_text, sizeof(action_text),
+				  "M4_HOOK_CHAR_FORWARD(%d)\n", limit);
+			add_action (action_text);
+			add_action ("M4_HOOK_TAKE_YYTEXT\n");
+			add_action ("M4_HOOK_LENGTH_LIMIT_CLOSE\n");
+		}
 	}
 
 	/* Okay, in the action code at this point yytext and yyleng have
@@ -537,12 +956,45 @@ int     mkposcl (int state)
  *
  * note
  *   if "ub" is INFINITE_REPEAT then "new" matches "lb" or more occurrences of "mach"
+ *   with --counted-repeats, a large repeat of a single character or class
+ *   may be built as a loop instead; see struct counted_rep above
  */
 
 int     mkrep (int mach, int lb, int ub)
+{
+	int     entry, final, body, sym;
+
+	if (!env.counted_repeats || ub == INFINITE_REPEAT ||
+	    ub - lb < MIN_COUNTED_REPEAT || firstst[mach] != lastst[mach] ||
+	    transchar[mach] == SYM_EPSILON ||
+	    current_state_type != STATE_NORMAL)
+		return mkrep_copies (mach, lb, ub);
+
+	sym = transchar[mach];
+	entry = mkstate (SYM_EPSILON);
+	body = lb > 0 ? mkrep_copies (mach, lb, INFINITE_REPEAT) :
+		mkclos (mach);
+	final = mkstate (SYM_EPSILON);
+
+	add_counted_rep (entry, final, sym, lb, ub, num_rules,
+			 current_state_type);
+
+	return link_machines (link_machines (entry, body), final);
+}
+
+
+/* mkrep_copies - make a replicated machine out of copies of mach
+ *
+ * As mkrep(), but always copying; an "lb" of 0 makes the copies optional.
+ */
+
+static int mkrep_copies (int mach, int lb, int ub)
 {
 	int     base_mach, tail, copy, i;
 
+	if (lb == 0)
+		return mkopt (mkrep_copies (mach, 1, ub));
+
 	base_mach = copysingl (mach, lb - 1);
 
 	if (ub == INFINITE_REPEAT) {
@@ -569,6 +1021,40 @@ int     mkrep (int mach, int lb, int ub)
 }
 
 
+/* grow_nfa - make room for more nfa states
+ *
+ * The nfa state arrays grow by half their size at a time, so that making
+ * n states copies O(n) entries in all rather than O(n^2).  The states'
+ * fields are kept in separate arrays, so the closure and subset
+ * construction code, which only reads transchar[], trans1[], trans2[]
+ * and accptnum[], doesn't drag the others through the cache.
+ */
+
+static void grow_nfa (void)
+{
+	if (current_mns >= MAXIMUM_MNS)
+		lerr (_("input rules are too complicated (>= %d NFA states)"),
+		      current_mns);
+
+	if (current_mns > MAXIMUM_MNS - current_mns / 2)
+		current_mns = MAXIMUM_MNS;
+	else
+		current_mns += current_mns / 2;
+
+	++num_reallocs;
+
+	firstst = reallocate_integer_array (firstst, current_mns);
+	lastst = reallocate_integer_array (lastst, current_mns);
+	finalst = reallocate_integer_array (finalst, current_mns);
+	transchar = reallocate_integer_array (transchar, current_mns);
+	trans1 = reallocate_integer_array (trans1, current_mns);
+	trans2 = reallocate_integer_array (trans2, current_mns);
+	accptnum = reallocate_integer_array (accptnum, current_mns);
+	assoc_rule = reallocate_integer_array (assoc_rule, current_mns);
+	state_type = reallocate_integer_array (state_type, current_mns);
+}
+
+
 /* mkstate - create a state with a transition on a given symbol
  *
  * synopsis
@@ -587,28 +1073,8 @@ int     mkrep (int mach, int lb, int ub)
 
 int     mkstate (int sym)
 {
-	if (++lastnfa >= current_mns) {
-		if ((current_mns += MNS_INCREMENT) >= maximum_mns)
-			lerr(_
-				("input rules are too complicated (>= %d NFA states)"),
-current_mns);
-
-		++num_reallocs;
-
-		firstst = reallocate_integer_array (firstst, current_mns);
-		lastst = reallocate_integer_array (lastst, current_mns);
-		finalst = reallocate_integer_array (finalst, current_mns);
-		transchar =
-			reallocate_integer_array (transchar, current_mns);
-		trans1 = reallocate_integer_array (trans1, current_mns);
-		trans2 = reallocate_integer_array (trans2, current_mns);
-		accptnum =
-			reallocate_integer_array (accptnum, current_mns);
-		assoc_rule =
-			reallocate_integer_array (assoc_rule, current_mns);
-		state_type =
-			reallocate_integer_array (state_type, current_mns);
-	}
+	if (++lastnfa >= current_mns)
+		grow_nfa ();
 
 	firstst[lastnfa] = lastnfa;
 	finalst[lastnfa] = lastnfa;
@@ -682,7 +1148,8 @@ void    new_rule (void)
 {
 	if (++num_rules >= current_max_rules) {
 		++num_reallocs;
-		current_max_rules += MAX_RULES_INCREMENT;
+		current_max_rules += MAX (MAX_RULES_INCREMENT,
+					  current_max_rules / 2);
 		rule_type = reallocate_integer_array (rule_type,
 						      current_max_rules);
 		rule_linenum = reallocate_integer_array (rule_linenum,
@@ -699,4 +1166,5 @@ void    new_rule (void)
 	rule_linenum[num_rules] = linenum;
 	rule_useful[num_rules] = false;
 	rule_has_nl[num_rules] = false;
+	first_rule_rep = num_reps;
 }
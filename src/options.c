@@ -72,6 +72,8 @@ optspec_t flexopts[] = {
 	,			/* Scanner to be called by a bison pure parser. */
 	{"--bison-locations", OPT_BISON_BRIDGE_LOCATIONS, 0}
 	,			/* Scanner to be called by a bison pure parser. */
+	{"--cache-dir=DIR", OPT_CACHE_DIR, 0}
+	,			/* Reuse tables built for the same rules. */
 	{"-i", OPT_CASE_INSENSITIVE, 0}
 	,
 	{"--case-insensitive", OPT_CASE_INSENSITIVE, 0}
@@ -79,6 +81,10 @@ optspec_t flexopts[] = {
 	
 		{"-C[aefFmr]", OPT_COMPRESSION,
 	 "Specify degree of table compression (default is -Cem)"},
+	{"--counted-repeats", OPT_COUNTED_REPEATS, 0}
+	,			/* Loop large x{n,m} and check the length. */
+	{"--nocounted-repeats", OPT_NO_COUNTED_REPEATS, 0}
+	,
 	{"-+", OPT_CPLUSPLUS, 0}
 	,
 	{"--c++", OPT_CPLUSPLUS, 0}
@@ -129,6 +135,8 @@ optspec_t flexopts[] = {
 	,
 	{"--interactive", OPT_INTERACTIVE, 0}
 	,			/* Generate interactive scanner (opposite of -B). */
+	{"--large-input", OPT_LARGE_INPUT, 0}
+	,			/* 64-bit buffer sizes, offsets and yyleng. */
 	{"-l", OPT_LEX_COMPAT, 0}
 	,
 	{"--lex-compat", OPT_LEX_COMPAT, 0}
@@ -143,6 +151,8 @@ optspec_t flexopts[] = {
 	,			/* Suppress #line directives in scanner. */
 	{"--noline", OPT_NO_LINE, 0}
 	,			/* Suppress #line directives in scanner. */
+	{"--m4=PROGRAM", OPT_M4, 0}
+	,			/* m4 to expand the skeleton with, or "builtin" */
 	{"--main", OPT_MAIN, 0}
 	,			/* use built-in main() function. */
 	{"--nomain", OPT_NO_MAIN, 0}
@@ -151,24 +161,40 @@ optspec_t flexopts[] = {
 	,			/* Construct meta-equivalence classes. */
 	{"--nometa-ecs", OPT_NO_META_ECS, 0}
 	,
+	{"--minimize", OPT_MINIMIZE, 0}
+	,			/* Merge equivalent DFA states. */
+	{"--nominimize", OPT_NO_MINIMIZE, 0}
+	,
+	{"--mmap", OPT_MMAP, 0}
+	,			/* Generate yy_scan_file_mmap(). */
 	{"--never-interactive", OPT_NEVER_INTERACTIVE, 0}
 	,
 	{"-o FILE", OPT_OUTFILE, 0}
 	,
 	{"--outfile=FILE", OPT_OUTFILE, 0}
 	,			/* Write to FILE (default is lex.yy.c) */
+	{"--pack", OPT_PACK, 0}
+	,			/* Pack the largest states first. */
+	{"--nopack", OPT_NO_PACK, 0}
+	,
 	{"-p", OPT_PERF_REPORT, 0}
 	,
 	{"--perf-report", OPT_PERF_REPORT, 0}
 	,			/* Generate performance report to stderr. */
 	{"--pointer", OPT_POINTER, 0}
 	,
+	{"--prefetch", OPT_PREFETCH, 0}
+	,			/* Generate yy_create_buffer_prefetch(). */
 	{"-P PREFIX", OPT_PREFIX, 0}
 	,
 	{"--prefix=PREFIX", OPT_PREFIX, 0}
 	,			/* Use PREFIX (default is yy) */
 	{"-Dmacro", OPT_PREPROCDEFINE, 0}
 	,			/* Define a preprocessor symbol. */
+	{"--proto-index", OPT_PROTO_INDEX, 0}
+	,			/* Search all protos, not just recent ones. */
+	{"--noproto-index", OPT_NO_PROTO_INDEX, 0}
+	,
 	{"--read", OPT_READ, 0}
 	,			/* Use read(2) instead of stdio. */
 	{"-R", OPT_REENTRANT, 0}
@@ -187,6 +213,8 @@ optspec_t flexopts[] = {
 	,			/* Use skeleton from FILE */
 	{"--stack", OPT_STACK, 0}
 	,
+	{"--stats=FORMAT", OPT_STATS, 0}
+	,			/* Report phase timings in FORMAT. */
 	{"--stdinit", OPT_STDINIT, 0}
 	,
 	{"--nostdinit", OPT_NO_STDINIT, 0}
@@ -203,6 +231,16 @@ optspec_t flexopts[] = {
 	,			/* Save tables to FILE */
         {"--tables-verify", OPT_TABLES_VERIFY, 0}
         ,                       /* Tables integrity check */
+	{"-j NUM", OPT_THREADS, 0}
+	,
+	{"--threads=NUM", OPT_THREADS, 0}
+	,			/* Build the DFA with NUM threads. */
+	{"--token-view", OPT_TOKEN_VIEW, 0}
+	,			/* Leave the input buffer unmodified. */
+	{"--tune-tables", OPT_TUNE_TABLES, 0}
+	,			/* Try several table compression settings. */
+	{"--notune-tables", OPT_NO_TUNE_TABLES, 0}
+	,
 	{"--nounistd", OPT_NO_UNISTD_H, 0}
 	,			/* Do not include unistd.h */
 	{"-v", OPT_VERBOSE, 0}
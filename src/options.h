@@ -50,8 +50,10 @@ enum flexopt_flag_t {
 	OPT_BATCH,
         OPT_BISON_BRIDGE,
         OPT_BISON_BRIDGE_LOCATIONS,
+	OPT_CACHE_DIR,
 	OPT_CASE_INSENSITIVE,
 	OPT_COMPRESSION,
+	OPT_COUNTED_REPEATS,
 	OPT_CPLUSPLUS,
 	OPT_DEBUG,
 	OPT_DEFAULT,
@@ -64,21 +66,30 @@ enum flexopt_flag_t {
 	OPT_HELP,
 	OPT_HEX,
 	OPT_INTERACTIVE,
+	OPT_LARGE_INPUT,
 	OPT_LEX_COMPAT,
 	OPT_POSIX_COMPAT,
+	OPT_M4,
 	OPT_MAIN,
 	OPT_META_ECS,
+	OPT_MINIMIZE,
+	OPT_MMAP,
 	OPT_NEVER_INTERACTIVE,
 	OPT_NO_ALIGN,
+	OPT_NO_COUNTED_REPEATS,
 	OPT_NO_DEBUG,
 	OPT_NO_DEFAULT,
 	OPT_NO_ECS,
 	OPT_NO_LINE,
 	OPT_NO_MAIN,
 	OPT_NO_META_ECS,
+	OPT_NO_MINIMIZE,
+	OPT_NO_PACK,
+	OPT_NO_PROTO_INDEX,
 	OPT_NO_REENTRANT,
 	OPT_NO_REJECT,
 	OPT_NO_STDINIT,
+	OPT_NO_TUNE_TABLES,
 	OPT_NO_YYINPUT,
 	OPT_NO_YYUNPUT,
 	OPT_NO_WARN,
@@ -110,21 +121,28 @@ enum flexopt_flag_t {
 	OPT_NO_YY_SCAN_STRING,
 	OPT_NO_YY_TOP_STATE,
 	OPT_OUTFILE,
+	OPT_PACK,
 	OPT_PERF_REPORT,
 	OPT_POINTER,
+	OPT_PREFETCH,
 	OPT_PREFIX,
 	OPT_PREPROCDEFINE,
 	OPT_PREPROC_LEVEL,
+	OPT_PROTO_INDEX,
 	OPT_READ,
 	OPT_REENTRANT,
 	OPT_REJECT,
 	OPT_SKEL,
 	OPT_STACK,
+	OPT_STATS,
 	OPT_STDINIT,
 	OPT_STDOUT,
 	OPT_TABLES_FILE,
 	OPT_TABLES_VERIFY,
+	OPT_THREADS,
+	OPT_TOKEN_VIEW,
 	OPT_TRACE,
+	OPT_TUNE_TABLES,
 	OPT_NO_UNISTD_H,
 	OPT_VERBOSE,
 	OPT_VERSION,
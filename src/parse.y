@@ -3,7 +3,7 @@
 %token CHAR NUMBER SECTEND SCDECL XSCDECL NAME PREVCCL EOF_OP
 %token TOK_OPTION TOK_OUTFILE TOK_PREFIX TOK_YYCLASS TOK_HEADER_FILE TOK_EXTRA_TYPE
 %token TOK_TABLES_FILE TOK_YYLMAX TOK_NUMERIC TOK_YYDECL TOK_PREACTION TOK_POSTACTION
-%token TOK_USERINIT TOK_EMIT TOK_BUFSIZE TOK_YYTERMINATE
+%token TOK_USERINIT TOK_EMIT TOK_BUFSIZE TOK_YYTERMINATE TOK_THREADS
 
 %token CCE_ALNUM CCE_ALPHA CCE_BLANK CCE_CNTRL CCE_DIGIT CCE_GRAPH
 %token CCE_LOWER CCE_PRINT CCE_PUNCT CCE_SPACE CCE_UPPER CCE_XDIGIT
@@ -151,6 +151,9 @@ goal		:  initlex sect1 sect1end sect2 initforrule
 initlex		:
 			{ /* initialize for processing rules */
 
+			/* The last run's '.' class went with its ccls. */
+			madeany = false;
+
 			/* Create default DFA start condition. */
 			scinstal( "INITIAL", false );
 			}
@@ -220,6 +223,10 @@ option		:  TOK_OUTFILE '=' NAME
 			{ ctrl.postaction = xstrdup(nmstr); }
 		|  TOK_BUFSIZE '=' TOK_NUMERIC
 			{ ctrl.bufsize = nmval; }
+		|  TOK_THREADS '=' TOK_NUMERIC
+			{ env.threads = nmval;
+			  if (env.threads < 1)
+			      flexerror(_("number of threads must be positive")); }
 		|  TOK_EMIT '=' NAME
 			{ ctrl.emit = xstrdup(nmstr); backend_by_name(ctrl.emit); }
 		|  TOK_USERINIT '=' NAME
@@ -585,8 +592,7 @@ series		:  series singleton
 						$$ = $1;
 						}
 					else
-						$$ = mkopt(
-							mkrep( $1, 1, $5 ) );
+						$$ = mkrep( $1, 0, $5 );
 					}
 				else
 					$$ = mkrep( $1, $3, $5 );
@@ -668,8 +674,7 @@ singleton	:  singleton '*'
 						$$ = $1;
 						}
 					else
-						$$ = mkopt(
-							mkrep( $1, 1, $5 ) );
+						$$ = mkrep( $1, 0, $5 );
 					}
 				else
 					$$ = mkrep( $1, $3, $5 );
@@ -1088,7 +1093,7 @@ void line_warning( const char *str, int line )
 
 void line_pinpoint( const char *str, int line )
 	{
-	fprintf( stderr, "%s:%d: %s\n", infilename, line, str );
+	fprintf( flex_run->err, "%s:%d: %s\n", infilename, line, str );
 	}
 
 
@@ -25,15 +25,22 @@
 
 
 regex_t regex_linedir; /**< matches line directives */
+static bool have_regex_linedir = false;
 
 
-/** Initialize the regular expressions.
+/** Initialize the regular expressions, freeing any made before.
  * @return true upon success.
  */
 bool flex_init_regex(const char *traceline_re)
 {
-	if (traceline_re != NULL)
+	if (have_regex_linedir) {
+		regfree(&regex_linedir);
+		have_regex_linedir = false;
+	}
+	if (traceline_re != NULL) {
 		flex_regcomp(&regex_linedir, traceline_re, REG_EXTENDED);
+		have_regex_linedir = true;
+	}
 	return true;
 }
 
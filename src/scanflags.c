@@ -56,15 +56,19 @@ sf_pop (void)
     --_sf_top_ix;
 }
 
-/* one-time initialization. Should be called before any sf_ functions. */
+/* per-run initialization. Should be called before any sf_ functions.
+ * A later run keeps the stack the first one allocated.
+ */
 void
 sf_init (void)
 {
-    assert(_sf_stk == NULL);
-    _sf_max = 32;
-    _sf_stk = malloc(sizeof(scanflags_t) * _sf_max);
-    if (!_sf_stk)
-        lerr_fatal(_("Unable to allocate %zu of stack"), sizeof(scanflags_t));
+    _sf_top_ix = 0;
+    if (_sf_stk == NULL) {
+        _sf_max = 32;
+        _sf_stk = malloc(sizeof(scanflags_t) * _sf_max);
+        if (!_sf_stk)
+            lerr_fatal(_("Unable to allocate %zu of stack"), sizeof(scanflags_t));
+    }
     _sf_stk[_sf_top_ix] = 0;
 }
 
@@ -476,29 +476,29 @@ static void scanopt_err(struct _scanopt_t *s, int is_short, int err)
 			}
 		}
 
-		fprintf (stderr, "%s: ", s->argv[0]);
+		fprintf (flex_run->err, "%s: ", s->argv[0]);
 		switch (err) {
 		case SCANOPT_ERR_ARG_NOT_ALLOWED:
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("option `%s' doesn't allow an argument\n"),
 				 optname);
 			break;
 		case SCANOPT_ERR_ARG_NOT_FOUND:
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _("option `%s' requires an argument\n"),
 				 optname);
 			break;
 		case SCANOPT_ERR_OPT_AMBIGUOUS:
-			fprintf (stderr, _("option `%s' is ambiguous\n"),
+			fprintf (flex_run->err, _("option `%s' is ambiguous\n"),
 				 optname);
 			break;
 		case SCANOPT_ERR_OPT_UNRECOGNIZED:
-			fprintf (stderr, _("Unrecognized option `%s'\n"),
+			fprintf (flex_run->err, _("Unrecognized option `%s'\n"),
 				 optname);
 			break;
 		default:
-			fprintf (stderr, _("Unknown error=(%d)\n"), err);
+			fprintf (flex_run->err, _("Unknown error=(%d)\n"), err);
 			break;
 		}
 	}
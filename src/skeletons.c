@@ -115,8 +115,14 @@ void backend_by_name(const char *name)
 		}
 		flexerror(_("no such back end"));
 	}
+	else
+		backend = &backends[0];
   backend_ok:
 	ctrl.rewrite = !is_default_backend();
+	/* %option emit may already have chosen one. */
+	free((void *) ctrl.backend_name);
+	free((void *) ctrl.traceline_re);
+	free((void *) ctrl.traceline_template);
 	ctrl.backend_name = xstrdup(skel_property("M4_PROPERTY_BACKEND_NAME"));
 	ctrl.traceline_re = xstrdup(skel_property("M4_PROPERTY_TRACE_LINE_REGEXP"));
 	ctrl.traceline_template = xstrdup(skel_property("M4_PROPERTY_TRACE_LINE_TEMPLATE"));
@@ -0,0 +1,234 @@
+/* stats - time and memory used by each phase of flex, for --stats */
+
+/*  This file is part of flex. */
+
+/*  Redistribution and use in source and binary forms, with or without */
+/*  modification, are permitted provided that the following conditions */
+/*  are met: */
+
+/*  1. Redistributions of source code must retain the above copyright */
+/*     notice, this list of conditions and the following disclaimer. */
+/*  2. Redistributions in binary form must reproduce the above copyright */
+/*     notice, this list of conditions and the following disclaimer in the */
+/*     documentation and/or other materials provided with the distribution. */
+
+/*  Neither the name of the University nor the names of its contributors */
+/*  may be used to endorse or promote products derived from this software */
+/*  without specific prior written permission. */
+
+/*  THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR */
+/*  IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED */
+/*  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR */
+/*  PURPOSE. */
+
+#include "flexdef.h"
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/* Each phase accumulates the wall clock time spent in it.  The phases
+ * that are entered only a few times also accumulate CPU time, of all of
+ * flex's threads, and note the peak resident set size flex has reached
+ * by their end.  The parts of ntod() are entered once or more for each
+ * DFA state, too often to ask the kernel for CPU time, so they get only
+ * wall clock time.  The filters phase counts both flex, which runs the
+ * internal filters itself, and the external filters it forks, whose CPU
+ * time and peak size are collected when flex waits for them.
+ */
+
+static const struct phase_info {
+	const char *name;
+	int     parent;		/* the phase this one is part of, or -1 */
+	bool    cheap;		/* wall clock time only */
+} phase_info[NUM_STATS_PHASES] = {
+	{"parse", -1, false},
+	{"ecs", -1, false},
+	{"ntod", -1, false},
+	{"closure", STATS_NTOD, true},
+	{"lookup", STATS_NTOD, true},
+	{"placement", STATS_NTOD, true},
+	{"minimize", STATS_NTOD, false},
+	{"cmptmps", STATS_NTOD, false},
+	{"make_tables", -1, false},
+	{"output", -1, false},
+	{"filters", -1, false},
+	{"total", -1, false},
+};
+
+static struct phase_stats {
+	bool    ran;		/* the phase ended at least once */
+	double  wall, cpu;	/* seconds spent in the phase */
+	double  wall_start, cpu_start;
+	long    max_rss;	/* peak resident set size at the end, in KB */
+} phases[NUM_STATS_PHASES];
+
+/* 0 if the run did not use --cache-dir, else 1 for a miss, 2 for a hit. */
+static int cache_use;
+
+/* The process that began the run.  The forked filters return through
+ * flex_main() as well, and must not report.
+ */
+static pid_t stats_pid;
+
+
+/* wall_time - seconds on a clock that only goes forward */
+
+static double wall_time (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+
+/* usage_of - CPU seconds and peak size of flex, or of its waited-for
+ * children
+ */
+
+static double usage_of (int who, long *max_rss)
+{
+	struct rusage ru;
+
+	if (getrusage (who, &ru) != 0) {
+		*max_rss = 0;
+		return 0;
+	}
+
+	*max_rss = ru.ru_maxrss;
+	return (double) ru.ru_utime.tv_sec + (double) ru.ru_utime.tv_usec / 1e6
+		+ (double) ru.ru_stime.tv_sec + (double) ru.ru_stime.tv_usec / 1e6;
+}
+
+
+/* phase_usage - CPU seconds and peak size to charge to phase p */
+
+static double phase_usage (enum stats_phase p, long *max_rss)
+{
+	double  cpu = usage_of (RUSAGE_SELF, max_rss);
+	long    child_rss;
+
+	if (p == STATS_FILTERS) {
+		cpu += usage_of (RUSAGE_CHILDREN, &child_rss);
+		if (child_rss > *max_rss)
+			*max_rss = child_rss;
+	}
+	return cpu;
+}
+
+
+/* stats_begin - enter a phase */
+
+void stats_begin (enum stats_phase p)
+{
+	struct phase_stats *ph = &phases[p];
+	long    max_rss;
+
+	if (p == STATS_TOTAL) {
+		/* Forget the last run's figures. */
+		memset (phases, 0, sizeof (phases));
+		cache_use = 0;
+	}
+
+	if (!env.stats)
+		return;
+
+	if (p == STATS_TOTAL)
+		stats_pid = getpid ();
+
+	ph->wall_start = wall_time ();
+	if (!phase_info[p].cheap)
+		ph->cpu_start = phase_usage (p, &max_rss);
+}
+
+
+/* stats_end - leave a phase */
+
+void stats_end (enum stats_phase p)
+{
+	struct phase_stats *ph = &phases[p];
+
+	if (!env.stats)
+		return;
+
+	ph->wall += wall_time () - ph->wall_start;
+	if (!phase_info[p].cheap)
+		ph->cpu += phase_usage (p, &ph->max_rss) - ph->cpu_start;
+	ph->ran = true;
+}
+
+
+/* stats_cache - note whether the DFA and tables came from the cache */
+
+void stats_cache (bool hit)
+{
+	cache_use = hit ? 2 : 1;
+}
+
+
+/* stats_report - write the phases that ran to stderr, as a table or,
+ * with --stats=json, as a JSON object, and whether the cache was hit
+ */
+
+void stats_report (void)
+{
+	int     p;
+	bool    first = true;
+
+	if (!env.stats || getpid () != stats_pid)
+		return;
+
+	if (env.stats == STATS_REPORT_JSON)
+		fprintf (flex_run->err, "{\"phases\": [");
+	else
+		fprintf (flex_run->err, _("%s phase statistics:\n"
+				   "  %-14s %10s %10s %14s\n"),
+			 program_name, _("phase"), _("wall (s)"),
+			 _("cpu (s)"), _("peak RSS (KB)"));
+
+	for (p = 0; p < NUM_STATS_PHASES; ++p) {
+		const struct phase_info *pi = &phase_info[p];
+		struct phase_stats *ph = &phases[p];
+
+		if (!ph->ran)
+			continue;
+
+		if (env.stats == STATS_REPORT_JSON) {
+			fprintf (flex_run->err, "%s\n  {\"name\": \"%s\"",
+				 first ? "" : ",", pi->name);
+			if (pi->parent >= 0)
+				fprintf (flex_run->err, ", \"parent\": \"%s\"",
+					 phase_info[pi->parent].name);
+			fprintf (flex_run->err, ", \"wall\": %.6f", ph->wall);
+			if (!pi->cheap)
+				fprintf (flex_run->err,
+					 ", \"cpu\": %.6f, \"max_rss_kb\": %ld",
+					 ph->cpu, ph->max_rss);
+			fputc ('}', flex_run->err);
+		}
+
+		else if (pi->cheap)
+			fprintf (flex_run->err, "  %s%-*s %10.6f %10s %14s\n",
+				 pi->parent >= 0 ? "  " : "",
+				 pi->parent >= 0 ? 12 : 14, pi->name,
+				 ph->wall, "-", "-");
+		else
+			fprintf (flex_run->err, "  %s%-*s %10.6f %10.6f %14ld\n",
+				 pi->parent >= 0 ? "  " : "",
+				 pi->parent >= 0 ? 12 : 14, pi->name,
+				 ph->wall, ph->cpu, ph->max_rss);
+
+		first = false;
+	}
+
+	if (env.stats == STATS_REPORT_JSON) {
+		fprintf (flex_run->err, "\n]");
+		if (cache_use)
+			fprintf (flex_run->err, ", \"cache\": \"%s\"",
+				 cache_use == 2 ? "hit" : "miss");
+		fprintf (flex_run->err, "}\n");
+	}
+	else if (cache_use)
+		fprintf (flex_run->err, _("  cache: %s\n"),
+			 cache_use == 2 ? _("hit") : _("miss"));
+}
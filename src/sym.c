@@ -37,73 +37,76 @@
  * sctbl - start-condition symbol table
  * ndtbl - name-definition symbol table
  * ccltab - character class text symbol table
+ * strtbl - the interned names
+ *
+ * The tables are open-addressed with linear probing.  Each holds a power
+ * of two slots, at least half of them empty, and doubles when an addition
+ * would fill more.  Entries keep their key's full hash.
+ *
+ * strtbl keeps one copy of every name the other tables hold, and those
+ * compare keys by address.  A lookup first finds its name in strtbl,
+ * comparing text only where the hashes match; a name that was never
+ * interned is in none of the tables.
  */
 
 struct hash_entry {
-	struct hash_entry *prev, *next;
-	char   *name;
+	char   *name;		/* NULL in an empty slot */
 	char   *str_val;
 	int     int_val;
+	uint64_t hash;
 };
 
-typedef struct hash_entry **hash_table;
+struct hash_table {
+	struct hash_entry *slots;
+	int     size, used;
+};
 
-#define NAME_TABLE_HASH_SIZE 101
-#define START_COND_HASH_SIZE 101
-#define CCL_HASH_SIZE 101
+#define INITIAL_HASH_TABLE_SIZE 64
 
-static struct hash_entry *ndtbl[NAME_TABLE_HASH_SIZE];
-static struct hash_entry *sctbl[START_COND_HASH_SIZE];
-static struct hash_entry *ccltab[CCL_HASH_SIZE];
+static struct hash_table ndtbl, sctbl, ccltab, strtbl;
 
 
 /* declare functions that have forward references */
 
-static int addsym(char[], char *, int, hash_table, int);
-static struct hash_entry *findsym (const char *sym, hash_table table,
-				   int table_size);
-static int hashfunct(const char *, int);
+static int addsym(struct hash_entry *, char *, int, struct hash_table *);
+static struct hash_entry *findsym (const char *sym, struct hash_table *table);
+static void grow_table(struct hash_table *);
+static uint64_t hashfunct(const char *);
+static struct hash_entry *intern(const char *, bool);
+static struct hash_entry *probe(struct hash_table *, const char *, uint64_t);
+static struct hash_entry *probe_text(struct hash_table *, const char *, uint64_t);
 
 
 /* addsym - add symbol and definitions to symbol table
  *
+ * key is the symbol's entry in strtbl.
  * -1 is returned if the symbol already exists, and the change not made.
  */
 
-static int addsym (char sym[], char *str_def, int int_def, hash_table table, int table_size)
+static int addsym (struct hash_entry *key, char *str_def, int int_def, struct hash_table *table)
 {
-	int    hash_val = hashfunct (sym, table_size);
-	struct hash_entry *sym_entry = table[hash_val];
-	struct hash_entry *new_entry;
-	struct hash_entry *successor;
+	struct hash_entry *sym_entry = NULL;
 
-	while (sym_entry) {
-		if (!strcmp (sym, sym_entry->name)) {	/* entry already exists */
-			return -1;
-		}
+	/* Look before growing, so that a symbol defined twice leaves the
+	 * table as it was.
+	 */
+	if (table->size > 0) {
+		sym_entry = probe (table, key->name, key->hash);
 
-		sym_entry = sym_entry->next;
+		if (sym_entry->name)	/* entry already exists */
+			return -1;
 	}
 
-	/* create new entry */
-	new_entry = malloc(sizeof(struct hash_entry));
-
-	if (new_entry == NULL)
-		flexfatal (_("symbol table memory allocation failed"));
-
-	if ((successor = table[hash_val]) != 0) {
-		new_entry->next = successor;
-		successor->prev = new_entry;
+	if (table->used + 1 > table->size / 2) {
+		grow_table (table);
+		sym_entry = probe (table, key->name, key->hash);
 	}
-	else
-		new_entry->next = NULL;
 
-	new_entry->prev = NULL;
-	new_entry->name = sym;
-	new_entry->str_val = str_def;
-	new_entry->int_val = int_def;
-
-	table[hash_val] = new_entry;
+	sym_entry->name = key->name;
+	sym_entry->str_val = str_def;
+	sym_entry->int_val = int_def;
+	sym_entry->hash = key->hash;
+	++table->used;
 
 	return 0;
 }
@@ -117,8 +120,8 @@ void    cclinstal (char ccltxt[], int cclnum)
 	 * called unless the symbol is new.
 	 */
 
-	(void) addsym (xstrdup(ccltxt),
-		       (char *) 0, cclnum, ccltab, CCL_HASH_SIZE);
+	(void) addsym (intern (ccltxt, true),
+		       (char *) 0, cclnum, &ccltab);
 }
 
 
@@ -129,57 +132,156 @@ void    cclinstal (char ccltxt[], int cclnum)
 
 int     ccllookup (char ccltxt[])
 {
-	return findsym (ccltxt, ccltab, CCL_HASH_SIZE)->int_val;
+	return findsym (ccltxt, &ccltab)->int_val;
 }
 
 
 /* findsym - find symbol in symbol table */
 
-static struct hash_entry *findsym (const char *sym, hash_table table, int table_size)
+static struct hash_entry *findsym (const char *sym, struct hash_table *table)
 {
 	static struct hash_entry empty_entry = {
-		NULL, NULL, NULL, NULL, 0,
+		NULL, NULL, 0, 0,
 	};
-	struct hash_entry *sym_entry =
+	struct hash_entry *key, *sym_entry;
 
-		table[hashfunct (sym, table_size)];
+	if (table->size == 0 || (key = intern (sym, false)) == NULL)
+		return &empty_entry;
 
-	while (sym_entry) {
-		if (!strcmp (sym, sym_entry->name))
-			return sym_entry;
-		sym_entry = sym_entry->next;
-	}
+	sym_entry = probe (table, key->name, key->hash);
 
-	return &empty_entry;
+	return sym_entry->name ? sym_entry : &empty_entry;
 }
 
-/* hashfunct - compute the hash value for "str" and hash size "hash_size" */
 
-static int hashfunct (const char *str, int hash_size)
+/* grow_table - double a table, or give it its first slots */
+
+static void grow_table (struct hash_table *table)
 {
-	int hashval;
-	int locstr;
+	struct hash_entry *old_slots = table->slots;
+	int     old_size = table->size, i;
+
+	table->size = old_size ? old_size * 2 : INITIAL_HASH_TABLE_SIZE;
+	table->slots = allocate_array (table->size,
+				       sizeof (struct hash_entry));
+	memset (table->slots, 0,
+		(size_t) table->size * sizeof (struct hash_entry));
+
+	/* Every key is distinct, so each goes in the first empty slot. */
+	for (i = 0; i < old_size; ++i)
+		if (old_slots[i].name)
+			*probe (table, old_slots[i].name,
+				old_slots[i].hash) = old_slots[i];
+
+	if (old_slots) {
+		free (old_slots);
+		++num_reallocs;
+	}
+}
+
 
-	hashval = 0;
-	locstr = 0;
+/* hashfunct - compute the hash value for "str"
+ *
+ * This is 64-bit FNV-1a; the table takes as many of the low bits as it
+ * has slots for.
+ */
 
-	while (str[locstr]) {
-		hashval = (hashval << 1) + (unsigned char) str[locstr++];
-		hashval %= hash_size;
+static uint64_t hashfunct (const char *str)
+{
+	uint64_t hashval = 0xcbf29ce484222325ULL;
+
+	while (*str) {
+		hashval ^= (unsigned char) *str++;
+		hashval *= 0x100000001b3ULL;
 	}
 
 	return hashval;
 }
 
 
+/* intern - find the interned copy of a name
+ *
+ * Returns its entry in strtbl, which holds the copy and its hash and is
+ * good until the next name is interned.  If the name has no copy yet,
+ * one is made if add is true, and otherwise NULL is returned.
+ */
+
+static struct hash_entry *intern (const char *sym, bool add)
+{
+	uint64_t hash_val = hashfunct (sym);
+	struct hash_entry *str_entry;
+
+	if (strtbl.size == 0) {
+		if (!add)
+			return NULL;
+		grow_table (&strtbl);
+	}
+
+	str_entry = probe_text (&strtbl, sym, hash_val);
+
+	if (str_entry->name)
+		return str_entry;
+	if (!add)
+		return NULL;
+
+	if (strtbl.used + 1 > strtbl.size / 2) {
+		grow_table (&strtbl);
+		str_entry = probe_text (&strtbl, sym, hash_val);
+	}
+
+	str_entry->name = xstrdup (sym);
+	str_entry->hash = hash_val;
+	++strtbl.used;
+
+	return str_entry;
+}
+
+
+/* probe - find the slot for an interned symbol
+ *
+ * Returns the symbol's entry, or the empty slot where it belongs.
+ */
+
+static struct hash_entry *probe (struct hash_table *table, const char *sym, uint64_t hash_val)
+{
+	size_t  mask = (size_t) table->size - 1;
+	size_t  i = (size_t) hash_val & mask;
+	struct hash_entry *sym_entry;
+
+	for (;; i = (i + 1) & mask) {
+		sym_entry = &table->slots[i];
+
+		if (!sym_entry->name || sym_entry->name == sym)
+			return sym_entry;
+	}
+}
+
+
+/* probe_text - probe() for strtbl, which compares the names' text */
+
+static struct hash_entry *probe_text (struct hash_table *table, const char *sym, uint64_t hash_val)
+{
+	size_t  mask = (size_t) table->size - 1;
+	size_t  i = (size_t) hash_val & mask;
+	struct hash_entry *sym_entry;
+
+	for (;; i = (i + 1) & mask) {
+		sym_entry = &table->slots[i];
+
+		if (!sym_entry->name ||
+		    (sym_entry->hash == hash_val && !strcmp (sym, sym_entry->name)))
+			return sym_entry;
+	}
+}
+
+
 /* ndinstal - install a name definition */
 
 void    ndinstal (const char *name, char definition[])
 {
 
-	if (addsym (xstrdup(name),
-		    xstrdup(definition), 0,
-		    ndtbl, NAME_TABLE_HASH_SIZE))
+	if (addsym (intern (name, true),
+		    xstrdup(definition), 0, &ndtbl))
 			synerr (_("name defined twice"));
 }
 
@@ -191,7 +293,7 @@ void    ndinstal (const char *name, char definition[])
 
 char   *ndlookup (const char *nd)
 {
-	return findsym (nd, ndtbl, NAME_TABLE_HASH_SIZE)->str_val;
+	return findsym (nd, &ndtbl)->str_val;
 }
 
 
@@ -219,14 +321,14 @@ void    scextend (void)
 
 void    scinstal (const char *str, int xcluflg)
 {
+	struct hash_entry *key = intern (str, true);
 
 	if (++lastsc >= current_max_scs)
 		scextend ();
 
-	scname[lastsc] = xstrdup(str);
+	scname[lastsc] = key->name;
 
-	if (addsym(scname[lastsc], NULL, lastsc,
-		    sctbl, START_COND_HASH_SIZE))
+	if (addsym(key, NULL, lastsc, &sctbl))
 			format_pinpoint_message (_
 						 ("start condition %s declared twice"),
 str);
@@ -245,5 +347,46 @@ str);
 
 int     sclookup (const char *str)
 {
-	return findsym (str, sctbl, START_COND_HASH_SIZE)->int_val;
+	return findsym (str, &sctbl)->int_val;
+}
+
+
+/* symtab_stats - report how full the symbol tables are, for -v */
+
+void    symtab_stats (FILE *file)
+{
+	fprintf (file,
+		 _("  %d/%d name definition, %d/%d start condition and %d/%d character class hash slots used\n"),
+		 ndtbl.used, ndtbl.size, sctbl.used, sctbl.size,
+		 ccltab.used, ccltab.size);
+	fprintf (file, _("  %d/%d interned name slots used\n"),
+		 strtbl.used, strtbl.size);
+}
+
+
+/* symtab_reset - empty the symbol tables for another run
+ *
+ * The names, scname's among them, all belong to strtbl and go with it.
+ */
+
+void    symtab_reset (void)
+{
+	struct hash_table *tables[4];
+	int     i, t;
+
+	tables[0] = &ndtbl;
+	tables[1] = &sctbl;
+	tables[2] = &ccltab;
+	tables[3] = &strtbl;
+
+	for (t = 0; t < 4; ++t) {
+		for (i = 0; i < tables[t]->size; ++i) {
+			if (tables[t] == &strtbl)
+				free (tables[t]->slots[i].name);
+			free (tables[t]->slots[i].str_val);
+		}
+		free (tables[t]->slots);
+		tables[t]->slots = NULL;
+		tables[t]->size = tables[t]->used = 0;
+	}
 }
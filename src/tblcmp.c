@@ -43,6 +43,476 @@ void mv2front(int);
 int tbldiff(int[], int, int[]);
 
 
+/* Occupancy bitmap of chk[] while the tables are being built: bit p is
+ * set if chk[p] is non-zero.  It lets the searches for free table space
+ * test 64 slots at a time.  Slots past the end of the map are free.
+ */
+static uint64_t *chkmap;
+static int chkmap_words;
+
+#define CHKMAP_BIT(pos) (UINT64_C (1) << ((pos) & 63))
+
+/* Words in a mask of the slots one state needs; see find_mask_space(). */
+#define CHKMAP_MASK_WORDS ((CSIZE + 2) / 64 + 1)
+
+/* Slots only ever fill up while the tables are being built, so once a
+ * search for room for some set of slots has failed at a base, a later
+ * search for the same set fails there too.  find_mask_space() remembers
+ * the range of bases each recent set was searched over, and skips it
+ * if a later search starts inside it.  Large scanners have thousands of
+ * states with the same shape, which otherwise search the whole table
+ * one after another.  chkmap_epoch is bumped whenever chk[] is cleared.
+ */
+
+#define MASK_MEMO_SIZE 1024
+
+struct mask_memo {
+	int     epoch, nwords;
+	int     start, base;	/* bases start .. base - 1 don't fit */
+	uint64_t mask[CHKMAP_MASK_WORDS];
+};
+
+static struct mask_memo mask_memo[MASK_MEMO_SIZE];
+static int chkmap_epoch;
+
+
+/* With -Cp, states aren't placed in nxt/chk as they're made.  mkentry(),
+ * stack1() and place_state() queue them instead, and once they all exist
+ * pack_tables() places them, trying several orders and keeping the one
+ * which gives the smallest table.
+ */
+
+enum pack_kind { PACK_ENTRY, PACK_ONE, PACK_FULL };
+
+struct pack_entry {
+	enum pack_kind kind;
+	int    *state;		/* copy of the transitions, for PACK_ENTRY/FULL */
+	int     numchars, statenum, deflink, totaltrans;
+	int     sym, nextstate;	/* for PACK_ONE */
+	int     slots;		/* number of nxt/chk slots it takes */
+	int     span;		/* distance from its first slot to its last */
+	int     seq;		/* position in the order the states were made */
+};
+
+static struct pack_entry *pack_queue;
+static int pack_queue_len, pack_queue_max;
+static bool pack_deferring;
+
+
+/* Settings which steer bldtbl()'s choice between protos, templates and
+ * plain entries.  inittbl() starts them at the *_PERCENTAGE values in
+ * flexdef.h; --tune-tables tries others.
+ */
+
+struct tbl_tuning {
+	int     proto_size, check_com, first_match_diff;
+	int     acceptable_diff, template_same, new_proto_diff;
+	bool    proto_index;	/* search all the protos, not just the queue */
+};
+
+static struct tbl_tuning tuning;
+
+
+/* With --tune-tables, bldtbl() and stack1() only record the states they
+ * are given.  tune_tables() then builds the tables from the recording
+ * with each of tune_settings[], reports the sizes, and rebuilds them
+ * with the settings which gave the smallest.  A row with no state is
+ * the end-of-buffer state, which goes straight to stack1().
+ */
+
+struct tune_row {
+	int    *state;
+	int     statenum, totaltrans, comstate, comfreq;
+};
+
+static struct tune_row *tune_rows;
+static int tune_rows_len, tune_rows_max;
+static bool tune_recording;
+
+/* The first two are flex's usual settings; the rest did best across the
+ * scanners we tried them on.  proto_size, check_com, first_match_diff,
+ * acceptable_diff, template_same, new_proto_diff and proto_index, in
+ * that order.
+ */
+static const struct tbl_tuning tune_settings[] = {
+	{PROTO_SIZE_PERCENTAGE, CHECK_COM_PERCENTAGE,
+	 FIRST_MATCH_DIFF_PERCENTAGE, ACCEPTABLE_DIFF_PERCENTAGE,
+	 TEMPLATE_SAME_PERCENTAGE, NEW_PROTO_DIFF_PERCENTAGE, false},
+	{PROTO_SIZE_PERCENTAGE, CHECK_COM_PERCENTAGE,
+	 FIRST_MATCH_DIFF_PERCENTAGE, ACCEPTABLE_DIFF_PERCENTAGE,
+	 TEMPLATE_SAME_PERCENTAGE, NEW_PROTO_DIFF_PERCENTAGE, true},
+	{15, 50, 10, 70, 60, 20, true},
+	{15, 50, 10, 50, 80, 10, true},
+	{5, 50, 10, 50, 80, 20, true},
+	{5, 50, 10, 70, 80, 20, true},
+	{30, 50, 10, 70, 60, 10, true},
+	{30, 50, 10, 70, 80, 10, true},
+	{30, 50, 10, 30, 60, 20, true},
+};
+
+
+/* With --proto-index, every proto made is kept, not just the MSP on the
+ * proto queue, so that bldtbl() can find the closest one however long
+ * ago it was made.  The equivalence classes are split into PROTO_BANDS
+ * bands, and each proto is hashed on the transitions in each band.  A
+ * proto which differs from a state in fewer than PROTO_BANDS places
+ * has at least one band identical to the state's, so it is usually
+ * among the protos hashed to the same buckets as the state.  Bands with
+ * no transitions at all match too much to be worth hashing.
+ */
+
+#define PROTO_BANDS 8
+#define PROTO_PROBES 16		/* protos compared per band and state */
+
+static int *protidx_tbl;	/* numecs transitions per proto */
+static int *protidx_state, *protidx_seen;
+static int protidx_len, protidx_max, protidx_bands, protidx_query;
+static unsigned int *protidx_key;	/* one per proto and band */
+static int *protidx_next;	/* chains of entries in the same bucket */
+static int *protidx_head, protidx_mask;
+
+
+/* pack_append - add a state to the -Cp queue
+ *
+ * state[0 .. numchars] is copied if state isn't NULL.  The caller fills
+ * in the rest of the entry.
+ */
+
+static struct pack_entry *pack_append (enum pack_kind kind, int *state, int numchars)
+{
+	struct pack_entry *e;
+
+	if (pack_queue_len >= pack_queue_max) {
+		pack_queue_max = pack_queue_max * 2 + 256;
+		pack_queue = reallocate_array (pack_queue, pack_queue_max,
+					       sizeof (struct pack_entry));
+	}
+
+	e = &pack_queue[pack_queue_len];
+	memset (e, 0, sizeof (*e));
+	e->kind = kind;
+	e->seq = pack_queue_len++;
+
+	if (state) {
+		e->state = allocate_integer_array (numchars + 1);
+		memcpy (e->state, state, (size_t) (numchars + 1) * sizeof (int));
+	}
+
+	return e;
+}
+
+
+/* mark_chk - record that chk[pos] is in use */
+
+static void mark_chk (int pos)
+{
+	chkmap[pos >> 6] |= CHKMAP_BIT (pos);
+}
+
+
+/* chkmap_window - the occupancy bits of chk[pos] .. chk[pos + 63] */
+
+static uint64_t chkmap_window (int pos)
+{
+	int     word = pos >> 6, shift = pos & 63;
+	uint64_t lo, hi;
+
+	lo = word < chkmap_words ? chkmap[word] : 0;
+
+	if (shift == 0)
+		return lo;
+
+	hi = word + 1 < chkmap_words ? chkmap[word + 1] : 0;
+
+	return (lo >> shift) | (hi << (64 - shift));
+}
+
+
+/* next_free_slot - first position at or after pos with chk[] == 0 */
+
+static int next_free_slot (int pos)
+{
+	int     word = pos >> 6;
+	uint64_t avail;
+
+	if (word >= chkmap_words)
+		return pos;
+
+	avail = ~chkmap[word] & (~UINT64_C (0) << (pos & 63));
+
+	while (avail == 0) {
+		if (++word >= chkmap_words)
+			return word * 64;
+
+		avail = ~chkmap[word];
+	}
+
+	return word * 64 + lowest_bit (avail);
+}
+
+
+/* find_mask_space - find room in chk[] for a set of slots
+ *
+ * Bit k of mask[0 .. nwords - 1] is set if the state being placed needs
+ * the slot at offset k from its base.  Returns the first base at or
+ * after pos for which all those slots are free.  Bit 0 must be set.
+ *
+ * The bases are tried 64 at a time: bit b of "fits" stays set while
+ * every slot needed so far is free for base pos + b.
+ */
+
+static int find_mask_space (int pos, uint64_t mask[], int nwords)
+{
+	int     offsets[CHKMAP_MASK_WORDS * 64], noffsets = 0, k;
+	uint64_t fits, m, h = (uint64_t) nwords;
+	struct mask_memo *memo;
+	int     start = pos;
+
+	for (k = 0; k < nwords; ++k) {
+		h = (h ^ mask[k]) * UINT64_C (0x9e3779b97f4a7c15);
+
+		for (m = mask[k]; m != 0; m &= m - 1)
+			offsets[noffsets++] = 64 * k + lowest_bit (m);
+	}
+
+	memo = &mask_memo[(h >> 32) % MASK_MEMO_SIZE];
+
+	if (memo->epoch == chkmap_epoch && memo->nwords == nwords &&
+	    memcmp (memo->mask, mask, (size_t) nwords * sizeof (uint64_t)) == 0 &&
+	    pos >= memo->start && pos < memo->base) {
+		start = memo->start;
+		pos = memo->base;
+	}
+
+	for (;;) {
+		/* The base itself must be free. */
+		pos = next_free_slot (pos);
+		fits = ~UINT64_C (0);
+
+		for (k = 0; k < noffsets && fits != 0; ++k)
+			fits &= ~chkmap_window (pos + offsets[k]);
+
+		if (fits != 0)
+			break;
+
+		pos += 64;
+	}
+
+	pos += lowest_bit (fits);
+
+	memo->epoch = chkmap_epoch;
+	memo->nwords = nwords;
+	memo->start = start;
+	memo->base = pos;
+	memcpy (memo->mask, mask, (size_t) nwords * sizeof (uint64_t));
+
+	return pos;
+}
+
+
+/* protidx_band_key - hash the transitions of state[] in one band
+ *
+ * Returns 0 if none of them is a transition.
+ */
+
+static unsigned int protidx_band_key (int state[], int band)
+{
+	int     lo = 1 + band * numecs / protidx_bands;
+	int     hi = (band + 1) * numecs / protidx_bands;
+	uint32_t h = UINT32_C (2166136261) ^ (uint32_t) band;
+	bool    any = false;
+	int     i;
+
+	for (i = lo; i <= hi; ++i) {
+		if (state[i] != 0)
+			any = true;
+
+		h = (h ^ (uint32_t) state[i]) * UINT32_C (16777619);
+	}
+
+	if (!any)
+		return 0;
+
+	h ^= h >> 15;
+
+	return h ? h : 1;
+}
+
+
+/* protidx_rehash - rebuild the --proto-index with "size" buckets */
+
+static void protidx_rehash (int size)
+{
+	int     e;
+
+	free (protidx_head);
+	protidx_head = allocate_integer_array (size);
+	protidx_mask = size - 1;
+
+	for (e = 0; e < size; ++e)
+		protidx_head[e] = -1;
+
+	/* Later protos go in front of earlier ones in each bucket. */
+	for (e = 0; e < protidx_len * protidx_bands; ++e)
+		if (protidx_key[e] != 0) {
+			protidx_next[e] =
+				protidx_head[protidx_key[e] & (unsigned int) protidx_mask];
+			protidx_head[protidx_key[e] & (unsigned int) protidx_mask] = e;
+		}
+}
+
+
+/* protidx_add - add a new proto to the --proto-index */
+
+static void protidx_add (int state[], int statenum)
+{
+	int     n = protidx_len, b, e;
+
+	if (n >= protidx_max) {
+		protidx_max = protidx_max * 2 + 64;
+		protidx_tbl = reallocate_integer_array (protidx_tbl,
+							protidx_max * numecs);
+		protidx_state = reallocate_integer_array (protidx_state,
+							  protidx_max);
+		protidx_seen = reallocate_integer_array (protidx_seen,
+							 protidx_max);
+		protidx_key = reallocate_array (protidx_key,
+						protidx_max * protidx_bands,
+						sizeof (unsigned int));
+		protidx_next = reallocate_integer_array (protidx_next,
+							 protidx_max * protidx_bands);
+	}
+
+	if ((n + 1) * protidx_bands > protidx_mask)
+		protidx_rehash ((protidx_mask + 1) * 2);
+
+	memcpy (&protidx_tbl[n * numecs], &state[1],
+		(size_t) numecs * sizeof (int));
+	protidx_state[n] = statenum;
+	protidx_seen[n] = 0;
+	++protidx_len;
+
+	for (b = 0; b < protidx_bands; ++b) {
+		e = n * protidx_bands + b;
+		protidx_key[e] = protidx_band_key (state, b);
+
+		if (protidx_key[e] != 0) {
+			protidx_next[e] =
+				protidx_head[protidx_key[e] & (unsigned int) protidx_mask];
+			protidx_head[protidx_key[e] & (unsigned int) protidx_mask] = e;
+		}
+	}
+}
+
+
+/* protidx_diff - count the differences between state[] and indexed proto
+ *
+ * Counting stops once it reaches "limit".
+ */
+
+static int protidx_diff (int state[], int pr, int limit)
+{
+	int    *protp = &protidx_tbl[pr * numecs];
+	int     i, numdiff = 0;
+
+	for (i = 1; i <= numecs && numdiff < limit; ++i)
+		if (protp[i - 1] != state[i])
+			++numdiff;
+
+	return numdiff;
+}
+
+
+/* protidx_find - find the indexed proto closest to state[]
+ *
+ * Only protos differing from state[] in fewer than "mindiff" places are
+ * of interest.  Returns -1 if no such proto turns up.
+ */
+
+static int protidx_find (int state[], int mindiff)
+{
+	unsigned int key;
+	int     b, e, pr, d, probes, best = -1;
+
+	++protidx_query;
+
+	for (b = 0; b < protidx_bands; ++b) {
+		if ((key = protidx_band_key (state, b)) == 0)
+			continue;
+
+		probes = 0;
+
+		for (e = protidx_head[key & (unsigned int) protidx_mask];
+		     e >= 0 && probes < PROTO_PROBES; e = protidx_next[e]) {
+			if (protidx_key[e] != key)
+				continue;
+
+			++probes;
+			pr = e / protidx_bands;
+
+			if (protidx_seen[pr] == protidx_query)
+				continue;
+
+			protidx_seen[pr] = protidx_query;
+			d = protidx_diff (state, pr, mindiff);
+
+			if (d < mindiff) {
+				mindiff = d;
+				best = pr;
+			}
+		}
+	}
+
+	return best;
+}
+
+
+/* protidx_tbldiff - tbldiff() for a proto found by protidx_find() */
+
+static int protidx_tbldiff (int state[], int pr, int ext[])
+{
+	int    *protp = &protidx_tbl[pr * numecs];
+	int     i, numdiff = 0;
+
+	for (i = 1; i <= numecs; ++i)
+		if (protp[i - 1] == state[i])
+			ext[i] = SAME_TRANS;
+		else {
+			ext[i] = state[i];
+			++numdiff;
+		}
+
+	return numdiff;
+}
+
+
+/* tune_record - record a state for --tune-tables */
+
+static void tune_record (int state[], int statenum, int totaltrans,
+			 int comstate, int comfreq)
+{
+	struct tune_row *r;
+
+	if (tune_rows_len >= tune_rows_max) {
+		tune_rows_max = tune_rows_max * 2 + 256;
+		tune_rows = reallocate_array (tune_rows, tune_rows_max,
+					      sizeof (struct tune_row));
+	}
+
+	r = &tune_rows[tune_rows_len++];
+	r->state = NULL;
+	r->statenum = statenum;
+	r->totaltrans = totaltrans;
+	r->comstate = comstate;
+	r->comfreq = comfreq;
+
+	if (state) {
+		r->state = allocate_integer_array (numecs + 1);
+		memcpy (r->state, state, (size_t) (numecs + 1) * sizeof (int));
+	}
+}
+
+
 /* bldtbl - build table entries for dfa state
  *
  * synopsis
@@ -81,7 +551,12 @@ int tbldiff(int[], int, int[]);
 void    bldtbl (int state[], int statenum, int totaltrans, int comstate, int comfreq)
 {
 	int     extptr, extrct[2][CSIZE + 1];
-	int     mindiff, minprot, i, d;
+	int     mindiff, minprot, i, d, idxprot = -1;
+
+	if (tune_recording) {
+		tune_record (state, statenum, totaltrans, comstate, comfreq);
+		return;
+	}
 
 	/* If extptr is 0 then the first array of extrct holds the result
 	 * of the "best difference" to date, which is those transitions
@@ -99,7 +574,7 @@ void    bldtbl (int state[], int statenum, int totaltrans, int comstate, int com
 	 * compact its tables.
 	 */
 
-	if ((totaltrans * 100) < (numecs * PROTO_SIZE_PERCENTAGE))
+	if ((totaltrans * 100) < (numecs * tuning.proto_size))
 		mkentry (state, numecs, statenum, JAMSTATE, totaltrans);
 
 	else {
@@ -108,7 +583,7 @@ void    bldtbl (int state[], int statenum, int totaltrans, int comstate, int com
 		 */
 		int     checkcom =
 
-			comfreq * 100 > totaltrans * CHECK_COM_PERCENTAGE;
+			comfreq * 100 > totaltrans * tuning.check_com;
 
 		minprot = firstprot;
 		mindiff = totaltrans;
@@ -147,7 +622,7 @@ void    bldtbl (int state[], int statenum, int totaltrans, int comstate, int com
 		 */
 
 		if (mindiff * 100 >
-		    totaltrans * FIRST_MATCH_DIFF_PERCENTAGE) {
+		    totaltrans * tuning.first_match_diff) {
 			/* Not a good enough match.  Scan the rest of the
 			 * protos.
 			 */
@@ -161,19 +636,31 @@ void    bldtbl (int state[], int statenum, int totaltrans, int comstate, int com
 			}
 		}
 
+		/* The proto queue only holds the protos used most recently.
+		 * If none of them matched well, try all the others.
+		 */
+
+		if (tuning.proto_index &&
+		    mindiff * 100 > totaltrans * tuning.first_match_diff &&
+		    (idxprot = protidx_find (state, mindiff)) >= 0) {
+			extptr = 1 - extptr;
+			mindiff = protidx_tbldiff (state, idxprot,
+						   extrct[extptr]);
+		}
+
 		/* Check if the proto we've decided on as our best bet is close
 		 * enough to the state we want to match to be usable.
 		 */
 
 		if (mindiff * 100 >
-		    totaltrans * ACCEPTABLE_DIFF_PERCENTAGE) {
+		    totaltrans * tuning.acceptable_diff) {
 			/* No good.  If the state is homogeneous enough,
 			 * we make a template out of it.  Otherwise, we
 			 * make a proto.
 			 */
 
 			if (comfreq * 100 >=
-			    totaltrans * TEMPLATE_SAME_PERCENTAGE)
+			    totaltrans * tuning.template_same)
 					mktemplate (state, statenum,
 						    comstate);
 
@@ -186,6 +673,7 @@ void    bldtbl (int state[], int statenum, int totaltrans, int comstate, int com
 
 		else {		/* use the proto */
 			mkentry (extrct[extptr], numecs, statenum,
+				 idxprot >= 0 ? protidx_state[idxprot] :
 				 prottbl[minprot], mindiff);
 
 			/* If this state was sufficiently different from the
@@ -193,7 +681,7 @@ void    bldtbl (int state[], int statenum, int totaltrans, int comstate, int com
 			 */
 
 			if (mindiff * 100 >=
-			    totaltrans * NEW_PROTO_DIFF_PERCENTAGE)
+			    totaltrans * tuning.new_proto_diff)
 					mkprot (state, statenum, comstate);
 
 			/* Since mkprot added a new proto to the proto queue,
@@ -206,7 +694,10 @@ void    bldtbl (int state[], int statenum, int totaltrans, int comstate, int com
 			 * following call will do nothing.
 			 */
 
-			mv2front (minprot);
+			if (idxprot >= 0)
+				++proto_index_uses;
+			else
+				mv2front (minprot);
 		}
 	}
 }
@@ -290,16 +781,27 @@ void    cmptmps (void)
 
 void    expand_nxt_chk (void)
 {
-	int old_max = current_max_xpairs;
+	int old_max = current_max_xpairs, old_words = chkmap_words;
 
-	current_max_xpairs += MAX_XPAIRS_INCREMENT;
+	/* Grow geometrically, so that a big table doesn't cost a
+	 * reallocation every MAX_XPAIRS_INCREMENT entries.
+	 */
+	current_max_xpairs += MAX (MAX_XPAIRS_INCREMENT, current_max_xpairs / 2);
 
 	++num_reallocs;
 
 	nxt = reallocate_integer_array (nxt, current_max_xpairs);
 	chk = reallocate_integer_array (chk, current_max_xpairs);
 
-	memset(chk + old_max, 0, MAX_XPAIRS_INCREMENT * sizeof(int));
+	memset(chk + old_max, 0, (size_t) (current_max_xpairs - old_max) * sizeof(int));
+
+	if (chkmap) {
+		chkmap_words = current_max_xpairs / 64 + 1;
+		chkmap = reallocate_array (chkmap, chkmap_words,
+					   sizeof (uint64_t));
+		memset (chkmap + old_words, 0,
+			(size_t) (chkmap_words - old_words) * sizeof (uint64_t));
+	}
 }
 
 
@@ -327,9 +829,8 @@ int     find_table_space (int *state, int numtrans)
 	/* Firstfree is the position of the first possible occurrence of two
 	 * consecutive unused records in the chk and nxt arrays.
 	 */
-	int i;
-	int *state_ptr, *chk_ptr;
-	int *ptr_to_last_entry_in_state;
+	int i, j, nwords;
+	uint64_t mask[CHKMAP_MASK_WORDS];
 
 	/* If there are too many out-transitions, put the state at the end of
 	 * nxt and chk.
@@ -344,7 +845,7 @@ int     find_table_space (int *state, int numtrans)
 		/* Start searching for table space near the end of
 		 * chk/nxt arrays.
 		 */
-		i = tblend - numecs;
+		i = MAX (tblend - numecs, 1);
 	}
 
 	else
@@ -354,60 +855,32 @@ int     find_table_space (int *state, int numtrans)
 		 */
 		i = firstfree;
 
-	while (1) {		/* loops until a space is found */
-		while (i + numecs >= current_max_xpairs)
-			expand_nxt_chk ();
-
-		/* Loops until space for end-of-buffer and action number
-		 * are found.
-		 */
-		while (1) {
-			/* Check for action number space. */
-			if (chk[i - 1] == 0) {
-				/* Check for end-of-buffer space. */
-				if (chk[i] == 0)
-					break;
-
-				else
-					/* Since i != 0, there is no use
-					 * checking to see if (++i) - 1 == 0,
-					 * because that's the same as i == 0,
-					 * so we skip a space.
-					 */
-					i += 2;
-			}
-
-			else
-				++i;
+	/* The state needs [i - 1] for the action number, [i] for the
+	 * end-of-buffer transition and [i + j] for each transition on j.
+	 */
+	nwords = (numecs + 1) / 64 + 1;
 
-			while (i + numecs >= current_max_xpairs)
-				expand_nxt_chk ();
-		}
+	for (j = 0; j < nwords; ++j)
+		mask[j] = 0;
 
-		/* If we started search from the beginning, store the new
-		 * firstfree for the next call of find_table_space().
-		 */
-		if (numtrans <= MAX_XTIONS_FULL_INTERIOR_FIT)
-			firstfree = i + 1;
+	mask[0] = CHKMAP_BIT (0) | CHKMAP_BIT (1);
 
-		/* Check to see if all elements in chk (and therefore nxt)
-		 * that are needed for the new state have not yet been taken.
-		 */
+	for (j = 1; j <= numecs; ++j)
+		if (state[j] != 0)
+			mask[(j + 1) >> 6] |= CHKMAP_BIT (j + 1);
 
-		state_ptr = &state[1];
-		ptr_to_last_entry_in_state = &chk[i + numecs + 1];
+	i = find_mask_space (i - 1, mask, nwords) + 1;
 
-		for (chk_ptr = &chk[i + 1];
-		     chk_ptr != ptr_to_last_entry_in_state; ++chk_ptr)
-			if (*(state_ptr++) != 0 && *chk_ptr != 0)
-				break;
+	while (i + numecs >= current_max_xpairs)
+		expand_nxt_chk ();
 
-		if (chk_ptr == ptr_to_last_entry_in_state)
-			return i;
+	/* If we started search from the beginning, store the new
+	 * firstfree for the next call of find_table_space().
+	 */
+	if (numtrans <= MAX_XTIONS_FULL_INTERIOR_FIT)
+		firstfree = i + 1;
 
-		else
-			++i;
-	}
+	return i;
 }
 
 
@@ -422,10 +895,32 @@ void    inittbl (void)
 
 	memset(chk, 0, (size_t) current_max_xpairs * sizeof(int));
 
+	chkmap_words = current_max_xpairs / 64 + 1;
+	++chkmap_epoch;
+	free (chkmap);
+	chkmap = allocate_array (chkmap_words, sizeof (uint64_t));
+	memset (chkmap, 0, (size_t) chkmap_words * sizeof (uint64_t));
+
 	tblend = 0;
 	firstfree = tblend + 1;
 	numtemps = 0;
 
+	pack_deferring = env.pack && !ctrl.fulltbl;
+
+	tuning.proto_size = PROTO_SIZE_PERCENTAGE;
+	tuning.check_com = CHECK_COM_PERCENTAGE;
+	tuning.first_match_diff = FIRST_MATCH_DIFF_PERCENTAGE;
+	tuning.acceptable_diff = ACCEPTABLE_DIFF_PERCENTAGE;
+	tuning.template_same = TEMPLATE_SAME_PERCENTAGE;
+	tuning.new_proto_diff = NEW_PROTO_DIFF_PERCENTAGE;
+	tuning.proto_index = env.proto_index;
+
+	protidx_len = 0;
+	protidx_bands = MIN (PROTO_BANDS, numecs);
+	protidx_rehash (1024);
+
+	tune_recording = env.tune_tables && !ctrl.fulltbl && !ctrl.fullspd;
+
 	if (ctrl.usemecs) {
 		/* Set up doubly-linked meta-equivalence classes; these
 		 * are sets of equivalence classes which all have identical
@@ -444,6 +939,41 @@ void    inittbl (void)
 }
 
 
+/* freetbl - release the tables that are only needed while compressing
+ *
+ * The --proto-index grows with the protos across inittbl() calls, so it
+ * is freed here, once the tables are complete.  So is whatever --pack or
+ * --tune-tables still holds when an error ends the run.
+ */
+void    freetbl (void)
+{
+	int     i;
+
+	for (i = 0; i < pack_queue_len; ++i)
+		free (pack_queue[i].state);
+	free (pack_queue);
+	pack_queue = NULL;
+	pack_queue_len = pack_queue_max = 0;
+
+	for (i = 0; i < tune_rows_len; ++i)
+		free (tune_rows[i].state);
+	free (tune_rows);
+	tune_rows = NULL;
+	tune_rows_len = tune_rows_max = 0;
+
+	free (protidx_tbl);
+	free (protidx_state);
+	free (protidx_seen);
+	free (protidx_key);
+	free (protidx_next);
+	free (protidx_head);
+	protidx_tbl = protidx_state = protidx_seen = NULL;
+	protidx_key = NULL;
+	protidx_next = protidx_head = NULL;
+	protidx_len = protidx_max = protidx_mask = 0;
+}
+
+
 /* mkdeftbl - make the default, "jam" table entries */
 
 void    mkdeftbl (void)
@@ -460,10 +990,12 @@ void    mkdeftbl (void)
 	/* Add in default end-of-buffer transition. */
 	nxt[tblend] = end_of_buffer_state;
 	chk[tblend] = jamstate;
+	mark_chk (tblend);
 
 	for (i = 1; i <= numecs; ++i) {
 		nxt[tblend + i] = 0;
 		chk[tblend + i] = jamstate;
+		mark_chk (tblend + i);
 	}
 
 	jambase = tblend;
@@ -499,7 +1031,8 @@ void    mkentry (int *state, int numchars, int statenum, int deflink,
 		 int totaltrans)
 {
 	int minec, maxec, i, baseaddr;
-	int tblbase, tbllast;
+	int tblbase, tbllast, nwords;
+	uint64_t mask[CHKMAP_MASK_WORDS];
 
 	if (totaltrans == 0) {	/* there are no out-transitions */
 		if (deflink == JAMSTATE)
@@ -531,6 +1064,23 @@ void    mkentry (int *state, int numchars, int statenum, int deflink,
 				break;
 	}
 
+	if (pack_deferring) {
+		struct pack_entry *e = pack_append (PACK_ENTRY, state, numchars);
+
+		e->numchars = numchars;
+		e->statenum = statenum;
+		e->deflink = deflink;
+		e->totaltrans = totaltrans;
+		e->span = maxec - minec + 1;
+
+		for (i = minec; i <= maxec; ++i)
+			if (state[i] != SAME_TRANS &&
+			    (state[i] != 0 || deflink != JAMSTATE))
+				++e->slots;
+
+		return;
+	}
+
 	/* Whether we try to fit the state table in the middle of the table
 	 * entries we have already generated, or if we just take the state
 	 * table at the end of the nxt/chk tables, we must make sure that we
@@ -542,37 +1092,26 @@ void    mkentry (int *state, int numchars, int statenum, int deflink,
 
 	/* Find the first transition of state that we need to worry about. */
 	if (totaltrans * 100 <= numchars * INTERIOR_FIT_PERCENTAGE) {
-		/* Attempt to squeeze it into the middle of the tables. */
-		baseaddr = firstfree;
-
-		while (baseaddr < minec) {
-			/* Using baseaddr would result in a negative base
-			 * address below; find the next free slot.
-			 */
-			for (++baseaddr; chk[baseaddr] != 0; ++baseaddr) ;
-		}
+		/* Attempt to squeeze it into the middle of the tables.
+		 * Bit i - minec of the mask is set if the state needs
+		 * [baseaddr + i - minec].  Using a baseaddr below minec
+		 * would result in a negative base address.
+		 */
+		nwords = (maxec - minec) / 64 + 1;
 
-		while (baseaddr + maxec - minec + 1 >= current_max_xpairs)
-			expand_nxt_chk ();
+		for (i = 0; i < nwords; ++i)
+			mask[i] = 0;
 
 		for (i = minec; i <= maxec; ++i)
 			if (state[i] != SAME_TRANS &&
-			    (state[i] != 0 || deflink != JAMSTATE) &&
-			    chk[baseaddr + i - minec] != 0) {	/* baseaddr unsuitable - find another */
-				for (++baseaddr;
-				     baseaddr < current_max_xpairs &&
-				     chk[baseaddr] != 0; ++baseaddr) ;
-
-				while (baseaddr + maxec - minec + 1 >=
-				       current_max_xpairs)
-						expand_nxt_chk ();
-
-				/* Reset the loop counter so we'll start all
-				 * over again next time it's incremented.
-				 */
+			    (state[i] != 0 || deflink != JAMSTATE))
+				mask[(i - minec) >> 6] |= CHKMAP_BIT (i - minec);
 
-				i = minec - 1;
-			}
+		baseaddr = find_mask_space (MAX (firstfree, minec), mask,
+					    nwords);
+
+		while (baseaddr + maxec - minec + 1 >= current_max_xpairs)
+			expand_nxt_chk ();
 	}
 
 	else {
@@ -596,11 +1135,12 @@ void    mkentry (int *state, int numchars, int statenum, int deflink,
 			if (state[i] != 0 || deflink != JAMSTATE) {
 				nxt[tblbase + i] = state[i];
 				chk[tblbase + i] = statenum;
+				mark_chk (tblbase + i);
 			}
 
 	if (baseaddr == firstfree)
 		/* Find next free slot in tables. */
-		for (++firstfree; chk[firstfree] != 0; ++firstfree) ;
+		firstfree = next_free_slot (firstfree + 1);
 
 	tblend = MAX (tblend, tbllast);
 }
@@ -615,13 +1155,15 @@ void    mk1tbl (int state, int sym, int onenxt, int onedef)
 	if (firstfree < sym)
 		firstfree = sym;
 
-	while (chk[firstfree] != 0)
-		if (++firstfree >= current_max_xpairs)
-			expand_nxt_chk ();
+	firstfree = next_free_slot (firstfree);
+
+	while (firstfree >= current_max_xpairs)
+		expand_nxt_chk ();
 
 	base[state] = firstfree - sym;
 	def[state] = onedef;
 	chk[firstfree] = state;
+	mark_chk (firstfree);
 	nxt[firstfree] = onenxt;
 
 	if (firstfree > tblend) {
@@ -665,6 +1207,9 @@ void    mkprot (int state[], int statenum, int comstate)
 
 	for (i = 1; i <= numecs; ++i)
 		protsave[tblbase + i] = state[i];
+
+	if (tuning.proto_index)
+		protidx_add (state, statenum);
 }
 
 
@@ -743,6 +1288,143 @@ void    mv2front (int qelm)
 }
 
 
+/* pack_by_slots - qsort() order for -Cp: most slots first */
+
+static int pack_by_slots (const void *a, const void *b)
+{
+	const struct pack_entry *x = *(struct pack_entry * const *) a;
+	const struct pack_entry *y = *(struct pack_entry * const *) b;
+
+	if (x->slots != y->slots)
+		return y->slots - x->slots;
+
+	return x->seq - y->seq;
+}
+
+
+/* pack_by_span - qsort() order for -Cp: widest first */
+
+static int pack_by_span (const void *a, const void *b)
+{
+	const struct pack_entry *x = *(struct pack_entry * const *) a;
+	const struct pack_entry *y = *(struct pack_entry * const *) b;
+
+	if (x->span != y->span)
+		return y->span - x->span;
+
+	return pack_by_slots (a, b);
+}
+
+
+/* pack_pass - place the queued states in the given order
+ *
+ * Starts over with empty nxt/chk tables.  Returns the resulting tblend.
+ */
+
+static int pack_pass (struct pack_entry *order[], int n)
+{
+	struct pack_entry *e;
+	int     i;
+
+	memset (chk, 0, (size_t) current_max_xpairs * sizeof (int));
+	memset (chkmap, 0, (size_t) chkmap_words * sizeof (uint64_t));
+	++chkmap_epoch;
+	tblend = 0;
+	firstfree = tblend + 1;
+
+	for (i = 0; i < n; ++i) {
+		e = order[i];
+
+		switch (e->kind) {
+		case PACK_ENTRY:
+			mkentry (e->state, e->numchars, e->statenum,
+				 e->deflink, e->totaltrans);
+			break;
+
+		case PACK_ONE:
+			stack1 (e->statenum, e->sym, e->nextstate,
+				e->deflink);
+			break;
+
+		case PACK_FULL:
+			place_state (e->state, e->statenum, e->totaltrans);
+			break;
+		}
+	}
+
+	while (onesp > 0) {
+		mk1tbl (onestate[onesp], onesym[onesp], onenext[onesp],
+			onedef[onesp]);
+		--onesp;
+	}
+
+	return tblend;
+}
+
+
+/* pack_tables - place the states queued for -Cp
+ *
+ * The states are placed in the order they were made, then largest first
+ * ("first fit decreasing"), by the number of slots they take and by how
+ * widely those slots are spread.  The smallest result is kept, so -Cp
+ * never makes the tables bigger; pack_saved records the difference.
+ */
+
+void    pack_tables (void)
+{
+	static int (*const orders[]) (const void *, const void *) = {
+		NULL, pack_by_slots, pack_by_span
+	};
+	int     norders = (int) (sizeof (orders) / sizeof (orders[0]));
+	struct pack_entry **order, **best_order, **tmp;
+	int     n = pack_queue_len, i, p, size, best, best_size = 0;
+	int     unpacked = 0;
+
+	pack_deferring = false;
+
+	order = allocate_array (n + 1, sizeof (struct pack_entry *));
+	best_order = allocate_array (n + 1, sizeof (struct pack_entry *));
+	best = -1;
+
+	for (p = 0; p < norders; ++p) {
+		for (i = 0; i < n; ++i)
+			order[i] = &pack_queue[i];
+
+		if (orders[p])
+			qsort (order, (size_t) n, sizeof (order[0]), orders[p]);
+
+		size = pack_pass (order, n);
+
+		if (p == 0)
+			unpacked = size;
+
+		if (best < 0 || size < best_size) {
+			best = p;
+			best_size = size;
+			tmp = best_order;
+			best_order = order;
+			order = tmp;
+		}
+	}
+
+	/* The tables hold the last order tried; redo the best one. */
+	if (best != norders - 1)
+		pack_pass (best_order, n);
+
+	pack_saved = unpacked - best_size;
+	peakpairs = numtemps * numecs + tblend;
+
+	for (i = 0; i < n; ++i)
+		free (pack_queue[i].state);
+
+	free (pack_queue);
+	free (order);
+	free (best_order);
+	pack_queue = NULL;
+	pack_queue_len = pack_queue_max = 0;
+}
+
+
 /* place_state - place a state into full speed transition table
  *
  * State is the statenum'th state.  It is indexed by equivalence class and
@@ -754,7 +1436,19 @@ void    place_state (int *state, int statenum, int transnum)
 {
 	int i;
 	int *state_ptr;
-	int position = find_table_space (state, transnum);
+	int position;
+
+	if (pack_deferring) {
+		struct pack_entry *e = pack_append (PACK_FULL, state, numecs);
+
+		e->statenum = statenum;
+		e->totaltrans = transnum;
+		e->slots = transnum + 2;
+		e->span = numecs + 2;
+		return;
+	}
+
+	position = find_table_space (state, transnum);
 
 	/* "base" is the table of start positions. */
 	base[statenum] = position;
@@ -765,11 +1459,13 @@ void    place_state (int *state, int statenum, int transnum)
 	 * state.
 	 */
 	chk[position - 1] = 1;
+	mark_chk (position - 1);
 
 	/* Put in end-of-buffer marker; this is for the same purposes as
 	 * above.
 	 */
 	chk[position] = 1;
+	mark_chk (position);
 
 	/* Place the state into chk and nxt. */
 	state_ptr = &state[1];
@@ -777,6 +1473,7 @@ void    place_state (int *state, int statenum, int transnum)
 	for (i = 1; i <= numecs; ++i, ++state_ptr)
 		if (*state_ptr != 0) {
 			chk[position + i] = i;
+			mark_chk (position + i);
 			nxt[position + i] = *state_ptr;
 		}
 
@@ -794,7 +1491,23 @@ void    place_state (int *state, int statenum, int transnum)
 
 void    stack1 (int statenum, int sym, int nextstate, int deflink)
 {
-	if (onesp >= ONE_STACK_SIZE - 1)
+	if (tune_recording)
+		/* Only ntod() calls us directly, for the end-of-buffer
+		 * state.
+		 */
+		tune_record (NULL, statenum, 0, 0, 0);
+
+	else if (pack_deferring) {
+		struct pack_entry *e = pack_append (PACK_ONE, NULL, 0);
+
+		e->statenum = statenum;
+		e->sym = sym;
+		e->nextstate = nextstate;
+		e->deflink = deflink;
+		e->slots = e->span = 1;
+	}
+
+	else if (onesp >= ONE_STACK_SIZE - 1)
 		mk1tbl (statenum, sym, nextstate, deflink);
 
 	else {
@@ -839,3 +1552,106 @@ int     tbldiff (int state[], int pr, int ext[])
 
 	return numdiff;
 }
+
+
+/* tune_pass - build the tables from the --tune-tables recording
+ *
+ * If "measure" is true the tables are finished off, as ntod() would,
+ * and their size is returned.  Otherwise they're left for ntod().
+ */
+
+static int tune_pass (const struct tbl_tuning *t, bool measure)
+{
+	struct tune_row *r;
+	int     i;
+
+	inittbl ();
+	tuning = *t;
+	tune_recording = false;
+
+	numprots = 0;
+	firstprot = NIL;
+	lastprot = 1;
+	onesp = 0;
+	proto_index_uses = 0;
+
+	for (i = 0; i < tune_rows_len; ++i) {
+		r = &tune_rows[i];
+
+		if (r->state)
+			bldtbl (r->state, r->statenum, r->totaltrans,
+				r->comstate, r->comfreq);
+		else
+			stack1 (r->statenum, 0, 0, JAMSTATE);
+	}
+
+	if (!measure)
+		return 0;
+
+	cmptmps ();
+
+	if (env.pack)
+		pack_tables ();
+
+	while (onesp > 0) {
+		mk1tbl (onestate[onesp], onesym[onesp], onenext[onesp],
+			onedef[onesp]);
+		--onesp;
+	}
+
+	mkdeftbl ();
+
+	return tblend;
+}
+
+
+/* tune_tables - try the compression settings in tune_settings[]
+ *
+ * Reports the size of the tables each gives and leaves the tables
+ * built, as far as bldtbl() goes, with the best of them.  Ties go to
+ * the earlier settings, the first being flex's usual ones.
+ */
+
+void    tune_tables (void)
+{
+	int     nsettings =
+		(int) (sizeof (tune_settings) / sizeof (tune_settings[0]));
+	int     i, size, best = 0, best_size = 0;
+	const struct tbl_tuning *t;
+
+	if (!tune_recording)
+		return;
+
+	fputs (_("--tune-tables: nxt-chk entries for each setting\n"),
+	       flex_run->err);
+
+	for (i = 0; i < nsettings; ++i) {
+		t = &tune_settings[i];
+		size = tune_pass (t, true);
+
+		fprintf (flex_run->err,
+			 _
+			 ("  %d. proto-size %d%%, acceptable-diff %d%%, new-proto-diff %d%%, template-same %d%%, %s: %d\n"),
+			 i + 1, t->proto_size, t->acceptable_diff, t->new_proto_diff,
+			 t->template_same,
+			 t->proto_index ? "proto-index" : "noproto-index",
+			 size);
+
+		if (i == 0 || size < best_size) {
+			best = i;
+			best_size = size;
+		}
+	}
+
+	fprintf (flex_run->err, _("  using setting %d of %d\n"), best + 1,
+		 nsettings);
+
+	tune_pass (&tune_settings[best], false);
+
+	for (i = 0; i < tune_rows_len; ++i)
+		free (tune_rows[i].state);
+
+	free (tune_rows);
+	tune_rows = NULL;
+	tune_rows_len = tune_rows_max = 0;
+}
@@ -65,7 +65,7 @@ int     yylex (void)
 
 	if (env.trace) {
 		if (beglin) {
-			fprintf (stderr, "%d\t", num_rules + 1);
+			fprintf (flex_run->err, "%d\t", num_rules + 1);
 			beglin = 0;
 		}
 
@@ -90,11 +90,11 @@ int     yylex (void)
 		case '*':
 		case '+':
 		case ',':
-			(void) putc (toktype, stderr);
+			(void) putc (toktype, flex_run->err);
 			break;
 
 		case '\n':
-			(void) putc ('\n', stderr);
+			(void) putc ('\n', flex_run->err);
 
 			if (sectnum == 2)
 				beglin = 1;
@@ -102,15 +102,15 @@ int     yylex (void)
 			break;
 
 		case SCDECL:
-			fputs ("%s", stderr);
+			fputs ("%s", flex_run->err);
 			break;
 
 		case XSCDECL:
-			fputs ("%x", stderr);
+			fputs ("%x", flex_run->err);
 			break;
 
 		case SECTEND:
-			fputs ("%%\n", stderr);
+			fputs ("%%\n", flex_run->err);
 
 			/* We set beglin to be true so we'll start
 			 * writing out numbers as we echo rules.
@@ -122,7 +122,7 @@ int     yylex (void)
 			break;
 
 		case NAME:
-			fprintf (stderr, "'%s'", nmstr);
+			fprintf (flex_run->err, "'%s'", nmstr);
 			break;
 
 		case CHAR:
@@ -147,36 +147,36 @@ int     yylex (void)
 			case '*':
 			case '+':
 			case ',':
-				fprintf (stderr, "\\%c", yylval);
+				fprintf (flex_run->err, "\\%c", yylval);
 				break;
 
 			default:
 				if (!isascii (yylval) || !isprint (yylval)) {
 					if(env.trace_hex)
-						fprintf (stderr, "\\x%02x", (unsigned int) yylval);
+						fprintf (flex_run->err, "\\x%02x", (unsigned int) yylval);
 					else
-						fprintf (stderr, "\\%.3o", (unsigned int) yylval);
+						fprintf (flex_run->err, "\\%.3o", (unsigned int) yylval);
 				} else
-					(void) putc (yylval, stderr);
+					(void) putc (yylval, flex_run->err);
 				break;
 			}
 
 			break;
 
 		case NUMBER:
-			fprintf (stderr, "%d", yylval);
+			fprintf (flex_run->err, "%d", yylval);
 			break;
 
 		case PREVCCL:
-			fprintf (stderr, "[%d]", yylval);
+			fprintf (flex_run->err, "[%d]", yylval);
 			break;
 
 		case EOF_OP:
-			fprintf (stderr, "<<EOF>>");
+			fprintf (flex_run->err, "<<EOF>>");
 			break;
 
 		case TOK_OPTION:
-			fprintf (stderr, "%s ", yytext);
+			fprintf (flex_run->err, "%s ", yytext);
 			break;
 
 		case TOK_OUTFILE:
@@ -193,15 +193,15 @@ int     yylex (void)
 		case CCE_SPACE:
 		case CCE_UPPER:
 		case CCE_XDIGIT:
-			fprintf (stderr, "%s", yytext);
+			fprintf (flex_run->err, "%s", yytext);
 			break;
 
 		case 0:
-			fprintf (stderr, _("End Marker\n"));
+			fprintf (flex_run->err, _("End Marker\n"));
 			break;
 
 		default:
-			fprintf (stderr,
+			fprintf (flex_run->err,
 				 _
 				 ("*Something Weird* - tok: %d val: %d\n"),
 				 toktype, yylval);
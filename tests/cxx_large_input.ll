@@ -0,0 +1,67 @@
+/*
+ * This file is part of flex.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the University nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.
+ */
+
+%{
+/* A C++ scanner with %option large-input: yyleng is a ptrdiff_t, and
+ * the classes are in the inline namespace yy_large_input, so that
+ * sources disagreeing about YY_LARGE_INPUT cannot link together.
+ */
+#include <cstdlib>
+#include "config.h"
+
+static long total;
+%}
+
+%option 8bit prefix="test"
+%option warn c++ large-input
+%option nounput nomain noinput noyywrap
+
+%%
+
+[[:alpha:]]+	{ total += (long) yyleng; return 1; }
+.|\n		;
+
+%%
+
+int main(void);
+
+int
+main (void)
+{
+    yyFlexLexer f;
+    yy_large_input::FlexLexer *base = &f;
+
+    if (sizeof(yy_len_t) != sizeof(std::ptrdiff_t)) {
+        std::cerr << "yy_len_t is not a ptrdiff_t\n";
+        return 1;
+    }
+    f.switch_streams(&std::cin, &std::cout);
+    while (base->yylex() != 0)
+        ;
+    if (total != 24) {
+        std::cerr << total << " letters, expected 24\n";
+        return 1;
+    }
+    std::cout << "TEST RETURNING OK." << std::endl;
+    return 0;
+}
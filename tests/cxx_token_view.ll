@@ -0,0 +1,72 @@
+/*
+ * This file is part of flex.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * Neither the name of the University nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.
+ */
+
+%{
+/* Scan with %option token-view in a C++ scanner: YYText() and yytext in
+ * an action are the NUL-terminated copy of the token; outside the
+ * actions YYText() points into the input buffer.
+ */
+#include <cstring>
+#include <cstdlib>
+#include "config.h"
+
+static void check_token (const char *text, const char *copy, int len);
+%}
+
+%option 8bit prefix="test"
+%option warn c++ token-view
+%option nounput nomain noinput noyywrap
+
+%%
+
+[[:alpha:]]+	{ check_token(YYText(), yytext, YYLeng()); return 1; }
+[[:digit:]]+	{ check_token(YYText(), yytext, YYLeng()); return 2; }
+.|\n		{ check_token(YYText(), yytext, YYLeng()); }
+
+%%
+
+static void check_token (const char *text, const char *copy, int len)
+{
+    if (std::strlen(text) != (size_t) len || std::strcmp(text, copy) != 0) {
+        std::cerr << "YYText() \"" << text << "\" but yytext \"" << copy << "\"\n";
+        std::exit(1);
+    }
+}
+
+int main(void);
+
+int
+main (void)
+{
+    yyFlexLexer f;
+    f.switch_streams(&std::cin, &std::cout);
+    while (f.yylex() != 0) {
+        /* Not the copy out here, but the token is at the start. */
+        if (f.YYLeng() < 1 || f.YYText()[0] == '\0') {
+            std::cerr << "empty token\n";
+            return 1;
+        }
+    }
+    std::cout << "TEST RETURNING OK." << std::endl;
+    return 0;
+}
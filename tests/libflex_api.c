@@ -0,0 +1,234 @@
+/*
+ * This file is part of flex.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * Neither the name of the University nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.
+ */
+
+/* Generate scanners through libflex: from memory to sinks, with errors
+ * reported through the message callback, from several threads at once,
+ * and many times over in the one process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <config.h>
+#include "libflex.h"
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#define N_THREADS 4
+
+struct text {
+	char   *str;
+	size_t  len;
+};
+
+static const char good[] =
+	"%option noyywrap\n"
+	"%%\n"
+	"[[:digit:]]+\treturn 1;\n"
+	".|\\n\t;\n";
+
+static const char bad[] =
+	"%%\n"
+	"[a-\n";
+
+static void sink (void *cookie, const char *data, size_t len)
+{
+	struct text *t = cookie;
+
+	t->str = realloc (t->str, t->len + len + 1);
+	if (t->str == NULL) {
+		fprintf (stderr, "out of memory\n");
+		exit (1);
+	}
+	memcpy (t->str + t->len, data, len);
+	t->len += len;
+	t->str[t->len] = '\0';
+}
+
+static void message (void *cookie, const char *line)
+{
+	struct text *t = cookie;
+
+	sink (t, line, strlen (line));
+	sink (t, "\n", 1);
+}
+
+/* A generator of text into out, header and msgs, with the given option
+ * as well if it is not NULL.
+ */
+static flex_generator *generator (const char *text, const char *option,
+				  struct text *out, struct text *header,
+				  struct text *msgs)
+{
+	flex_generator *g;
+
+	if ((g = flex_generator_new ()) == NULL ||
+	    flex_generator_add_option (g, "-olibflex_api_scan.c") != 0 ||
+	    flex_generator_add_option (g,
+				       "--header-file=libflex_api_scan.h") != 0 ||
+	    (option != NULL && flex_generator_add_option (g, option) != 0)) {
+		fprintf (stderr, "out of memory\n");
+		exit (1);
+	}
+	flex_generator_set_input (g, "libflex_api.l", text, strlen (text));
+	flex_generator_set_output (g, sink, out);
+	flex_generator_set_header (g, sink, header);
+	flex_generator_set_messages (g, message, msgs);
+	return g;
+}
+
+/* Generate text with option; returns flex's status. */
+static int generate_with (const char *text, const char *option,
+			  struct text *out, struct text *header,
+			  struct text *msgs)
+{
+	flex_generator *g = generator (text, option, out, header, msgs);
+	int     status;
+
+	status = flex_generate (g);
+	flex_generator_free (g);
+	return status;
+}
+
+static int generate (const char *text, struct text *out,
+		     struct text *header, struct text *msgs)
+{
+	return generate_with (text, NULL, out, header, msgs);
+}
+
+static void clear (struct text *t)
+{
+	free (t->str);
+	t->str = NULL;
+	t->len = 0;
+}
+
+static int same (const struct text *a, const struct text *b)
+{
+	return a->len == b->len && memcmp (a->str, b->str, a->len) == 0;
+}
+
+static void check (int ok, const char *what)
+{
+	if (!ok) {
+		fprintf (stderr, "FAILED: %s\n", what);
+		exit (1);
+	}
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *generate_thread (void *arg)
+{
+	struct text *out = arg, header = { NULL, 0 }, msgs = { NULL, 0 };
+
+	if (generate (good, out, &header, &msgs) != 0)
+		out->len = 0;
+	free (header.str);
+	free (msgs.str);
+	return NULL;
+}
+#endif
+
+int main (void)
+{
+	struct text out = { NULL, 0 }, header = { NULL, 0 }, msgs = { NULL, 0 };
+	struct text again = { NULL, 0 }, again_h = { NULL, 0 };
+	flex_generator *g;
+
+	check (generate (good, &out, &header, &msgs) == 0, "good input");
+	check (msgs.len == 0, "no messages for good input");
+	check (strstr (out.str, "yylex") != NULL, "scanner written");
+	check (strstr (out.str, "\"libflex_api_scan.c\"") != NULL &&
+	       strstr (out.str, "\"libflex_api.l\"") != NULL,
+	       "files named in #line directives");
+	check (header.str != NULL && strstr (header.str, "yylex") != NULL,
+	       "header written");
+	check (strstr (out.str, "m4_") == NULL, "m4 expanded");
+	check (access ("libflex_api_scan.c", F_OK) != 0 &&
+	       access ("libflex_api_scan.h", F_OK) != 0, "no files written");
+
+#ifdef HAVE_PTHREAD_H
+	{
+		pthread_t threads[N_THREADS];
+		struct text outs[N_THREADS];
+		int     i;
+
+		for (i = 0; i < N_THREADS; ++i) {
+			outs[i].str = NULL;
+			outs[i].len = 0;
+			check (pthread_create (&threads[i], NULL,
+					       generate_thread, &outs[i]) == 0,
+			       "pthread_create");
+		}
+		for (i = 0; i < N_THREADS; ++i) {
+			pthread_join (threads[i], NULL);
+			check (same (&outs[i], &out),
+			       "same scanner from each thread");
+			free (outs[i].str);
+		}
+	}
+#endif
+
+	/* Each run starts from scratch: the same generator run again, and
+	 * a run after one that failed, give just what the first run did.
+	 */
+	g = generator (good, NULL, &again, &again_h, &msgs);
+	check (flex_generate (g) == 0, "first run of a generator");
+	clear (&again);
+	clear (&again_h);
+	check (flex_generate (g) == 0, "second run of a generator");
+	flex_generator_free (g);
+	check (same (&again, &out) && same (&again_h, &header),
+	       "same scanner from a generator run twice");
+	clear (&again);
+	clear (&again_h);
+
+	check (generate (bad, &again, &again_h, &msgs) == 1, "bad input");
+	check (strncmp (msgs.str, "libflex_api.l:2: ", 17) == 0,
+	       "error reported through the callback");
+	clear (&msgs);
+	clear (&again);
+	clear (&again_h);
+
+	check (generate_with (good, "-j2", &again, &again_h, &msgs) == 0 &&
+	       msgs.len == 0, "good input after bad");
+	check (same (&again, &out) && same (&again_h, &header),
+	       "same scanner after a failed run");
+	clear (&again);
+	clear (&again_h);
+
+	check (generate_with (good, "--m4=m4", &again, &again_h, &msgs) == 1 &&
+	       strstr (msgs.str, "--m4 must be builtin") != NULL,
+	       "only the builtin m4 in process");
+
+	free (out.str);
+	free (header.str);
+	free (msgs.str);
+	free (again.str);
+	free (again_h.str);
+	printf ("TEST RETURNING OK.\n");
+	return 0;
+}
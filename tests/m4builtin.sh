@@ -0,0 +1,38 @@
+#!/bin/sh
+# Generate make productions for the m4builtin_* tests, which build
+# string_nr.l and a header in each table mode, once with the external
+# m4 and once with flex's own, and check that both write the same
+# files.  Like ruleset.sh, this exists because automake can't handle the
+# pattern rules that would be natural here.  Output is written to
+# standard output for inclusion in a Makefile.am.
+set -eu
+
+M4BUILTIN_TESTS=""
+M4BUILTIN_REMOVABLES=""
+
+printf "\n# Begin generated test rules\n\n"
+
+for opt in -Ca -Ce -Cf -CF -Cm ; do
+    # The filenames must work on case-insensitive filesystems.
+    testname=m4builtin_$(echo "${opt#-}" | sed 's/F$/xF/')
+    M4BUILTIN_TESTS="${M4BUILTIN_TESTS} ${testname}"
+    M4BUILTIN_REMOVABLES="${M4BUILTIN_REMOVABLES} ${testname} ${testname}.c ${testname}.first ${testname}.h ${testname}.hfirst"
+    cat << EOF
+${testname}_SOURCES =
+nodist_${testname}_SOURCES = ${testname}.c
+${testname}.c: \$(srcdir)/string_nr.l \$(FLEX)
+	\$(AM_V_LEX)\$(FLEX) \$(TESTOPTS) ${opt} --header-file=${testname}.h -o \$@ \$(srcdir)/string_nr.l
+	\$(AM_V_at)mv \$@ ${testname}.first
+	\$(AM_V_at)mv ${testname}.h ${testname}.hfirst
+	\$(AM_V_at)\$(FLEX) \$(TESTOPTS) --m4=builtin ${opt} --header-file=${testname}.h -o \$@ \$(srcdir)/string_nr.l
+	\$(AM_V_at)cmp ${testname}.first \$@
+	\$(AM_V_at)cmp ${testname}.hfirst ${testname}.h
+
+EOF
+done
+
+printf "# End generated test rules\n"
+
+echo M4BUILTIN_TESTS = "${M4BUILTIN_TESTS}"
+echo M4BUILTIN_REMOVABLES = "${M4BUILTIN_REMOVABLES}"
+echo
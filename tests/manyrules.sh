@@ -0,0 +1,102 @@
+#! /bin/sh
+# Generate a scanner with more rules than the 8192 the trailing context
+# masks once left room for.  The last rules have variable trailing
+# context, so their numbers must stay clear of YY_TRAILING_MASK and
+# YY_TRAILING_HEAD_MASK.  main() checks the rule and length of each token.
+set -eu
+
+RULES=9000
+
+cat <<'EOF'
+/*
+ * This file is part of flex.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * Neither the name of the University nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.
+ */
+
+/* Generated by manyrules.sh. */
+
+%{
+#include <stdio.h>
+#include <stdlib.h>
+#include "config.h"
+%}
+
+%option 8bit prefix="test"
+%option nounput nomain nodefault noyywrap noinput
+%option warn
+
+%%
+
+EOF
+
+# Each rule returns its own number.
+i=1
+while [ $i -le $RULES ] ; do
+    printf 'kw%d\treturn %d;\n' $i $i
+    i=$((i+1))
+done
+
+cat <<EOF
+a+/b+c	return $((RULES+1));
+x[0-9]+/y*z	return $((RULES+2));
+[0-9]+/[d-f]+!	return $((RULES+3));
+" "	;
+.	return -1;
+
+%%
+
+/* Each token of the input, as the rule it matches and its length. */
+static const struct {
+    int rule, leng;
+} expected[] = {
+    {1, 3}, {8191, 6}, {8192, 6}, {8193, 6}, {$RULES, 6},
+    {$((RULES+1)), 3}, {-1, 1}, {-1, 1}, {-1, 1},
+    {$((RULES+2)), 3}, {-1, 1}, {-1, 1}, {-1, 1},
+    {$((RULES+2)), 2}, {-1, 1},
+    {$((RULES+3)), 4}, {-1, 1}, {-1, 1}, {-1, 1},
+    {$((RULES+3)), 1}, {-1, 1}, {-1, 1}, {-1, 1}, {-1, 1},
+};
+
+int main(void);
+
+int main (void)
+{
+    size_t n = sizeof expected / sizeof expected[0], i;
+    int rule;
+
+    test_scan_string("kw1 kw8191 kw8192 kw8193 kw$RULES aaabbc x12yyz x7z"
+                     " 1234ff! 7def!");
+    for (i = 0; (rule = testlex()) != 0; ++i) {
+        if (i >= n || rule != expected[i].rule || testleng != expected[i].leng) {
+            fprintf(stderr, "token %lu: rule %d, length %d\n",
+                    (unsigned long) i, rule, (int) testleng);
+            exit(1);
+        }
+    }
+    if (i != n) {
+        fprintf(stderr, "%lu tokens, expected %lu\n",
+                (unsigned long) i, (unsigned long) n);
+        exit(1);
+    }
+    printf("TEST RETURNING OK.\n");
+    return 0;
+}
+EOF
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Generate make productions for the resume_* tests, which build
+# resume_<backend>.l in each table mode.  Pass it a list of back-end
+# suffixes.  Like ruleset.sh, this exists because automake can't handle
+# the pattern rules that would be natural here.  Output is written to
+# standard output for inclusion in a Makefile.am.
+set -eu
+
+RESUME_TESTS=""
+RESUME_REMOVABLES=""
+TABLE_OPTS="-Ca -Ce -Cf -CF -Cm"
+
+# The filenames must work on case-insensitive filesystems.
+bare() {
+    echo "${1#-}" | sed 's/F$/xF/'
+}
+
+printf "\n# Begin generated test rules\n\n"
+
+# resume_<backend>_* scan tokens that span many refills of a tiny
+# buffer, in each table mode.
+for backend in "$@" ; do
+    for opt in ${TABLE_OPTS} ; do
+        testname=resume_${backend}_$(bare "${opt}")
+        RESUME_TESTS="${RESUME_TESTS} ${testname}"
+        RESUME_REMOVABLES="${RESUME_REMOVABLES} ${testname} ${testname}.c"
+        cat << EOF
+${testname}_SOURCES =
+nodist_${testname}_SOURCES = ${testname}.c
+${testname}.c: \$(srcdir)/resume_${backend}.l \$(FLEX)
+	\$(AM_V_LEX)\$(FLEX) \$(TESTOPTS) ${opt} -o \$@ \$(srcdir)/resume_${backend}.l
+
+EOF
+    done
+done
+
+printf "# End generated test rules\n"
+
+echo RESUME_TESTS = "${RESUME_TESTS}"
+echo RESUME_REMOVABLES = "${RESUME_REMOVABLES}"
+echo